@@ -0,0 +1,577 @@
+/**
+ * @file
+ * A work-stealing driver that parses many files in parallel.
+ *
+ * @verbatim
+ * SPSPS
+ * Stacy's Pathetically Simple Parsing System
+ * https://github.com/sprowell/spsps
+ *
+ * Copyright (c) 2014, Stacy Prowell
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * @endverbatim
+ */
+
+#include "batch.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#if defined(__unix__) || defined(__unix) || defined(__APPLE__)
+#  define SPSPS_HAVE_MMAP
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+// The workers are threads where read-ahead has them too.  Elsewhere the
+// batch is parsed on the calling thread.
+#if defined(__linux__) || defined(__FreeBSD__)
+#  define SPSPS_HAVE_THREADS
+#  include <pthread.h>
+#  include <stdatomic.h>
+#  define SPSPS_ATOMIC_(m_type) _Atomic m_type
+#else
+#  define SPSPS_ATOMIC_(m_type) m_type
+#endif
+
+//======================================================================
+// Definition of the batch structs.
+//======================================================================
+
+/**
+ * A file that has been read into memory.  It is shared by the jobs for its
+ * pieces, and released by whichever finishes last.
+ */
+typedef struct spsps_batch_file_ {
+	/// The characters of the file.
+	const SPSPS_CHAR * data;
+	/// The number of characters.
+	size_t length;
+	/// The number of bytes mapped at data, or zero if it is not a mapping.
+	size_t mapped;
+	/// The number of jobs still using the file.
+	SPSPS_ATOMIC_(size_t) refs;
+} spsps_batch_file_;
+
+/**
+ * A file, or a piece of one, to parse.
+ */
+typedef struct spsps_batch_job_ {
+	/// The index of the file in the list of paths.
+	size_t index;
+	/// The file, or NULL if it has not been read yet.
+	spsps_batch_file_ * file;
+	/// Which piece of the file this is.
+	size_t piece;
+	/// How many pieces there are.
+	size_t pieces;
+	/// The offset of the piece.
+	size_t offset;
+	/// The length of the piece.
+	size_t length;
+} spsps_batch_job_;
+
+/**
+ * The jobs of one worker.  The worker takes the newest job from the tail,
+ * and other workers steal the oldest from the head.  A lock is enough here:
+ * each worker mostly touches only its own deque, so it is rarely contended.
+ */
+typedef struct spsps_deque_ {
+#ifdef SPSPS_HAVE_THREADS
+	/// Guards the deque.
+	pthread_mutex_t lock;
+#endif
+	/// The jobs.
+	spsps_batch_job_ * jobs;
+	/// The index of the oldest job.
+	size_t head;
+	/// The index past the newest job.
+	size_t tail;
+	/// The capacity of jobs.
+	size_t capacity;
+} spsps_deque_;
+
+/**
+ * A batch being parsed.
+ */
+typedef struct spsps_batch_ {
+	/// The files.
+	char ** paths;
+	/// The rule.
+	spsps_rule rule;
+	/// The result callback.
+	spsps_batch_result result;
+	/// The context for the rule and callbacks.
+	void * context;
+	/// The split function, or NULL.
+	spsps_batch_split split;
+	/// The length of a piece.
+	size_t piece;
+	/// A deque for each worker.
+	spsps_deque_ * deques;
+	/// The number of workers.
+	size_t workers;
+	/// The number of jobs not finished.
+	SPSPS_ATOMIC_(size_t) pending;
+	/// The number of files that could not be read.
+	SPSPS_ATOMIC_(size_t) failed;
+#ifdef SPSPS_HAVE_THREADS
+	/// Guards the wait for work.
+	pthread_mutex_t idle_lock;
+	/// Signalled when pieces are scheduled or the last job finishes.
+	pthread_cond_t work;
+	/// Counts the signals, so that an idle worker misses none.
+	SPSPS_ATOMIC_(size_t) posted;
+#endif
+} spsps_batch_;
+
+/**
+ * What a worker thread is given.
+ */
+typedef struct spsps_worker_ {
+	/// The batch.
+	spsps_batch_ * batch;
+	/// Which worker this is.
+	size_t id;
+#ifdef SPSPS_HAVE_THREADS
+	/// The thread.
+	pthread_t thread;
+#endif
+} spsps_worker_;
+
+//======================================================================
+// Helper functions.
+//======================================================================
+
+/**
+ * Add a job to the tail of a deque.
+ * @param deque			The deque.
+ * @param job			The job.
+ */
+static void
+spsps_deque_push_(spsps_deque_ * deque, spsps_batch_job_ job) {
+#ifdef SPSPS_HAVE_THREADS
+	pthread_mutex_lock(&deque->lock);
+#endif
+	if (deque->tail == deque->capacity) {
+		if (deque->head > 0) {
+			// Reuse the space at the front.
+			memmove(deque->jobs, deque->jobs + deque->head,
+					(deque->tail - deque->head) * sizeof(spsps_batch_job_));
+			deque->tail -= deque->head;
+			deque->head = 0;
+		} else {
+			size_t capacity = deque->capacity > 0 ? 2 * deque->capacity : 16;
+			deque->jobs = (spsps_batch_job_ *) realloc(deque->jobs,
+					capacity * sizeof(spsps_batch_job_));
+			deque->capacity = capacity;
+		}
+	}
+	deque->jobs[deque->tail++] = job;
+#ifdef SPSPS_HAVE_THREADS
+	pthread_mutex_unlock(&deque->lock);
+#endif
+}
+
+/**
+ * Take a job from a deque: the newest if it is the worker's own, or the
+ * oldest if it is being stolen.
+ * @param deque			The deque.
+ * @param steal			Whether to take the oldest job.
+ * @param job			Set to the job.
+ * @return				True iff there was a job.
+ */
+static bool
+spsps_deque_take_(spsps_deque_ * deque, bool steal, spsps_batch_job_ * job) {
+	bool found = false;
+#ifdef SPSPS_HAVE_THREADS
+	pthread_mutex_lock(&deque->lock);
+#endif
+	if (deque->head < deque->tail) {
+		*job = steal ? deque->jobs[deque->head++] : deque->jobs[--deque->tail];
+		found = true;
+	}
+#ifdef SPSPS_HAVE_THREADS
+	pthread_mutex_unlock(&deque->lock);
+#endif
+	return found;
+}
+
+/**
+ * Wake the idle workers, because there are new jobs or no jobs are left.
+ * @param batch			The batch.
+ */
+static void
+spsps_batch_wake_(spsps_batch_ * batch) {
+#ifdef SPSPS_HAVE_THREADS
+	pthread_mutex_lock(&batch->idle_lock);
+	atomic_fetch_add_explicit(&batch->posted, 1, memory_order_release);
+	pthread_cond_broadcast(&batch->work);
+	pthread_mutex_unlock(&batch->idle_lock);
+#else
+	(void) batch;
+#endif
+}
+
+/**
+ * Read a file into memory, by mapping it where that is possible.
+ * @param path			The path of the file.
+ * @return				The file, or NULL if it cannot be read.
+ */
+static spsps_batch_file_ *
+spsps_batch_read_(const char * path) {
+	spsps_batch_file_ * file = (spsps_batch_file_ *) calloc(1,
+			sizeof(spsps_batch_file_));
+	if (file == NULL) return NULL;
+#ifdef SPSPS_HAVE_MMAP
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		free(file);
+		return NULL;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		free(file);
+		return NULL;
+	}
+	size_t bytes = (size_t) info.st_size;
+	if (bytes > 0) {
+		void * data = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			free(file);
+			return NULL;
+		}
+		file->data = (const SPSPS_CHAR *) data;
+		file->mapped = bytes;
+	}
+	close(fd);
+#else
+	FILE * stream = fopen(path, "rb");
+	if (stream == NULL) {
+		free(file);
+		return NULL;
+	}
+	fseek(stream, 0, SEEK_END);
+	long end = ftell(stream);
+	fseek(stream, 0, SEEK_SET);
+	size_t bytes = end > 0 ? (size_t) end : 0;
+	if (bytes > 0) {
+		void * data = malloc(bytes);
+		if (data == NULL || fread(data, 1, bytes, stream) != bytes) {
+			free(data);
+			fclose(stream);
+			free(file);
+			return NULL;
+		}
+		file->data = (const SPSPS_CHAR *) data;
+	}
+	fclose(stream);
+#endif
+	file->length = bytes / sizeof(SPSPS_CHAR);
+	return file;
+}
+
+/**
+ * Let go of a file.  The last job to let go releases it.
+ * @param file			The file.
+ */
+static void
+spsps_batch_drop_(spsps_batch_file_ * file) {
+#ifdef SPSPS_HAVE_THREADS
+	if (atomic_fetch_sub_explicit(&file->refs, 1, memory_order_acq_rel) > 1) {
+		return;
+	}
+#else
+	if (--file->refs > 0) return;
+#endif
+#ifdef SPSPS_HAVE_MMAP
+	if (file->mapped > 0) munmap((void *) file->data, file->mapped);
+#else
+	free((void *) file->data);
+#endif
+	free(file);
+}
+
+/**
+ * Read the file of a job and, if it is large and the grammar allows, split
+ * it into pieces.  The job, which starts as the only piece, becomes the
+ * first piece, and the rest are added to the worker's deque, where idle
+ * workers can steal them.
+ * @param batch			The batch.
+ * @param id			The worker.
+ * @param job			The job.
+ * @return				True iff the file could be read.
+ */
+static bool
+spsps_batch_open_(spsps_batch_ * batch, size_t id, spsps_batch_job_ * job) {
+	spsps_batch_file_ * file = spsps_batch_read_(batch->paths[job->index]);
+	if (file == NULL) return false;
+	job->file = file;
+	job->offset = 0;
+	job->length = file->length;
+	size_t * cuts = NULL;
+	if (batch->split != NULL && file->length > batch->piece) {
+		// Find where each piece starts.  A split function that makes no
+		// progress ends the splitting.
+		size_t capacity = file->length / batch->piece + 2;
+		cuts = (size_t *) malloc(capacity * sizeof(size_t));
+		size_t start = 0;
+		while (cuts != NULL && job->pieces < capacity &&
+				file->length - start > batch->piece) {
+			size_t cut = batch->split(batch->context, file->data,
+					file->length, start + batch->piece);
+			if (cut <= start || cut >= file->length) break;
+			cuts[job->pieces++] = cut;
+			start = cut;
+		} // Find the pieces.
+	}
+#ifdef SPSPS_HAVE_THREADS
+	atomic_init(&file->refs, job->pieces);
+	atomic_fetch_add_explicit(&batch->pending, job->pieces - 1,
+			memory_order_relaxed);
+#else
+	file->refs = job->pieces;
+	batch->pending += job->pieces - 1;
+#endif
+	if (job->pieces > 1) {
+		cuts[0] = 0;
+		for (size_t piece = job->pieces - 1; piece > 0; --piece) {
+			spsps_batch_job_ rest = *job;
+			rest.piece = piece;
+			rest.offset = cuts[piece];
+			rest.length = ((piece + 1 < job->pieces) ? cuts[piece + 1] :
+					file->length) - cuts[piece];
+			spsps_deque_push_(&batch->deques[id], rest);
+		} // Schedule the other pieces.
+		job->length = cuts[1];
+		spsps_batch_wake_(batch);
+	}
+	free(cuts);
+	return true;
+}
+
+/**
+ * The body of a worker.  Take jobs from the worker's own deque, or steal
+ * them from the others, until every job is finished.
+ * @param arg			The worker.
+ * @return				NULL.
+ */
+static void *
+spsps_batch_main_(void * arg) {
+	spsps_worker_ * worker = (spsps_worker_ *) arg;
+	spsps_batch_ * batch = worker->batch;
+	Parser parser = NULL;
+	while (true) {
+#ifdef SPSPS_HAVE_THREADS
+		if (atomic_load_explicit(&batch->pending, memory_order_acquire) == 0) {
+			break;
+		}
+#else
+		if (batch->pending == 0) break;
+#endif
+#ifdef SPSPS_HAVE_THREADS
+		size_t seen = atomic_load_explicit(&batch->posted,
+				memory_order_acquire);
+#endif
+		spsps_batch_job_ job;
+		bool found = spsps_deque_take_(&batch->deques[worker->id], false, &job);
+		for (size_t step = 1; ! found && step < batch->workers; ++step) {
+			found = spsps_deque_take_(
+					&batch->deques[(worker->id + step) % batch->workers], true,
+					&job);
+		} // Steal from the others.
+		if (! found) {
+#ifdef SPSPS_HAVE_THREADS
+			// Others are still working, and may yet split off pieces.  Sleep
+			// until they do, or until the last job is finished.
+			pthread_mutex_lock(&batch->idle_lock);
+			while (atomic_load_explicit(&batch->posted,
+					memory_order_acquire) == seen &&
+					atomic_load_explicit(&batch->pending,
+					memory_order_acquire) > 0) {
+				pthread_cond_wait(&batch->work, &batch->idle_lock);
+			} // Wait for work.
+			pthread_mutex_unlock(&batch->idle_lock);
+#endif
+			continue;
+		}
+
+		spsps_batch_item item;
+		item.index = job.index;
+		item.path = batch->paths[job.index];
+		item.opened = job.file != NULL ||
+				spsps_batch_open_(batch, worker->id, &job);
+		item.piece = job.piece;
+		item.pieces = job.pieces;
+		item.offset = job.offset;
+		item.length = job.length;
+		item.parser = NULL;
+		if (! item.opened) {
+#ifdef SPSPS_HAVE_THREADS
+			atomic_fetch_add_explicit(&batch->failed, 1, memory_order_relaxed);
+#else
+			batch->failed++;
+#endif
+			batch->result(batch->context, &item, NULL);
+		} else {
+			const SPSPS_CHAR * data = job.file->data != NULL ?
+					job.file->data + job.offset : NULL;
+			if (parser == NULL) {
+				parser = spsps_acquire_buffer(item.path, data, job.length);
+			} else {
+				spsps_reset_buffer(parser, item.path, data, job.length);
+			}
+			void * value = batch->rule(parser, batch->context);
+			item.parser = parser;
+			batch->result(batch->context, &item, value);
+			spsps_batch_drop_(job.file);
+		}
+#ifdef SPSPS_HAVE_THREADS
+		if (atomic_fetch_sub_explicit(&batch->pending, 1,
+				memory_order_acq_rel) == 1) {
+			spsps_batch_wake_(batch);
+		}
+#else
+		batch->pending--;
+#endif
+	} // Work until everything is done.
+	if (parser != NULL) spsps_release(parser);
+	return NULL;
+}
+
+/**
+ * The body of a worker thread, which must also drain the parser pool of its
+ * thread before the thread exits.
+ * @param arg			The worker.
+ * @return				NULL.
+ */
+#ifdef SPSPS_HAVE_THREADS
+static void *
+spsps_batch_thread_(void * arg) {
+	spsps_batch_main_(arg);
+	spsps_pool_drain();
+	return NULL;
+}
+#endif
+
+//======================================================================
+// Implementation of public interface.
+//======================================================================
+
+size_t
+spsps_parse_batch(char ** paths, size_t n, spsps_rule rule,
+		spsps_batch_result result, void * context, size_t threads) {
+	spsps_batch_options options = { 0 };
+	options.threads = threads;
+	return spsps_parse_batch_ex(paths, n, rule, result, context, &options);
+}
+
+size_t
+spsps_parse_batch_ex(char ** paths, size_t n, spsps_rule rule,
+		spsps_batch_result result, void * context,
+		const spsps_batch_options * options) {
+	if (n == 0) return 0;
+	spsps_batch_ batch;
+	batch.paths = paths;
+	batch.rule = rule;
+	batch.result = result;
+	batch.context = context;
+	batch.split = (options != NULL) ? options->split : NULL;
+	batch.piece = (options != NULL && options->piece > 0) ? options->piece :
+			(1 << 20) / sizeof(SPSPS_CHAR);
+	batch.workers = (options != NULL) ? options->threads : 0;
+#ifdef SPSPS_HAVE_THREADS
+	if (batch.workers == 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		batch.workers = (online > 0) ? (size_t) online : 1;
+	}
+	// There is no use for more workers than files, unless files are split.
+	if (batch.split == NULL && batch.workers > n) batch.workers = n;
+	atomic_init(&batch.pending, n);
+	atomic_init(&batch.failed, 0);
+	atomic_init(&batch.posted, 0);
+	pthread_mutex_init(&batch.idle_lock, NULL);
+	pthread_cond_init(&batch.work, NULL);
+#else
+	batch.workers = 1;
+	batch.pending = n;
+	batch.failed = 0;
+#endif
+
+	// Deal the files out to the workers.
+	batch.deques = (spsps_deque_ *) calloc(batch.workers, sizeof(spsps_deque_));
+	spsps_worker_ * workers = (spsps_worker_ *) calloc(batch.workers,
+			sizeof(spsps_worker_));
+	for (size_t id = 0; id < batch.workers; ++id) {
+#ifdef SPSPS_HAVE_THREADS
+		pthread_mutex_init(&batch.deques[id].lock, NULL);
+#endif
+		workers[id].batch = &batch;
+		workers[id].id = id;
+	} // Set up the workers.
+	for (size_t index = n; index > 0; --index) {
+		spsps_batch_job_ job;
+		memset(&job, 0, sizeof(job));
+		job.index = index - 1;
+		// A file is one piece until it is read and split.
+		job.pieces = 1;
+		spsps_deque_push_(&batch.deques[job.index % batch.workers], job);
+	} // Deal the files, so that each worker takes its first file first.
+
+	// The calling thread is the first worker.
+#ifdef SPSPS_HAVE_THREADS
+	size_t started = 1;
+	for (; started < batch.workers; ++started) {
+		if (pthread_create(&workers[started].thread, NULL,
+				spsps_batch_thread_, &workers[started]) != 0) {
+			break;
+		}
+	} // Start the other workers.
+	spsps_batch_main_(&workers[0]);
+	for (size_t id = 1; id < started; ++id) {
+		pthread_join(workers[id].thread, NULL);
+	} // Wait for the other workers.
+	size_t failed = atomic_load(&batch.failed);
+	pthread_cond_destroy(&batch.work);
+	pthread_mutex_destroy(&batch.idle_lock);
+#else
+	spsps_batch_main_(&workers[0]);
+	size_t failed = batch.failed;
+#endif
+
+	for (size_t id = 0; id < batch.workers; ++id) {
+#ifdef SPSPS_HAVE_THREADS
+		pthread_mutex_destroy(&batch.deques[id].lock);
+#endif
+		free(batch.deques[id].jobs);
+	} // Tear down the workers.
+	free(batch.deques);
+	free(workers);
+	return failed;
+}
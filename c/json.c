@@ -36,11 +36,11 @@
 
 #define SPSPS_SHORTHAND
 #include "parser.h"
+#include "parser_inline.h"
 #include "json.h"
 #include "xstring.h"
 #include <string.h>
 #include <math.h>
-#include <ctype.h>
 
 /**
  * Come here to read a JSON value from the stream.  Leading whitespace is
@@ -73,11 +73,10 @@ static json_value * parse_string(Parser parser);
  * Come here to parse a number.  The first character in the stream is
  * expected to be the first character of the number.  This could be a
  * minus sign, or it could be a digit.  There must be at least one
- * digit.  The digits are interpreted in base 10, and stored in a
- * C `int`.
+ * digit.  The value is the correctly rounded double.
  * @verbatim
- * number = '-'? ( '0'..'9' )+
- * double = n
+ * number = '-'? digits ( '.' digits )? ( ( 'e' | 'E' ) ( '+' | '-' )? digits )?
+ * digits = ( '0'..'9' )+
  * @endverbatim
  * @param parser			The parser.
  * @return					The number or NULL on error.
@@ -115,7 +114,7 @@ json_parse_value(Parser parser) {
 	// The next thing in the stream must be a quotation mark (a string), a
 	// minus sign or digit (number), a curly brace (object) or a square
 	// bracket (array).  It might also be true, false, or null.  That's it!
-	SPSPS_CHAR ch = spsps_peek(parser);
+	SPSPS_CHAR ch = spsps_peek_inline(parser);
 	switch (ch) {
 	case '"':
 		return parse_string(parser);
@@ -154,7 +153,7 @@ json_parse_value(Parser parser) {
 		}
 	default:
 		// Check for a digit.
-		if (isdigit(ch)) {
+		if (spsps_class_has(SPSPS_DIGIT, ch)) {
 			return parse_number(parser);
 		} else {
 			SPSPS_ERR(parser, "Expected to find a value, but instead found "
@@ -186,6 +185,21 @@ unhex_(char ch) {
 	}
 }
 
+/**
+ * Append a run of characters to a mutable string.
+ * @param str				The string, or NULL for the empty string.
+ * @param run				The characters to append.
+ * @param length			The number of characters.
+ * @return					The string.
+ */
+static mstring
+append_run_(mstring str, const SPSPS_CHAR * run, size_t length) {
+	for (size_t index = 0; index < length; ++index) {
+		str = mstr_append(str, run[index]);
+	} // Append all characters.
+	return str;
+}
+
 static json_value *
 parse_string(Parser parser) {
 	// The first thing in the stream must be the quotation mark.
@@ -194,114 +208,89 @@ parse_string(Parser parser) {
 				"but instead found %s.", spsps_printchar(spsps_peek(parser)));
 		return NULL;
 	}
-	// Read the rest of the string.
+	// Read the rest of the string.  Runs of ordinary characters are taken
+	// straight from the parser's buffer; only escapes need the mstring.
 	mstring str = NULL;
 	SPSPS_CHAR highc, lowc;
 	char high, low;
-	while (! spsps_peek_and_consume(parser, "\"") && !spsps_eof(parser)) {
-		if (spsps_peek_and_consume(parser, "\\")) {
-			// Process an escape.
-			SPSPS_CHAR ch = spsps_consume(parser);
-			switch (ch) {
-			case 'n':
-				str = mstr_append(str, '\n');
-				break;
-			case 'r':
-				str = mstr_append(str, '\r');
-				break;
-			case 't':
-				str = mstr_append(str, '\t');
-				break;
-			case '\r':
-				spsps_peek_and_consume(parser, "\n");
-				break;
-			case '\n':
-				break;
-			case 'x':
-				// Extract the two hexadecimal characters.
-				highc = spsps_consume(parser);
-				lowc = spsps_consume(parser);
-				high = unhex_(highc);
-				low = unhex_(lowc);
-				if (high > 15) {
-					SPSPS_ERR(parser, "Expected to find two hexadecimal digits "
-							"in an escape (starting with \\x) but "
-							"instead found %s.", spsps_printchar(highc));
-				}
-				if (low > 15) {
-					SPSPS_ERR(parser, "Expected to find two hexadecimal digits "
-							"in an escape (starting with \\x) but "
-							"instead found %s.", spsps_printchar(lowc));
-				}
-				str = mstr_append(str, (char) ((high << 4)|low));
-				break;
-			default:
-				str = mstr_append(str, ch);
-				break;
+	const SPSPS_CHAR * run;
+	size_t length;
+	Mark mark = spsps_mark(parser);
+	while (true) {
+		spsps_consume_until(parser, "\"\\");
+		run = spsps_slice(parser, mark, &length);
+		SPSPS_CHAR ch = spsps_peek_inline(parser);
+		if (ch == '"' && str == NULL) {
+			// The usual case is no escapes, and then a single copy does it.
+			char * cstring = (char *) malloc(length + 1);
+			for (size_t index = 0; index < length; ++index) {
+				cstring[index] = (char) run[index];
+			} // Copy the characters.
+			cstring[length] = 0;
+			spsps_unmark(parser, mark);
+			spsps_consume_inline(parser);
+			return json_new_string(cstring);
+		}
+		str = append_run_(str, run, length);
+		spsps_unmark(parser, mark);
+		// Consume the closing quotation mark, the backslash, or the end
+		// of file.
+		spsps_consume_inline(parser);
+		if (ch != '\\') break;
+		// Process an escape.
+		ch = spsps_consume_inline(parser);
+		switch (ch) {
+		case 'n':
+			str = mstr_append(str, '\n');
+			break;
+		case 'r':
+			str = mstr_append(str, '\r');
+			break;
+		case 't':
+			str = mstr_append(str, '\t');
+			break;
+		case '\r':
+			spsps_peek_and_consume(parser, "\n");
+			break;
+		case '\n':
+			break;
+		case 'x':
+			// Extract the two hexadecimal characters.
+			highc = spsps_consume_inline(parser);
+			lowc = spsps_consume_inline(parser);
+			high = unhex_(highc);
+			low = unhex_(lowc);
+			if (high > 15) {
+				SPSPS_ERR(parser, "Expected to find two hexadecimal digits "
+						"in an escape (starting with \\x) but "
+						"instead found %s.", spsps_printchar(highc));
 			}
-		} else {
-			str = mstr_append(str, spsps_consume(parser));
+			if (low > 15) {
+				SPSPS_ERR(parser, "Expected to find two hexadecimal digits "
+						"in an escape (starting with \\x) but "
+						"instead found %s.", spsps_printchar(lowc));
+			}
+			str = mstr_append(str, (char) ((high << 4)|low));
+			break;
+		default:
+			str = mstr_append(str, ch);
+			break;
 		}
-	} // Loop over the characters in the string.
-	char * cstring = mstr_cstr(str);
+		mark = spsps_mark(parser);
+	} // Loop over the runs in the string.
+	char * cstring = mstr_cstr_f(str);
 	return json_new_string(cstring);
 }
 
-static int
-parse_integer_(Parser parser, int *digits) {
-	*digits = 0;
-	if (! isdigit(spsps_peek(parser))) {
-		SPSPS_ERR(parser, "Expected to find a digit, but instead found %s.",
-				  spsps_printchar(spsps_peek(parser)));
-		return 0;
-	}
-	int value = 0;
-	do {
-		value *= 10;
-		value += spsps_consume(parser) - '0';
-		*digits += 1;
-	} while (isdigit(spsps_peek(parser))); // Parse all digits.
-	return value;
-}
-
 static json_value *
 parse_number(Parser parser) {
-	// Build the number by consuming the digits.
-	bool neg = spsps_peek_and_consume(parser, "-");
-	// Consume the integer portion of the number.  There must be a digit.
-	int digits = 0;
-	double value = (double) parse_integer_(parser, &digits);
-	if (digits == 0) {
+	// The library converts the number in place, correctly rounded.
+	double value;
+	if (! spsps_parse_double(parser, &value)) {
+		SPSPS_ERR(parser, "Expected to find a digit, but instead found %s.",
+				  spsps_printchar(spsps_peek(parser)));
 		return NULL;
 	}
-	// See what the next character is.
-	if (spsps_peek_and_consume(parser, ".")) {
-		// We have found a fractional part.  Parse it.
-		double fracpart = (double) parse_integer_(parser, &digits);
-		if (digits == 0) {
-			return NULL;
-		}
-		value += fracpart / pow(10, digits);
-	}
-	if (spsps_peek_and_consume(parser, "E") || spsps_peek_and_consume(parser, "e")) {
-		// We have found an exponent part.  Parse it.
-		SPSPS_CHAR ch = spsps_peek(parser);
-		bool negexp = false;
-		if (ch == '-') {
-			negexp = true;
-			spsps_consume(parser);
-		} else if (ch == '+') {
-			spsps_consume(parser);
-		}
-		double exppart = (double) parse_integer_(parser, &digits);
-		if (digits == 0) {
-			return NULL;
-		}
-		if (negexp) exppart = -exppart;
-		value *= pow(10, exppart);
-	}
-	// Now possibly negate the number.
-	if (neg) value = -value;
 	return json_new_number(value);
 }
 
@@ -346,7 +335,7 @@ parse_object(Parser parser) {
 	spsps_consume_whitespace(parser);
 	// Now consume a (potentially empty) comma-separated list of pairs.
 	json_object * object = NULL;
-	while (! spsps_eof(parser) && spsps_peek(parser) != '}') {
+	while (! spsps_eof(parser) && spsps_peek_inline(parser) != '}') {
 		spsps_consume_whitespace(parser);
 		// Expect to find the start of a pair.
 		json_value * keyval = parse_string(parser);
@@ -384,7 +373,7 @@ parse_object(Parser parser) {
 		// Look for a comma.
 		if (spsps_peek_and_consume(parser, ",")) {
 			// Found the comma.  This is good.
-		} else if (spsps_peek(parser) != '}') {
+		} else if (spsps_peek_inline(parser) != '}') {
 			SPSPS_ERR(parser, "Expected to find either a comma or the "
 					"end of the object (a curly brace), but instead "
 					"found %s.  Did you forget a comma?",
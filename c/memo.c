@@ -0,0 +1,263 @@
+/**
+ * @file
+ * Implementation of the packrat memo table.
+ *
+ * @verbatim
+ * SPSPS
+ * Stacy's Pathetically Simple Parsing System
+ * https://github.com/sprowell/spsps
+ *
+ * Copyright (c) 2014, Stacy Prowell
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * @endverbatim
+ */
+
+#include "memo.h"
+#include <stdlib.h>
+#include <string.h>
+
+/// The initial number of slots in a table.  Must be a power of two.
+#define SPSPS_MEMO_SLOTS 64
+
+/**
+ * An entry in the table.
+ */
+typedef struct spsps_memo_entry_ {
+	/// The offset at which the rule started.
+	uint64_t start;
+	/// The offset at which the rule stopped.
+	uint64_t end;
+	/// The value the rule produced.
+	void * value;
+	/// The rule identifier.
+	unsigned rule;
+	/// Whether this slot is in use.
+	bool used;
+} spsps_memo_entry_;
+
+struct spsps_memo_ {
+	/// The slots.  This is an open-addressing table with linear probing.
+	spsps_memo_entry_ * slots;
+	/// The number of slots.  Always a power of two.
+	size_t capacity;
+	/// The number of slots in use.
+	size_t count;
+	/// How far behind the latest start to keep entries, or zero for all.
+	uint64_t window;
+	/// The latest start stored.
+	uint64_t latest;
+	/// Called on discarded values, if not NULL.
+	void (* release)(void *);
+	/// The number of rules.
+	size_t rules;
+	/// The counts for each rule.
+	spsps_memo_stats * stats;
+};
+
+//======================================================================
+// Private functions.
+//======================================================================
+
+/**
+ * Find the slot to start probing for a key.
+ * @param memo			The table.
+ * @param rule			The rule identifier.
+ * @param start			The start offset.
+ * @return				The slot index.
+ */
+static size_t
+spsps_memo_hash_(Memo memo, unsigned rule, uint64_t start) {
+	// Mix the two together; the multiplier spreads nearby offsets out.
+	uint64_t key = (start ^ ((uint64_t) rule << 48)) * 0x9e3779b97f4a7c15ULL;
+	return (size_t) (key >> 32) & (memo->capacity - 1);
+}
+
+/**
+ * Whether an entry lies outside the window.
+ * @param memo			The table.
+ * @param start			The start offset of the entry.
+ * @return				True iff the entry should be discarded.
+ */
+static bool
+spsps_memo_stale_(Memo memo, uint64_t start) {
+	return memo->window > 0 && start + memo->window < memo->latest;
+}
+
+/**
+ * Discard a value, counting the eviction.
+ * @param memo			The table.
+ * @param entry			The entry being discarded.
+ * @param evicted		Whether to count this as an eviction.
+ */
+static void
+spsps_memo_discard_(Memo memo, spsps_memo_entry_ * entry, bool evicted) {
+	if (memo->release != NULL) memo->release(entry->value);
+	if (evicted && entry->rule < memo->rules) {
+		memo->stats[entry->rule].evictions++;
+	}
+	entry->used = false;
+}
+
+/**
+ * Put an entry into its slot.  The table must have a free slot, and must not
+ * already hold the key.
+ * @param memo			The table.
+ * @param entry			The entry.
+ */
+static void
+spsps_memo_place_(Memo memo, const spsps_memo_entry_ * entry) {
+	size_t index = spsps_memo_hash_(memo, entry->rule, entry->start);
+	while (memo->slots[index].used) {
+		index = (index + 1) & (memo->capacity - 1);
+	} // Find a free slot.
+	memo->slots[index] = *entry;
+	memo->count++;
+}
+
+/**
+ * Rebuild the table, dropping everything outside the window, and growing it
+ * if it is still more than half full.
+ * @param memo			The table.
+ */
+static void
+spsps_memo_rebuild_(Memo memo) {
+	spsps_memo_entry_ * old = memo->slots;
+	size_t capacity = memo->capacity;
+	size_t live = 0;
+	for (size_t index = 0; index < capacity; ++index) {
+		if (! old[index].used) continue;
+		if (spsps_memo_stale_(memo, old[index].start)) {
+			spsps_memo_discard_(memo, &old[index], true);
+		} else {
+			++live;
+		}
+	} // Drop the stale entries.
+	while (live * 2 >= memo->capacity) memo->capacity *= 2;
+	memo->slots = (spsps_memo_entry_ *) calloc(memo->capacity,
+			sizeof(spsps_memo_entry_));
+	memo->count = 0;
+	for (size_t index = 0; index < capacity; ++index) {
+		if (old[index].used) spsps_memo_place_(memo, &old[index]);
+	} // Put back the rest.
+	free(old);
+}
+
+//======================================================================
+// Implementation of public interface.
+//======================================================================
+
+Memo
+spsps_memo_new(size_t rules, uint64_t window, void (* release)(void *)) {
+	Memo memo = (Memo) calloc(1, sizeof(struct spsps_memo_));
+	memo->capacity = SPSPS_MEMO_SLOTS;
+	memo->slots = (spsps_memo_entry_ *) calloc(memo->capacity,
+			sizeof(spsps_memo_entry_));
+	memo->count = 0;
+	memo->window = window;
+	memo->latest = 0;
+	memo->release = release;
+	memo->rules = rules;
+	memo->stats = (spsps_memo_stats *) calloc(rules > 0 ? rules : 1,
+			sizeof(spsps_memo_stats));
+	return memo;
+}
+
+void
+spsps_memo_free(Memo memo) {
+	if (memo == NULL) return;
+	spsps_memo_clear(memo);
+	free(memo->slots);
+	free(memo->stats);
+	free(memo);
+}
+
+bool
+spsps_memo_lookup(Memo memo, Parser parser, unsigned rule, void ** value) {
+	// Nothing is allocated or deallocated by this method.
+	uint64_t start = spsps_offset(parser);
+	size_t index = spsps_memo_hash_(memo, rule, start);
+	while (memo->slots[index].used) {
+		spsps_memo_entry_ * entry = &memo->slots[index];
+		if (entry->rule == rule && entry->start == start) {
+			if (rule < memo->rules) memo->stats[rule].hits++;
+			spsps_consume_n(parser, (size_t) (entry->end - start));
+			if (value != NULL) *value = entry->value;
+			return true;
+		}
+		index = (index + 1) & (memo->capacity - 1);
+	} // Probe for the entry.
+	if (rule < memo->rules) memo->stats[rule].misses++;
+	return false;
+}
+
+void
+spsps_memo_store(Memo memo, unsigned rule, uint64_t start, uint64_t end,
+		void * value) {
+	if (start > memo->latest) memo->latest = start;
+	if (rule < memo->rules) memo->stats[rule].stores++;
+	size_t index = spsps_memo_hash_(memo, rule, start);
+	while (memo->slots[index].used) {
+		spsps_memo_entry_ * entry = &memo->slots[index];
+		if (entry->rule == rule && entry->start == start) {
+			// Replace the entry.
+			if (memo->release != NULL && entry->value != value) {
+				memo->release(entry->value);
+			}
+			entry->end = end;
+			entry->value = value;
+			return;
+		}
+		index = (index + 1) & (memo->capacity - 1);
+	} // Probe for the entry.
+	// Keep the table at most half full, so probes stay short.
+	if ((memo->count + 1) * 2 > memo->capacity) spsps_memo_rebuild_(memo);
+	spsps_memo_entry_ entry;
+	entry.start = start;
+	entry.end = end;
+	entry.value = value;
+	entry.rule = rule;
+	entry.used = true;
+	spsps_memo_place_(memo, &entry);
+}
+
+void
+spsps_memo_clear(Memo memo) {
+	for (size_t index = 0; index < memo->capacity; ++index) {
+		if (memo->slots[index].used) {
+			spsps_memo_discard_(memo, &memo->slots[index], false);
+		}
+	} // Discard every entry.
+	memo->count = 0;
+	memo->latest = 0;
+}
+
+spsps_memo_stats
+spsps_memo_rule_stats(Memo memo, unsigned rule) {
+	// Nothing is allocated or deallocated by this method.
+	spsps_memo_stats stats;
+	memset(&stats, 0, sizeof(stats));
+	if (rule < memo->rules) stats = memo->stats[rule];
+	return stats;
+}
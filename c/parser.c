@@ -35,79 +35,1472 @@
  */
 
 #include "parser.h"
+#include "parser_inline.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <ctype.h>
+#include <stdarg.h>
 #include <wchar.h>
+#include <errno.h>
+#include <float.h>
+
+#if defined(__unix__) || defined(__unix) || defined(__APPLE__)
+#  define SPSPS_HAVE_MMAP
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+// Scatter/gather input takes its segments as a POSIX iovec.
+#if defined(__unix__) || defined(__unix) || defined(__APPLE__)
+#  define SPSPS_HAVE_IOV
+#  include <sys/uio.h>
+#endif
+
+// Push parsers run their rule as a coroutine on its own stack.
+#if defined(__linux__) || defined(__FreeBSD__)
+#  define SPSPS_HAVE_PUSH
+#  include <ucontext.h>
+#endif
+
+// Read-ahead uses a helper thread, and semaphores to sleep when the ring is
+// full or empty.
+#if defined(__linux__) || defined(__FreeBSD__)
+#  define SPSPS_HAVE_READAHEAD
+#  include <pthread.h>
+#  include <semaphore.h>
+#  include <stdatomic.h>
+#endif
+
+// The bulk scanners use SSE2 or AVX2 when the compiler targets them.
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+// Counters are only kept when built with SPSPS_STATS.  The per-thread
+// shards of the process-wide totals need C11 atomics and thread-local
+// storage.
+#ifdef SPSPS_STATS
+#  include <stdatomic.h>
+#  include <time.h>
+#endif
+
+// Numbers handed to strtod are converted in the "C" locale, whatever the
+// program's locale, by switching the calling thread's locale.
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__APPLE__)
+#  define SPSPS_HAVE_USELOCALE
+#  include <locale.h>
+#  include <stdatomic.h>
+#  ifdef __APPLE__
+#    include <xlocale.h>
+#  endif
+#endif
+
+/// The counters in spsps_parser_stats, for code that handles them all alike.
+#define SPSPS_STATS_FIELDS_(m_field) \
+	m_field(consumed) m_field(consumes) m_field(peeks) m_field(refills) \
+	m_field(reads) m_field(read_nanos) m_field(stalls) m_field(checkpoints) \
+	m_field(errors)
+
+/// Add to a counter of a parser, or do nothing if counters are compiled out.
+#ifdef SPSPS_STATS
+#  define SPSPS_COUNT_(m_parser, m_field, m_n) \
+	((m_parser)->stats.m_field += (uint64_t) (m_n))
+#else
+#  define SPSPS_COUNT_(m_parser, m_field, m_n) ((void) 0)
+#endif
+
+/// The most runs of consecutive codes a character class may have for the
+/// vectorized scanners to be used.  Other classes use the scalar scanner.
+#define SPSPS_SIMD_RUNS 8
 
 //======================================================================
 // Definition of the parser struct.
 //======================================================================
 
 struct spsps_parser_ {
+	// The cursor comes first, and is laid out exactly as spsps_cursor, so
+	// that the inline functions in parser_inline.h can reach it.
+	union {
+		/// The cursor, as the inline functions see it.
+		spsps_cursor cursor;
+		struct {
+			/// The characters available to the parser.  For a memory-backed
+			/// source this is the source itself, for a block handed over by
+			/// map it is the block, and otherwise it is the window.
+			const SPSPS_CHAR * buf;
+			/// The index in buf of the next character.
+			size_t next;
+			/// The number of characters in buf.  What lies past this is
+			/// either the end of the input (if drained) or characters not
+			/// yet read.
+			size_t limit;
+			/// How many times we have peeked without consuming.
+			uint16_t look_count;
+		};
+	};
+	/// The absolute offset of buf[0].  The offset of the next character is
+	/// base plus next.
+	uint64_t base;
+	/// Whether the source has no characters past limit.
+	bool drained;
+	/// Whether the source is in memory, so that buf holds all of it.
+	bool in_memory;
 	/// Whether the parser has consumed the end of file.
 	bool at_eof;
-	/// The current zero-based block index.
-	uint8_t block;
-	/// The blocks.
-	SPSPS_CHAR blocks[2][SPSPS_LOOK];
 	/// How many times we have consumed the EOF.
 	uint16_t eof_count;
-	/// How many times we have peeked without consuming.
-	uint16_t look_count;
 	/// The name of the source.
 	char * name;
-	/// The next entry in the current block.
-	size_t next;
-	/// The stream providing characters.
+	/// Whether the name was copied by the parser and must be freed.
+	bool owns_name;
+	/// The stream providing characters, or NULL if the parser does not read
+	/// a stream.
 	FILE * stream;
-	/// The current column number.
-	uint32_t column;
-	/// The current line number.
-	uint32_t line;
+	/// The hooks that provide characters.  For a stream these read the
+	/// stream.
+	spsps_source source;
+	/// The context passed to the hooks.
+	void * source_context;
+	/// The rest of the last block handed over by map that has not yet been
+	/// copied into the window or parsed in place.
+	const SPSPS_CHAR * pending;
+	/// The number of characters at pending.
+	size_t pending_length;
+	/// The window into which a stream is read, allocated on first use.  It
+	/// holds every character from the oldest pinned offset (or the next
+	/// character, if nothing is pinned) up to limit.  A block handed over by
+	/// map is parsed in place, with buf pointing into it instead.
+	SPSPS_CHAR * window;
+	/// The capacity of the window, in characters.
+	size_t capacity;
+	/// The number of characters to read at once.
+	size_t block;
+	/// The most characters a peek may look ahead, or SIZE_MAX for no limit.
+	size_t max_lookahead;
+	/// The allocator for the window.
+	spsps_allocator allocator;
+	/// The context passed to the allocator.
+	void * allocator_context;
+	/// The pinned offsets, in no particular order.  Characters from the
+	/// oldest of these on are kept in the window.
+	uint64_t * pins;
+	/// The number of pinned offsets.
+	size_t npins;
+	/// The capacity of the pins array.
+	size_t pins_capacity;
+	/// The coroutine state of a push parser, or NULL if the parser pulls its
+	/// characters from a stream or memory.
+	struct spsps_push_ * push;
+	/// The read-ahead state of a stream parser, or NULL if the parser reads
+	/// the stream itself.
+	struct spsps_readahead_ * readahead;
+	/// The offset up to which the line and column have been computed.
+	/// Lines and columns are only computed when asked for (or when the
+	/// characters are about to be discarded), so consuming characters does
+	/// not have to look for newlines.
+	uint64_t loc_offset;
+	/// The line number at loc_offset.
+	uint64_t loc_line;
+	/// The column number at loc_offset.
+	uint64_t loc_column;
 	/// The most recent error code.
-	spsps_errno errno;
-	/// Whether the buffer been initialized the first time
-	bool initialized;
+	spsps_errno status;
+	/// The number of bytes mapped at buf, or zero if buf is not a mapping.
+	size_t mapped;
+	/// Whether a memory-backed buf was allocated by the parser and must be
+	/// freed.
+	bool owns_data;
+	/// How errors are handled.
+	spsps_error_mode error_mode;
+	/// The number of errors recorded.
+	size_t error_total;
+	/// The most recent errors recorded, as a ring.
+	spsps_error errors[SPSPS_ERROR_RING];
+	/// Whether the parser has stopped at its first error.
+	bool stopped;
+	/// Whether the input is UTF-8, so that it is validated as it arrives and
+	/// columns count code points.
+	bool utf8;
+	/// The offset up to which UTF-8 has been validated.
+	uint64_t utf8_checked;
+	/// The offset of the first invalid UTF-8 seen, or UINT64_MAX.
+	uint64_t utf8_bad;
+#ifdef SPSPS_STATS
+	/// The counters.
+	spsps_parser_stats stats;
+#endif
 };
 
+//======================================================================
+// Performance counters.
+//======================================================================
+
+#ifdef SPSPS_STATS
+/**
+ * One thread's share of the process-wide counters.  Only the owning thread
+ * adds to a shard, and shards are never freed, so reading the totals is just
+ * a walk of the list with no lock.
+ */
+typedef struct spsps_shard_ {
+#define SPSPS_SHARD_FIELD_(m_name) _Atomic uint64_t m_name;
+	SPSPS_STATS_FIELDS_(SPSPS_SHARD_FIELD_)
+#undef SPSPS_SHARD_FIELD_
+	/// The next shard in the list.
+	struct spsps_shard_ * next;
+} spsps_shard_;
+
+/// Every shard, newest first.
+static _Atomic(spsps_shard_ *) spsps_shards_ = NULL;
+
+/// The shard of this thread, made on first use.
+static _Thread_local spsps_shard_ * spsps_my_shard_ = NULL;
+
+/**
+ * Read a monotonic clock.
+ * @return				The time, in nanoseconds.
+ */
+static uint64_t
+spsps_nanos_(void) {
+#if defined(CLOCK_MONOTONIC)
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+#else
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+#endif
+	return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * Add the counters of a parser that is going away to the shard of this
+ * thread.
+ * @param parser		The parser.
+ */
+static void
+spsps_flush_stats_(Parser parser) {
+	spsps_shard_ * shard = spsps_my_shard_;
+	if (shard == NULL) {
+		shard = (spsps_shard_ *) calloc(1, sizeof(spsps_shard_));
+		if (shard == NULL) return;
+		shard->next = atomic_load_explicit(&spsps_shards_,
+				memory_order_relaxed);
+		while (! atomic_compare_exchange_weak_explicit(&spsps_shards_,
+				&shard->next, shard, memory_order_release,
+				memory_order_relaxed)) {}
+		spsps_my_shard_ = shard;
+	}
+#define SPSPS_FLUSH_FIELD_(m_name) \
+	atomic_fetch_add_explicit(&shard->m_name, parser->stats.m_name, \
+			memory_order_relaxed);
+	SPSPS_STATS_FIELDS_(SPSPS_FLUSH_FIELD_)
+#undef SPSPS_FLUSH_FIELD_
+}
+#endif
+
 //======================================================================
 // Helper functions.
 //======================================================================
 
-SPSPS_CHAR chbuf[30]; // U+002e (.) and U+0000002e.
+/// The buffer for spsps_printchar.  Each thread has its own.
+static _Thread_local char spsps_chbuf_[SPSPS_PRINTCHAR_SIZE];
+
 char * spsps_printchar(SPSPS_CHAR xch) {
+	return spsps_printchar_r(xch, spsps_chbuf_, sizeof(spsps_chbuf_));
+}
+
+char * spsps_printchar_r(SPSPS_CHAR xch, char * buf, size_t size) {
 	unsigned SPSPS_CHAR ch = (unsigned SPSPS_CHAR) xch;
-	if (isprint(ch)) {
-		sprintf(chbuf, "U+%04x (%1c)", ch, ch);
+	if (spsps_class_has(SPSPS_PRINT, xch)) {
+		snprintf(buf, size, "U+%04x (%1c)", (unsigned) ch, (int) ch);
 	} else {
-		sprintf(chbuf, "U+%04x", ch);
+		snprintf(buf, size, "U+%04x", (unsigned) ch);
 	}
-	return chbuf;
+	return buf;
 }
 
-void
-spsps_read_other_(Parser parser) {
-	// Allocation: Nothing is allocated or deallocated by this method.
-	size_t count = fread(parser->blocks[parser->block^1], sizeof(SPSPS_CHAR),
-		SPSPS_LOOK, parser->stream);
-	if (count < SPSPS_LOOK) {
-		if (sizeof(SPSPS_CHAR) == 1) {
-			memset(parser->blocks[parser->block^1] + count, SPSPS_EOF,
-				SPSPS_LOOK - count);
+/**
+ * A character class.  The bitmap answers membership for the codes 0 to 255,
+ * and the runs describe the same members as ranges of consecutive codes,
+ * which is what the vectorized scanners test.  Codes above 255 are members
+ * if they are in one of the wide ranges.
+ */
+struct spsps_class_ {
+	/// Membership bitmap for the character codes 0 to 255.
+	uint8_t bits[32];
+	/// The members below 256 as runs of consecutive codes, low then high.
+	uint8_t runs[SPSPS_SIMD_RUNS][2];
+	/// The number of runs, or more than SPSPS_SIMD_RUNS if there are too
+	/// many for the vectorized scanners.
+	size_t nruns;
+	/// Ranges of codes above 255, low then high.
+	uint32_t (* wide)[2];
+	/// The number of wide ranges.
+	size_t nwide;
+	/// Whether this is a built-in class, which is never freed.
+	bool builtin;
+};
+
+// The built-in classes are built at compile time.  Each is described by a
+// predicate on the character code, from which the bitmap is computed one bit
+// at a time, and by its runs.  They follow the "C" locale.
+#define SPSPS_IN_(c, lo, hi)	((c) >= (lo) && (c) <= (hi))
+#define SPSPS_DIGIT_(c)			SPSPS_IN_(c, '0', '9')
+#define SPSPS_UPPER_(c)			SPSPS_IN_(c, 'A', 'Z')
+#define SPSPS_LOWER_(c)			SPSPS_IN_(c, 'a', 'z')
+#define SPSPS_ALPHA_(c)			(SPSPS_UPPER_(c) || SPSPS_LOWER_(c))
+#define SPSPS_ALNUM_(c)			(SPSPS_ALPHA_(c) || SPSPS_DIGIT_(c))
+#define SPSPS_XDIGIT_(c)		(SPSPS_DIGIT_(c) || SPSPS_IN_(c, 'A', 'F') || \
+								SPSPS_IN_(c, 'a', 'f'))
+#define SPSPS_SPACE_(c)			((c) == ' ' || SPSPS_IN_(c, '\t', '\r'))
+#define SPSPS_PRINT_(c)			SPSPS_IN_(c, ' ', '~')
+#define SPSPS_PUNCT_(c)			(SPSPS_PRINT_(c) && ! SPSPS_ALNUM_(c) && \
+								(c) != ' ')
+#define SPSPS_IDENT_(c)			(SPSPS_ALNUM_(c) || (c) == '_')
+#define SPSPS_IDENT_START_(c)	(SPSPS_ALPHA_(c) || (c) == '_')
+#define SPSPS_BIT_(f, c)		((f(c)) ? 1 << ((c) & 7) : 0)
+#define SPSPS_BYTE_(f, b)		(uint8_t) (SPSPS_BIT_(f, 8*(b)) | \
+		SPSPS_BIT_(f, 8*(b)+1) | SPSPS_BIT_(f, 8*(b)+2) | \
+		SPSPS_BIT_(f, 8*(b)+3) | SPSPS_BIT_(f, 8*(b)+4) | \
+		SPSPS_BIT_(f, 8*(b)+5) | SPSPS_BIT_(f, 8*(b)+6) | \
+		SPSPS_BIT_(f, 8*(b)+7))
+#define SPSPS_BYTES8_(f, b)		SPSPS_BYTE_(f, b), SPSPS_BYTE_(f, b+1), \
+		SPSPS_BYTE_(f, b+2), SPSPS_BYTE_(f, b+3), SPSPS_BYTE_(f, b+4), \
+		SPSPS_BYTE_(f, b+5), SPSPS_BYTE_(f, b+6), SPSPS_BYTE_(f, b+7)
+#define SPSPS_BITS_(f)			{ SPSPS_BYTES8_(f, 0), SPSPS_BYTES8_(f, 8), \
+		SPSPS_BYTES8_(f, 16), SPSPS_BYTES8_(f, 24) }
+#define SPSPS_BUILTIN_(m_name, m_pred, m_nruns, ...) \
+	static const struct spsps_class_ m_name##_class_ = { \
+		SPSPS_BITS_(m_pred), { __VA_ARGS__ }, m_nruns, NULL, 0, true \
+	}; \
+	const CharClass m_name = &m_name##_class_;
+
+SPSPS_BUILTIN_(SPSPS_DIGIT, SPSPS_DIGIT_, 1, { '0', '9' })
+SPSPS_BUILTIN_(SPSPS_UPPER, SPSPS_UPPER_, 1, { 'A', 'Z' })
+SPSPS_BUILTIN_(SPSPS_LOWER, SPSPS_LOWER_, 1, { 'a', 'z' })
+SPSPS_BUILTIN_(SPSPS_ALPHA, SPSPS_ALPHA_, 2, { 'A', 'Z' }, { 'a', 'z' })
+SPSPS_BUILTIN_(SPSPS_ALNUM, SPSPS_ALNUM_, 3, { '0', '9' }, { 'A', 'Z' },
+		{ 'a', 'z' })
+SPSPS_BUILTIN_(SPSPS_XDIGIT, SPSPS_XDIGIT_, 3, { '0', '9' }, { 'A', 'F' },
+		{ 'a', 'f' })
+SPSPS_BUILTIN_(SPSPS_SPACE, SPSPS_SPACE_, 2, { '\t', '\r' }, { ' ', ' ' })
+SPSPS_BUILTIN_(SPSPS_PRINT, SPSPS_PRINT_, 1, { ' ', '~' })
+SPSPS_BUILTIN_(SPSPS_PUNCT, SPSPS_PUNCT_, 4, { '!', '/' }, { ':', '@' },
+		{ '[', '`' }, { '{', '~' })
+SPSPS_BUILTIN_(SPSPS_IDENT, SPSPS_IDENT_, 4, { '0', '9' }, { 'A', 'Z' },
+		{ '_', '_' }, { 'a', 'z' })
+SPSPS_BUILTIN_(SPSPS_IDENT_START, SPSPS_IDENT_START_, 3, { 'A', 'Z' },
+		{ '_', '_' }, { 'a', 'z' })
+
+/// The whitespace skipped by spsps_consume_whitespace.
+#define SPSPS_WHITESPACE_(c)	((c) == ' ' || (c) == '\t' || (c) == '\r' || \
+								(c) == '\n')
+static const struct spsps_class_ spsps_whitespace_ = {
+	SPSPS_BITS_(SPSPS_WHITESPACE_), { { '\t', '\n' }, { '\r', '\r' },
+	{ ' ', ' ' } }, 3, NULL, 0, true
+};
+
+/**
+ * Work out the runs of a class from its bitmap.
+ * @param cls			The class.
+ */
+static void
+spsps_class_runs_(struct spsps_class_ * cls) {
+	cls->nruns = 0;
+	for (unsigned code = 0; code < 256; ++code) {
+		if (! ((cls->bits[code >> 3] >> (code & 7)) & 1)) continue;
+		if (cls->nruns > 0 && cls->nruns <= SPSPS_SIMD_RUNS &&
+				cls->runs[cls->nruns - 1][1] + 1u == code) {
+			cls->runs[cls->nruns - 1][1] = (uint8_t) code;
+		} else if (cls->nruns < SPSPS_SIMD_RUNS) {
+			cls->runs[cls->nruns][0] = (uint8_t) code;
+			cls->runs[cls->nruns][1] = (uint8_t) code;
+			cls->nruns++;
 		} else {
-			for (; count < SPSPS_LOOK; ++count) {
-				parser->blocks[parser->block^1][count] = SPSPS_EOF;
-			} // Clear the remainder of the block.
+			// Too many runs to vectorize.
+			cls->nruns = SPSPS_SIMD_RUNS + 1;
+			return;
 		}
+	} // Find the runs.
+}
+
+/**
+ * Initialize a class from the members given as a C string.
+ * @param cls			The class to initialize.
+ * @param members		The members of the class.  May be NULL (empty).
+ */
+static void
+spsps_class_init_(struct spsps_class_ * cls, const char * members) {
+	memset(cls->bits, 0, sizeof(cls->bits));
+	cls->wide = NULL;
+	cls->nwide = 0;
+	cls->builtin = false;
+	for (; members != NULL && *members != 0; ++members) {
+		unsigned char code = (unsigned char) *members;
+		cls->bits[code >> 3] |= (uint8_t) (1 << (code & 7));
+	} // Add all members.
+	spsps_class_runs_(cls);
+}
+
+/**
+ * Determine whether a character is a member of a class.
+ * @param cls			The class.
+ * @param ch			The character.
+ * @return				True iff the character is in the class.
+ */
+static inline bool
+spsps_class_has_(CharClass cls, SPSPS_CHAR ch) {
+	uint32_t code = (sizeof(SPSPS_CHAR) == 1)
+			? (uint32_t) (unsigned char) ch : (uint32_t) ch;
+	if (code < 256) return (cls->bits[code >> 3] >> (code & 7)) & 1;
+	for (size_t index = 0; index < cls->nwide; ++index) {
+		if (code >= cls->wide[index][0] && code <= cls->wide[index][1]) {
+			return true;
+		}
+	} // Check the wide ranges.
+	return false;
+}
+
+/**
+ * Find the index of the lowest set bit in a non-zero mask.
+ * @param mask			The mask.
+ * @return				The index of the lowest set bit.
+ */
+static inline size_t
+spsps_ctz_(uint32_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+	return (size_t) __builtin_ctz(mask);
+#else
+	size_t index = 0;
+	while ((mask & 1) == 0) {
+		mask >>= 1;
+		++index;
+	} // Find the bit.
+	return index;
+#endif
+}
+
+/**
+ * Count the leading characters of an array that are in a class (if in is
+ * true) or that are not in the class (if in is false).  This is the bulk
+ * scanner.  For single-byte characters and classes with few runs it tests 32
+ * or 16 characters at a time, checking each run with a subtraction and an
+ * unsigned comparison; otherwise it falls back to a scalar loop.
+ * @param str			The characters.
+ * @param n				The number of characters available.
+ * @param cls			The class.
+ * @param in			Whether to skip members (true) or non-members.
+ * @return				The number of leading characters skipped.
+ */
+static size_t
+spsps_span_(const SPSPS_CHAR * str, size_t n, CharClass cls, bool in) {
+	size_t index = 0;
+#if defined(__SSE2__)
+	if (sizeof(SPSPS_CHAR) == 1 && cls->nruns <= SPSPS_SIMD_RUNS) {
+		const unsigned char * bytes = (const unsigned char *) str;
+		// A code c is in the run [lo, hi] iff (c - lo) mod 256 <= hi - lo,
+		// and x <= y iff min(x, y) == x.
+#  if defined(__AVX2__)
+		__m256i wlow[SPSPS_SIMD_RUNS], wwidth[SPSPS_SIMD_RUNS];
+		for (size_t run = 0; run < cls->nruns; ++run) {
+			wlow[run] = _mm256_set1_epi8((char) cls->runs[run][0]);
+			wwidth[run] = _mm256_set1_epi8(
+					(char) (cls->runs[run][1] - cls->runs[run][0]));
+		} // Broadcast the runs.
+		for (; index + 32 <= n; index += 32) {
+			__m256i chunk = _mm256_loadu_si256(
+					(const __m256i *) (bytes + index));
+			__m256i hits = _mm256_setzero_si256();
+			for (size_t run = 0; run < cls->nruns; ++run) {
+				__m256i off = _mm256_sub_epi8(chunk, wlow[run]);
+				hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(
+						_mm256_min_epu8(off, wwidth[run]), off));
+			} // Test against all runs.
+			uint32_t stop = (uint32_t) _mm256_movemask_epi8(hits);
+			if (in) stop = ~stop;
+			if (stop != 0) return index + spsps_ctz_(stop);
+		} // Scan 32 characters at a time.
+#  endif
+		__m128i nlow[SPSPS_SIMD_RUNS], nwidth[SPSPS_SIMD_RUNS];
+		for (size_t run = 0; run < cls->nruns; ++run) {
+			nlow[run] = _mm_set1_epi8((char) cls->runs[run][0]);
+			nwidth[run] = _mm_set1_epi8(
+					(char) (cls->runs[run][1] - cls->runs[run][0]));
+		} // Broadcast the runs.
+		for (; index + 16 <= n; index += 16) {
+			__m128i chunk = _mm_loadu_si128((const __m128i *) (bytes + index));
+			__m128i hits = _mm_setzero_si128();
+			for (size_t run = 0; run < cls->nruns; ++run) {
+				__m128i off = _mm_sub_epi8(chunk, nlow[run]);
+				hits = _mm_or_si128(hits, _mm_cmpeq_epi8(
+						_mm_min_epu8(off, nwidth[run]), off));
+			} // Test against all runs.
+			uint32_t stop = (uint32_t) _mm_movemask_epi8(hits);
+			if (in) stop = ~stop & 0xffff;
+			if (stop != 0) return index + spsps_ctz_(stop);
+		} // Scan 16 characters at a time.
+	}
+#endif
+	for (; index < n; ++index) {
+		if (spsps_class_has_(cls, str[index]) != in) break;
+	} // Scan the rest one character at a time.
+	return index;
+}
+
+/**
+ * Count the code points in a run of UTF-8, by counting the bytes that are not
+ * continuation bytes.
+ * @param str			The characters.
+ * @param n				The number of characters.
+ * @return				The number of code points.
+ */
+static size_t
+spsps_utf8_count_(const SPSPS_CHAR * str, size_t n) {
+	const unsigned char * bytes = (const unsigned char *) str;
+	size_t count = 0;
+	size_t index = 0;
+#if defined(__SSE2__)
+	// A continuation byte is 0x80 to 0xbf, which as a signed byte is below
+	// -64.
+	__m128i limit = _mm_set1_epi8(-65);
+	for (; index + 16 <= n; index += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *) (bytes + index));
+		uint32_t starts = (uint32_t) _mm_movemask_epi8(
+				_mm_cmpgt_epi8(chunk, limit));
+#  if defined(__GNUC__) || defined(__clang__)
+		count += (size_t) __builtin_popcount(starts);
+#  else
+		for (; starts != 0; starts &= starts - 1) ++count;
+#  endif
+	} // Count 16 bytes at a time.
+#endif
+	for (; index < n; ++index) {
+		if ((bytes[index] & 0xc0) != 0x80) ++count;
+	} // Count the rest.
+	return count;
+}
+
+/**
+ * Decode one code point of UTF-8, checking that it is well-formed: not
+ * overlong, not a surrogate, and not above U+10FFFF.
+ * @param bytes			The bytes.
+ * @param n				The number of bytes available.
+ * @param cp			Set to the code point, or to U+FFFD if the bytes are
+ * 						not valid.
+ * @return				The length of the encoding, zero if the bytes are a
+ * 						valid start but more are needed, or -1 if they are
+ * 						not valid.
+ */
+static int
+spsps_utf8_decode_(const unsigned char * bytes, size_t n, int32_t * cp) {
+	*cp = 0xfffd;
+	if (n == 0) return 0;
+	unsigned char lead = bytes[0];
+	if (lead < 0x80) {
+		*cp = lead;
+		return 1;
+	}
+	int length;
+	int32_t value;
+	unsigned char low = 0x80, high = 0xbf;
+	if (lead >= 0xc2 && lead <= 0xdf) {
+		length = 2;
+		value = lead & 0x1f;
+	} else if (lead >= 0xe0 && lead <= 0xef) {
+		length = 3;
+		value = lead & 0x0f;
+		// No overlongs, and no surrogates.
+		if (lead == 0xe0) low = 0xa0;
+		if (lead == 0xed) high = 0x9f;
+	} else if (lead >= 0xf0 && lead <= 0xf4) {
+		length = 4;
+		value = lead & 0x07;
+		// No overlongs, and nothing above U+10FFFF.
+		if (lead == 0xf0) low = 0x90;
+		if (lead == 0xf4) high = 0x8f;
+	} else {
+		return -1;
+	}
+	for (int index = 1; index < length; ++index) {
+		if ((size_t) index >= n) return 0;
+		unsigned char byte = bytes[index];
+		if (byte < low || byte > high) return -1;
+		low = 0x80;
+		high = 0xbf;
+		value = (value << 6) | (byte & 0x3f);
+	} // Decode the continuation bytes.
+	*cp = value;
+	return length;
+}
+
+/**
+ * Validate the UTF-8 that has arrived since the last validation.  All-ASCII
+ * stretches are skipped 16 bytes at a time.  A sequence cut off at the limit
+ * is left for next time, unless the source is drained.  The first invalid
+ * byte is recorded.
+ * @param parser		The parser.
+ */
+static void
+spsps_utf8_check_(Parser parser) {
+	if (! parser->utf8) return;
+	// Anything already discarded cannot be checked any more.
+	if (parser->utf8_checked < parser->base) {
+		parser->utf8_checked = parser->base;
 	}
+	const unsigned char * bytes = (const unsigned char *) parser->buf +
+			(parser->utf8_checked - parser->base);
+	size_t n = parser->limit - (size_t) (parser->utf8_checked - parser->base);
+	size_t index = 0;
+	while (index < n) {
+#if defined(__SSE2__)
+		while (index + 16 <= n && _mm_movemask_epi8(_mm_loadu_si128(
+				(const __m128i *) (bytes + index))) == 0) {
+			index += 16;
+		} // Skip ASCII 16 bytes at a time.
+		if (index >= n) break;
+#endif
+		if (bytes[index] < 0x80) {
+			++index;
+			continue;
+		}
+		int32_t cp;
+		int length = spsps_utf8_decode_(bytes + index, n - index, &cp);
+		if (length == 0 && ! parser->drained) break;
+		if (length <= 0) {
+			if (parser->utf8_bad == UINT64_MAX) {
+				parser->utf8_bad = parser->utf8_checked + index;
+			}
+			length = 1;
+		}
+		index += (size_t) length;
+	} // Check everything available.
+	parser->utf8_checked += index;
 }
 
-void spsps_initialize_parser_(Parser parser){
-	spsps_read_other_(parser);
-	parser->block ^= 1;
-	parser->initialized = true;
+/**
+ * Advance the computed line and column over a run of characters.
+ * @param parser		The parser.
+ * @param str			The characters, starting at loc_offset.
+ * @param n				The number of characters.
+ */
+static void
+spsps_count_lines_(Parser parser, const SPSPS_CHAR * str, size_t n) {
+	size_t after = 0;
+	bool newline = false;
+	if (sizeof(SPSPS_CHAR) == 1) {
+		// The library memchr is vectorized, so let it find the newlines.
+		const char * here = (const char *) str;
+		const char * end = here + n;
+		while ((here = memchr(here, '\n', (size_t) (end - here))) != NULL) {
+			parser->loc_line++;
+			newline = true;
+			after = (size_t) (++here - (const char *) str);
+		} // Count the newlines.
+	} else {
+		for (size_t index = 0; index < n; ++index) {
+			if (str[index] == '\n') {
+				parser->loc_line++;
+				newline = true;
+				after = index + 1;
+			}
+		} // Count the newlines.
+	}
+	// In UTF-8 the column counts code points, so skip continuation bytes.
+	size_t columns = parser->utf8 ? spsps_utf8_count_(str + after, n - after)
+			: n - after;
+	if (newline) parser->loc_column = 1 + columns;
+	else parser->loc_column += columns;
+	parser->loc_offset += n;
+}
+
+/**
+ * Bring the computed line and column up to the current position.
+ * @param parser		The parser.
+ */
+static void
+spsps_sync_loc_(Parser parser) {
+	// The computed location never lags behind the start of buf.
+	size_t count = (size_t) (parser->base + parser->next - parser->loc_offset);
+	if (count == 0) return;
+	spsps_count_lines_(parser, parser->buf + (parser->loc_offset - parser->base),
+			count);
+}
+
+/**
+ * Find the oldest character anyone still needs: the next character, or the
+ * oldest pinned offset if that is earlier.  The start of a UTF-8 sequence
+ * that has not been validated yet is needed until the rest of it arrives,
+ * so that a sequence split between blocks is validated whole.
+ * @param parser		The parser.
+ * @return				The index in buf of that character.
+ */
+static size_t
+spsps_keep_(Parser parser) {
+	size_t keep = parser->next;
+	for (size_t index = 0; index < parser->npins; ++index) {
+		size_t pin = (size_t) (parser->pins[index] - parser->base);
+		if (pin < keep) keep = pin;
+	} // Find the oldest pin.
+	if (parser->utf8 && parser->utf8_checked < parser->base + keep) {
+		keep = (size_t) (parser->utf8_checked - parser->base);
+	}
+	return keep;
+}
+
+/**
+ * Make room at the end of the window for more characters.  Characters before
+ * the next character and before every pinned offset are discarded, and the
+ * window grows if that is not enough.  If buf is a block handed over by map,
+ * the characters still needed are copied out of it into the window.
+ * @param parser		The parser.
+ * @param room			The number of characters that must fit after limit.
+ * @return				True iff there is room.
+ */
+static bool
+spsps_make_room_(Parser parser, size_t room) {
+	// Discard what nobody needs any more.
+	size_t keep = spsps_keep_(parser);
+	bool borrowed = parser->buf != parser->window;
+	if (keep > 0 && ! borrowed) {
+		if (parser->loc_offset < parser->base + keep) spsps_sync_loc_(parser);
+		memmove(parser->window, parser->window + keep,
+				(parser->limit - keep) * sizeof(SPSPS_CHAR));
+		parser->base += keep;
+		parser->next -= keep;
+		parser->limit -= keep;
+		keep = 0;
+	}
+	// Grow the window if there is not enough room.
+	size_t capacity = parser->capacity > 0 ? parser->capacity :
+			2 * parser->block;
+	while (capacity - (parser->limit - keep) < room) capacity *= 2;
+	if (capacity != parser->capacity) {
+		SPSPS_CHAR * window = (SPSPS_CHAR *) parser->allocator(
+				parser->allocator_context, parser->window,
+				parser->capacity * sizeof(SPSPS_CHAR),
+				capacity * sizeof(SPSPS_CHAR));
+		if (window == NULL) {
+			parser->status = LOOKAHEAD_TOO_LARGE;
+			return false;
+		}
+		parser->window = window;
+		parser->capacity = capacity;
+		if (! borrowed) parser->buf = window;
+	}
+	if (borrowed) {
+		// Copy what is still needed out of the block.
+		if (parser->loc_offset < parser->base + keep) spsps_sync_loc_(parser);
+		memcpy(parser->window, parser->buf + keep,
+				(parser->limit - keep) * sizeof(SPSPS_CHAR));
+		parser->buf = parser->window;
+		parser->base += keep;
+		parser->next -= keep;
+		parser->limit -= keep;
+	}
+	return true;
+}
+
+/**
+ * Release the window.
+ * @param parser		The parser.
+ */
+static void
+spsps_drop_window_(Parser parser) {
+	if (parser->window != NULL) {
+		parser->allocator(parser->allocator_context, parser->window,
+				parser->capacity * sizeof(SPSPS_CHAR), 0);
+	}
+	if (parser->buf == parser->window) parser->buf = NULL;
+	parser->window = NULL;
+	parser->capacity = 0;
+}
+
+/**
+ * Move characters from the read-ahead ring into the window.
+ * @param parser		The parser.
+ * @param need			The number of characters needed.
+ */
+static void spsps_take_ahead_(Parser parser, size_t need);
+
+/**
+ * Suspend the rule of a push parser until more characters are fed.
+ * @param parser		The parser.
+ * @return				False if the rule is not running, so there is no one
+ * 						to feed it.
+ */
+static bool spsps_yield_(Parser parser);
+
+/**
+ * Read characters from a stream.  This is the read hook of a parser made
+ * with spsps_new.
+ * @param context		The stream.
+ * @param buf			Where to put the characters.
+ * @param size			The most characters to read.
+ * @return				The number of characters read, or zero at the end.
+ */
+static size_t
+spsps_read_stream_(void * context, SPSPS_CHAR * buf, size_t size) {
+	FILE * stream = (FILE *) context;
+	// A short read has already seen the end, so do not wait on the stream
+	// again.
+	if (feof(stream) || ferror(stream)) return 0;
+	return fread(buf, sizeof(SPSPS_CHAR), size, stream);
+}
+
+/// The hooks of a parser that reads a stream.
+static const spsps_source spsps_stream_source_ = {
+	spsps_read_stream_, NULL, NULL
+};
+
+/**
+ * Get the next block from map, unless the last one still has characters.
+ * @param parser		The parser.
+ * @return				False iff the source is done.
+ */
+static bool
+spsps_next_block_(Parser parser) {
+	if (parser->pending_length > 0) return true;
+	size_t length = 0;
+	const SPSPS_CHAR * block = parser->source.map(parser->source_context,
+			&length);
+	SPSPS_COUNT_(parser, reads, 1);
+	parser->pending = block;
+	parser->pending_length = (block != NULL) ? length : 0;
+	return parser->pending_length > 0;
+}
+
+/**
+ * Parse the next block from map in place, instead of copying it into the
+ * window.  This is only done when no character in buf is needed any more.
+ * @param parser		The parser.
+ * @return				False iff the source is done.
+ */
+static bool
+spsps_hand_over_(Parser parser) {
+	// Everything in buf is about to go, so the location has to be brought
+	// up to its end first.
+	spsps_sync_loc_(parser);
+	parser->base += parser->limit;
+	parser->next = 0;
+	parser->limit = 0;
+	parser->buf = parser->window;
+	if (! spsps_next_block_(parser)) {
+		parser->drained = true;
+		return false;
+	}
+	parser->buf = parser->pending;
+	parser->limit = parser->pending_length;
+	parser->pending_length = 0;
+	spsps_utf8_check_(parser);
+	return true;
+}
+
+/**
+ * Copy characters from blocks handed over by map into the window.
+ * @param parser		The parser.
+ * @param want			The most characters to copy.
+ * @return				The number of characters copied, or zero at the end.
+ */
+static size_t
+spsps_copy_blocks_(Parser parser, size_t want) {
+	if (! spsps_next_block_(parser)) return 0;
+	size_t count = (parser->pending_length < want) ? parser->pending_length
+			: want;
+	memcpy(parser->window + parser->limit, parser->pending,
+			count * sizeof(SPSPS_CHAR));
+	parser->pending += count;
+	parser->pending_length -= count;
+	return count;
+}
+
+/**
+ * Make sure at least the given number of characters are available from the
+ * next character on, by reading more of the source into the window if
+ * necessary.  A push parser instead waits for them to be fed.
+ * @param parser		The parser.
+ * @param need			The number of characters needed.
+ * @return				True iff that many characters are available.
+ */
+static bool
+spsps_fill_(Parser parser, size_t need) {
+	if (need > parser->max_lookahead) {
+		parser->status = LOOKAHEAD_TOO_LARGE;
+		return false;
+	}
+	if (parser->limit - parser->next >= need) return true;
+	if (parser->drained) return false;
+	SPSPS_COUNT_(parser, refills, 1);
+	if (parser->push != NULL) {
+		// Wait for spsps_feed or spsps_finish.
+		while (parser->limit - parser->next < need) {
+			if (parser->drained || ! spsps_yield_(parser)) return false;
+		} // Wait for characters.
+		return true;
+	}
+	if (parser->source.map != NULL && spsps_keep_(parser) == parser->limit) {
+		// Nothing buffered is needed any more, so parse the next block in
+		// place.  If it is too short, it is copied into the window below.
+		if (! spsps_hand_over_(parser)) return false;
+		if (parser->limit - parser->next >= need) return true;
+	}
+	// Make room for what is needed, and at least a block besides.
+	size_t room = need - (parser->limit - parser->next);
+	if (room < parser->block) room = parser->block;
+	if (! spsps_make_room_(parser, room)) return false;
+	if (parser->readahead != NULL) {
+		// The helper thread has done the reading.
+		spsps_take_ahead_(parser, need);
+		spsps_utf8_check_(parser);
+		return parser->limit - parser->next >= need;
+	}
+	// Read as much as will fit, until there is enough.
+	while (parser->limit - parser->next < need) {
+		size_t want = parser->capacity - parser->limit;
+#ifdef SPSPS_STATS
+		uint64_t start = spsps_nanos_();
+#endif
+		size_t count;
+		if (parser->source.map != NULL) {
+			count = spsps_copy_blocks_(parser, want);
+		} else {
+			count = parser->source.read(parser->source_context,
+					parser->window + parser->limit, want);
+		}
+		SPSPS_COUNT_(parser, reads, 1);
+		SPSPS_COUNT_(parser, read_nanos, spsps_nanos_() - start);
+		parser->limit += count;
+		if (count == 0) {
+			// The source is done.
+			parser->drained = true;
+			break;
+		}
+	} // Read until there is enough.
+	spsps_utf8_check_(parser);
+	return parser->limit - parser->next >= need;
+}
+
+/**
+ * Pin an offset, so that the characters from there on are kept.
+ * @param parser		The parser.
+ * @param offset		The offset to pin.
+ */
+static void
+spsps_pin_(Parser parser, uint64_t offset) {
+	// Memory-backed sources keep everything anyway.
+	if (parser->in_memory) return;
+	if (parser->npins == parser->pins_capacity) {
+		size_t capacity = parser->pins_capacity > 0
+				? 2 * parser->pins_capacity : 8;
+		parser->pins = (uint64_t *) realloc(parser->pins,
+				capacity * sizeof(uint64_t));
+		parser->pins_capacity = capacity;
+	}
+	parser->pins[parser->npins++] = offset;
+}
+
+/**
+ * Release one pin on an offset.
+ * @param parser		The parser.
+ * @param offset		The pinned offset.
+ */
+static void
+spsps_unpin_(Parser parser, uint64_t offset) {
+	for (size_t index = parser->npins; index > 0; --index) {
+		if (parser->pins[index - 1] == offset) {
+			parser->pins[index - 1] = parser->pins[--parser->npins];
+			return;
+		}
+	} // Find the pin.
+}
+
+/**
+ * One block of a read-ahead ring.
+ */
+typedef struct spsps_ahead_block_ {
+	/// The characters read.
+	SPSPS_CHAR * data;
+	/// The number of characters read.
+	size_t length;
+	/// Whether this is the last block, because the stream has ended.
+	bool last;
+#ifdef SPSPS_STATS
+	/// The time spent reading the block.
+	uint64_t read_nanos;
+#endif
+} spsps_ahead_block_;
+
+/**
+ * The read-ahead state of a stream parser.  A helper thread reads blocks of
+ * the stream into a ring, and the parser takes them out.  This is a single
+ * producer, single consumer ring with no lock: the thread only ever touches
+ * head, and the parser only ever touches tail.  The semaphores count the full
+ * and empty blocks and order the handoff; they only enter the kernel when
+ * one side has to sleep because the ring is full or empty.
+ */
+struct spsps_readahead_ {
+	/// The ring of blocks.
+	spsps_ahead_block_ * ring;
+	/// The number of blocks in the ring.
+	size_t blocks;
+	/// The number of blocks filled by the thread.
+	size_t head;
+	/// The number of blocks emptied by the parser.
+	size_t tail;
+#ifdef SPSPS_HAVE_READAHEAD
+	/// Whether the thread should stop.
+	atomic_bool stop;
+	/// Counts the empty blocks, so the thread can wait for one.
+	sem_t empty;
+	/// Counts the full blocks, so the parser can wait for one.
+	sem_t full;
+	/// The helper thread.
+	pthread_t thread;
+#endif
+	/// How many characters of the block at tail have been taken.
+	size_t taken;
+	/// Whether the parser holds the block at tail.
+	bool holding;
+	/// The stream.
+	FILE * stream;
+};
+
+#ifdef SPSPS_HAVE_READAHEAD
+/**
+ * The body of the read-ahead thread.  Read blocks until the stream ends or
+ * the parser says to stop.
+ * @param arg			The read-ahead state.
+ * @return				NULL.
+ */
+static void *
+spsps_read_ahead_main_(void * arg) {
+	struct spsps_readahead_ * ahead = (struct spsps_readahead_ *) arg;
+	while (true) {
+		sem_wait(&ahead->empty);
+		if (atomic_load_explicit(&ahead->stop, memory_order_acquire)) break;
+		spsps_ahead_block_ * block = &ahead->ring[ahead->head % ahead->blocks];
+#ifdef SPSPS_STATS
+		uint64_t start = spsps_nanos_();
+#endif
+		block->length = fread(block->data, sizeof(SPSPS_CHAR),
+				SPSPS_READAHEAD_BLOCK, ahead->stream);
+#ifdef SPSPS_STATS
+		block->read_nanos = spsps_nanos_() - start;
+#endif
+		block->last = block->length < SPSPS_READAHEAD_BLOCK;
+		ahead->head++;
+		sem_post(&ahead->full);
+		if (block->last) break;
+	} // Read blocks.
+	return NULL;
+}
+#endif
+
+static void
+spsps_take_ahead_(Parser parser, size_t need) {
+#ifdef SPSPS_HAVE_READAHEAD
+	struct spsps_readahead_ * ahead = parser->readahead;
+	while (parser->limit < parser->capacity && ! parser->drained) {
+		if (! ahead->holding) {
+			// Only sleep if the characters are still needed.
+			if (parser->limit - parser->next >= need) {
+				if (sem_trywait(&ahead->full) != 0) break;
+			} else {
+				while (sem_wait(&ahead->full) != 0) {}
+			}
+			ahead->holding = true;
+			ahead->taken = 0;
+			SPSPS_COUNT_(parser, reads, 1);
+			SPSPS_COUNT_(parser, read_nanos,
+					ahead->ring[ahead->tail % ahead->blocks].read_nanos);
+		}
+		spsps_ahead_block_ * block = &ahead->ring[ahead->tail % ahead->blocks];
+		size_t count = block->length - ahead->taken;
+		if (count > parser->capacity - parser->limit) {
+			count = parser->capacity - parser->limit;
+		}
+		memcpy(parser->window + parser->limit, block->data + ahead->taken,
+				count * sizeof(SPSPS_CHAR));
+		parser->limit += count;
+		ahead->taken += count;
+		if (ahead->taken == block->length) {
+			// Done with this block; hand it back.
+			if (block->last) parser->drained = true;
+			ahead->holding = false;
+			ahead->tail++;
+			sem_post(&ahead->empty);
+		}
+	} // Take blocks until the window is full.
+#endif
+}
+
+/**
+ * Stop the read-ahead thread and release the ring.
+ * @param parser		The parser.
+ */
+static void
+spsps_stop_ahead_(Parser parser) {
+#ifdef SPSPS_HAVE_READAHEAD
+	struct spsps_readahead_ * ahead = parser->readahead;
+	atomic_store_explicit(&ahead->stop, true, memory_order_release);
+	sem_post(&ahead->empty);
+	pthread_join(ahead->thread, NULL);
+	sem_destroy(&ahead->empty);
+	sem_destroy(&ahead->full);
+	for (size_t index = 0; index < ahead->blocks; ++index) {
+		free(ahead->ring[index].data);
+	} // Free the blocks.
+	free(ahead->ring);
+	free(ahead);
+	parser->readahead = NULL;
+#endif
+}
+
+/**
+ * The coroutine state of a push parser.
+ */
+struct spsps_push_ {
+	/// The rule to run.
+	spsps_rule rule;
+	/// The context passed to the rule.
+	void * context;
+	/// The value returned by the rule, once it is done.
+	void * result;
+	/// Whether the rule has been started.
+	bool started;
+	/// Whether the rule is running (that is, not suspended).
+	bool running;
+	/// Whether the rule has returned.
+	bool done;
+	/// The rule's stack.
+	void * stack;
+	/// The size of the rule's stack, in bytes.
+	size_t stack_size;
+#ifdef SPSPS_HAVE_PUSH
+	/// The context of the rule, while it is suspended.
+	ucontext_t rule_context;
+	/// The context of spsps_feed or spsps_finish, while the rule runs.
+	ucontext_t caller_context;
+#endif
+};
+
+#ifdef SPSPS_HAVE_PUSH
+/**
+ * The entry point of the coroutine.  The parser pointer is passed as two
+ * halves, since makecontext only passes int arguments.
+ * @param high			The high half of the parser pointer.
+ * @param low			The low half of the parser pointer.
+ */
+static void
+spsps_push_main_(unsigned int high, unsigned int low) {
+	Parser parser = (Parser) (((uintptr_t) high << 16 << 16) | (uintptr_t) low);
+	struct spsps_push_ * push = parser->push;
+	push->result = push->rule(parser, push->context);
+	push->done = true;
+	push->running = false;
+	// Returning resumes the caller, through uc_link.
+}
+#endif
+
+static bool
+spsps_yield_(Parser parser) {
+#ifdef SPSPS_HAVE_PUSH
+	struct spsps_push_ * push = parser->push;
+	if (! push->running) return false;
+	push->running = false;
+	swapcontext(&push->rule_context, &push->caller_context);
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ * Run the rule of a push parser until it needs more characters or is done.
+ * @param parser		The parser.
+ */
+static void
+spsps_resume_(Parser parser) {
+#ifdef SPSPS_HAVE_PUSH
+	struct spsps_push_ * push = parser->push;
+	if (push->done) return;
+	if (! push->started) {
+		push->started = true;
+		getcontext(&push->rule_context);
+		push->rule_context.uc_stack.ss_sp = push->stack;
+		push->rule_context.uc_stack.ss_size = push->stack_size;
+		push->rule_context.uc_link = &push->caller_context;
+		uintptr_t address = (uintptr_t) parser;
+		makecontext(&push->rule_context, (void (*)(void)) spsps_push_main_, 2,
+				(unsigned int) (address >> 16 >> 16),
+				(unsigned int) (address & 0xffffffffu));
+	}
+	push->running = true;
+	swapcontext(&push->caller_context, &push->rule_context);
+#endif
+}
+
+/**
+ * Consume leading characters that are in (or not in) a class.  This is the
+ * common implementation of the bulk consumption functions.
+ * @param parser		The parser.
+ * @param cls			The class.
+ * @param in			Whether to consume members (true) or non-members.
+ * @param buf			If not NULL, the consumed characters are copied here.
+ * @param max			The most characters to consume.
+ * @return				The number of characters consumed.
+ */
+static size_t
+spsps_scan_(Parser parser, CharClass cls, bool in, SPSPS_CHAR * buf,
+		size_t max) {
+	// Nothing is allocated or deallocated by this method.
+	parser->status = OK;
+	parser->look_count = 0;
+	size_t total = 0;
+	while (total < max) {
+		const SPSPS_CHAR * here = parser->buf + parser->next;
+		size_t avail = parser->limit - parser->next;
+		if (avail > max - total) avail = max - total;
+		size_t count = spsps_span_(here, avail, cls, in);
+		if (buf != NULL && count > 0) {
+			memcpy(buf + total, here, count * sizeof(SPSPS_CHAR));
+		}
+		parser->next += count;
+		total += count;
+		if (count < avail) break;
+		if (total < max && ! spsps_fill_(parser, 1)) break;
+	} // Scan everything available, reading more as needed.
+	SPSPS_COUNT_(parser, consumes, 1);
+	SPSPS_COUNT_(parser, consumed, total);
+	return total;
+}
+
+/**
+ * Stop the parser: from here on it behaves as if it had reached the end of
+ * the input.
+ * @param parser		The parser.
+ */
+static void
+spsps_stop_(Parser parser) {
+	// Just cut the input short.
+	parser->stopped = true;
+	parser->limit = parser->next;
+	parser->drained = true;
+}
+
+/// The length modifiers of a conversion specification.
+enum {
+	SPSPS_LEN_NONE, SPSPS_LEN_HH, SPSPS_LEN_H, SPSPS_LEN_L, SPSPS_LEN_LL,
+	SPSPS_LEN_J, SPSPS_LEN_Z, SPSPS_LEN_T, SPSPS_LEN_BIG_L
+};
+
+/**
+ * A conversion specification found in a format string.
+ */
+typedef struct spsps_spec_ {
+	/// The percent sign that starts the specification.
+	const char * start;
+	/// The start of the length modifier (or the conversion, if none).
+	const char * mod;
+	/// One past the conversion character.
+	const char * end;
+	/// The conversion character, or zero if the format ends early.
+	char conv;
+	/// The length modifier.
+	int length;
+	/// The number of asterisks (arguments for the width and precision).
+	int stars;
+} spsps_spec_;
+
+/**
+ * Find the next conversion specification in a format string.  Escaped
+ * percent signs are not conversions, and are skipped.
+ * @param fmt			Where to start looking.
+ * @param spec			Filled in with the specification found.
+ * @return				True iff a specification was found.
+ */
+static bool
+spsps_next_spec_(const char * fmt, spsps_spec_ * spec) {
+	while ((fmt = strchr(fmt, '%')) != NULL && fmt[1] == '%') fmt += 2;
+	if (fmt == NULL) return false;
+	spec->start = fmt++;
+	spec->stars = 0;
+	while (*fmt != 0 && strchr("-+ #0", *fmt) != NULL) ++fmt;
+	if (*fmt == '*') {
+		++spec->stars;
+		++fmt;
+	}
+	while (*fmt >= '0' && *fmt <= '9') ++fmt;
+	if (*fmt == '.') {
+		++fmt;
+		if (*fmt == '*') {
+			++spec->stars;
+			++fmt;
+		}
+		while (*fmt >= '0' && *fmt <= '9') ++fmt;
+	}
+	spec->mod = fmt;
+	spec->length = SPSPS_LEN_NONE;
+	switch (*fmt) {
+	case 'h':
+		spec->length = (fmt[1] == 'h') ? SPSPS_LEN_HH : SPSPS_LEN_H;
+		break;
+	case 'l':
+		spec->length = (fmt[1] == 'l') ? SPSPS_LEN_LL : SPSPS_LEN_L;
+		break;
+	case 'j': spec->length = SPSPS_LEN_J; break;
+	case 'z': spec->length = SPSPS_LEN_Z; break;
+	case 't': spec->length = SPSPS_LEN_T; break;
+	case 'L': spec->length = SPSPS_LEN_BIG_L; break;
+	default: break;
+	}
+	if (spec->length == SPSPS_LEN_HH || spec->length == SPSPS_LEN_LL) fmt += 2;
+	else if (spec->length != SPSPS_LEN_NONE) fmt += 1;
+	spec->conv = *fmt;
+	spec->end = (*fmt != 0) ? fmt + 1 : fmt;
+	return true;
+}
+
+/**
+ * Record the arguments of a message in an error, without formatting them.
+ * The format string says what the arguments are, just as for printf.
+ * @param error			The error.  Its message must be set.
+ * @param ap			The arguments.
+ */
+static void
+spsps_capture_args_(spsps_error * error, va_list * ap) {
+	spsps_spec_ spec;
+	size_t used = 0;
+	const char * fmt = error->msg;
+	error->nargs = 0;
+	while (spsps_next_spec_(fmt, &spec)) {
+		fmt = spec.end;
+		if (spec.conv == 0) break;
+		if (error->nargs + (size_t) spec.stars + 1 > SPSPS_ERROR_ARGS) break;
+		for (int star = 0; star < spec.stars; ++star) {
+			error->args[error->nargs++].i = va_arg(*ap, int);
+		} // Record the width and precision.
+		spsps_error_arg * arg = &error->args[error->nargs++];
+		switch (spec.conv) {
+		case 'd': case 'i':
+			switch (spec.length) {
+			case SPSPS_LEN_HH: arg->i = (signed char) va_arg(*ap, int); break;
+			case SPSPS_LEN_H: arg->i = (short) va_arg(*ap, int); break;
+			case SPSPS_LEN_L: arg->i = va_arg(*ap, long); break;
+			case SPSPS_LEN_LL: arg->i = va_arg(*ap, long long); break;
+			case SPSPS_LEN_J: arg->i = va_arg(*ap, intmax_t); break;
+			case SPSPS_LEN_Z: arg->i = (intmax_t) va_arg(*ap, size_t); break;
+			case SPSPS_LEN_T: arg->i = va_arg(*ap, ptrdiff_t); break;
+			default: arg->i = va_arg(*ap, int); break;
+			}
+			break;
+		case 'o': case 'u': case 'x': case 'X':
+			switch (spec.length) {
+			case SPSPS_LEN_HH:
+				arg->u = (unsigned char) va_arg(*ap, unsigned int);
+				break;
+			case SPSPS_LEN_H:
+				arg->u = (unsigned short) va_arg(*ap, unsigned int);
+				break;
+			case SPSPS_LEN_L: arg->u = va_arg(*ap, unsigned long); break;
+			case SPSPS_LEN_LL: arg->u = va_arg(*ap, unsigned long long); break;
+			case SPSPS_LEN_J: arg->u = va_arg(*ap, uintmax_t); break;
+			case SPSPS_LEN_Z: arg->u = va_arg(*ap, size_t); break;
+			case SPSPS_LEN_T: arg->u = (uintmax_t) va_arg(*ap, ptrdiff_t); break;
+			default: arg->u = va_arg(*ap, unsigned int); break;
+			}
+			break;
+		case 'c':
+			if (spec.length == SPSPS_LEN_L) arg->i = va_arg(*ap, wint_t);
+			else arg->i = va_arg(*ap, int);
+			break;
+		case 'e': case 'E': case 'f': case 'F':
+		case 'g': case 'G': case 'a': case 'A':
+			if (spec.length == SPSPS_LEN_BIG_L) {
+				arg->d = (double) va_arg(*ap, long double);
+			} else {
+				arg->d = va_arg(*ap, double);
+			}
+			break;
+		case 's':
+			// Copy the string, since it may not outlive the error.  Wide
+			// strings are narrowed.
+			arg->s = used;
+			if (spec.length == SPSPS_LEN_L) {
+				const wchar_t * str = va_arg(*ap, const wchar_t *);
+				if (str == NULL) str = L"(null)";
+				for (; *str != 0 && used + 1 < SPSPS_ERROR_TEXT; ++str) {
+					error->text[used++] = (*str < 128) ? (char) *str : '?';
+				} // Copy the string.
+			} else {
+				const char * str = va_arg(*ap, const char *);
+				if (str == NULL) str = "(null)";
+				for (; *str != 0 && used + 1 < SPSPS_ERROR_TEXT; ++str) {
+					error->text[used++] = *str;
+				} // Copy the string.
+			}
+			if (used < SPSPS_ERROR_TEXT) error->text[used++] = 0;
+			else error->text[SPSPS_ERROR_TEXT - 1] = 0;
+			break;
+		default:
+			// Pointers, and the count (which is never written).
+			arg->p = va_arg(*ap, void *);
+			break;
+		}
+	} // Record all arguments.
+}
+
+/**
+ * Append to a bounded buffer, keeping track of the full length, as for
+ * snprintf.
+ * @param buf			The buffer.
+ * @param size			The size of the buffer.
+ * @param len			The length so far, which is updated.
+ * @param fmt			The format string.
+ */
+static void
+spsps_append_(char * buf, size_t size, size_t * len, const char * fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	int count = vsnprintf(*len < size ? buf + *len : NULL,
+			*len < size ? size - *len : 0, fmt, ap);
+	va_end(ap);
+	if (count > 0) *len += (size_t) count;
+}
+
+/**
+ * Render an error report as printed, as with snprintf.  The line ends with a
+ * newline, but to make room for the null terminator it is rendered as a
+ * space; the caller swaps it in.
+ * @param parser		The parser, or NULL.
+ * @param buf			The buffer.
+ * @param size			The size of the buffer.
+ * @param msg			The format string, or NULL.
+ * @param ap			The arguments.
+ * @return				The length of the full line, including the newline.
+ */
+static size_t
+spsps_render_report_(Parser parser, char * buf, size_t size,
+		const char * msg, va_list ap) {
+	size_t len = 0;
+	if (parser != NULL) {
+		Loc loc = spsps_location(parser);
+		spsps_append_(buf, size, &len, "ERROR %s:%" PRIu64 ":%" PRIu64 ": ",
+				loc.name, loc.line, loc.column);
+	} else {
+		spsps_append_(buf, size, &len, "ERROR: ");
+	}
+	if (msg != NULL) {
+		int count = vsnprintf(len < size ? buf + len : NULL,
+				len < size ? size - len : 0, msg, ap);
+		if (count > 0) len += (size_t) count;
+	} else {
+		spsps_append_(buf, size, &len, "Unspecified error.");
+	}
+	spsps_append_(buf, size, &len, " ");
+	return len;
 }
 
 //======================================================================
@@ -122,14 +1515,14 @@ spsps_loc_to_string(Loc * loc) {
 		ret[0] = 0;
 		return ret;
 	}
-	// Generate the string.  An unsigned 32 bit integer can produce (with no
-	// bugs) a value up to 2^32-1.  This is 4*2^30-1, or roughly 4*10^9.  We
-	// allocate 12 digits for each number (which is sufficient), two for
-	// colons, and one for the terminating null.  This is 27.  We then add the
-	// strlen of the name.
-	size_t mlen = 27 + strlen(loc->name);
+	// Generate the string.  An unsigned 64 bit integer can produce (with no
+	// bugs) a value up to 2^64-1, which has 20 digits.  We allocate 20
+	// digits for each number, two for colons, and one for the terminating
+	// null.  This is 43.  We then add the strlen of the name.
+	size_t mlen = 43 + strlen(loc->name);
 	char * buf = (char *) malloc(mlen);
-	sprintf(buf, "%s:%d:%d", loc->name, loc->line, loc->column);
+	sprintf(buf, "%s:%" PRIu64 ":%" PRIu64, loc->name, loc->line,
+			loc->column);
 	if (strlen(buf) > mlen) {
 		// This should never, never, never happen.
 		fprintf(stderr, "Internal error in loc string construction.\n");
@@ -140,64 +1533,751 @@ spsps_loc_to_string(Loc * loc) {
 
 SPSPS_CHAR
 spsps_look_(Parser parser, size_t n) {
-	// Allocation: Nothing is allocated or deallocated by this method.
-	if (n >= SPSPS_LOOK) {
-		// Lookahead too large.
-		parser->errno = LOOKAHEAD_TOO_LARGE;
-		return 0;
-	}
+	// Allocation: The window may be allocated or grown by this method.
 	// If we look too long without progressing, the parser may be stalled.
 	parser->look_count++;
-	if (parser->look_count > 1000) {
+	if (parser->look_count > SPSPS_STALL_LOOKS) {
 		// Stalled.
-		parser->errno = STALLED;
+		parser->status = STALLED;
+		SPSPS_COUNT_(parser, stalls, 1);
+		return SPSPS_EOF;
+	}
+	if (n >= parser->max_lookahead) {
+		parser->status = LOOKAHEAD_TOO_LARGE;
 		return SPSPS_EOF;
 	}
 
-	if(!parser->initialized){
-		spsps_initialize_parser_(parser);
+	// The end of file lies past the limit, once the source is drained.
+	if (parser->next + n < parser->limit || spsps_fill_(parser, n + 1)) {
+		return parser->buf[parser->next + n];
 	}
+	return SPSPS_EOF;
+}
 
-	// Look in the correct block.
-	if (n + parser->next < SPSPS_LOOK) {
-		return parser->blocks[parser->block][n + parser->next];
-	} else {
-		return parser->blocks[parser->block^1][n + parser->next - SPSPS_LOOK];
+/**
+ * The default allocator, which uses realloc and free.
+ * @param context		Ignored.
+ * @param ptr			The memory to resize, or NULL.
+ * @param old_size		Ignored.
+ * @param new_size		The new size, or zero to free the memory.
+ * @return				The memory, or NULL.
+ */
+static void *
+spsps_default_allocator_(void * context, void * ptr, size_t old_size,
+		size_t new_size) {
+	if (new_size == 0) {
+		free(ptr);
+		return NULL;
+	}
+	return realloc(ptr, new_size);
+}
+
+/**
+ * Apply options to a parser that has no window yet.
+ * @param parser		The parser.
+ * @param options		The options, or NULL for the defaults.
+ */
+static void
+spsps_configure_(Parser parser, const spsps_options * options) {
+	parser->block = SPSPS_LOOK;
+	parser->max_lookahead = SIZE_MAX;
+	parser->allocator = spsps_default_allocator_;
+	parser->allocator_context = NULL;
+	if (options == NULL) return;
+	if (options->block > 0) parser->block = options->block;
+	if (options->max_lookahead > 0) {
+		parser->max_lookahead = options->max_lookahead;
+	}
+	if (options->allocator != NULL) {
+		parser->allocator = options->allocator;
+		parser->allocator_context = options->allocator_context;
+	}
+}
+
+/**
+ * Put a parser in the state of a new stream parser, without touching its
+ * window, pins, or name.  Anything held for the previous source must already
+ * have been released by spsps_clear_.
+ * @param parser		The parser.
+ * @param stream		The stream to parse.  If NULL, stdin is used.
+ */
+static void
+spsps_init_(Parser parser, FILE * stream) {
+	parser->buf = parser->window;
+	parser->next = 0;
+	parser->limit = 0;
+	parser->base = 0;
+	parser->drained = false;
+	parser->in_memory = false;
+	parser->at_eof = false;
+	parser->eof_count = 0;
+	parser->look_count = 0;
+	parser->stream = (stream != NULL) ? stream : stdin;
+	parser->source = spsps_stream_source_;
+	parser->source_context = parser->stream;
+	parser->pending = NULL;
+	parser->pending_length = 0;
+	parser->npins = 0;
+	parser->utf8 = false;
+	parser->utf8_checked = 0;
+	parser->utf8_bad = UINT64_MAX;
+	parser->loc_offset = 0;
+	parser->loc_line = 1;
+	parser->loc_column = 1;
+	parser->status = OK;
+	parser->error_mode = SPSPS_ERRORS_PRINT;
+	parser->error_total = 0;
+	parser->stopped = false;
+#ifdef SPSPS_STATS
+	memset(&parser->stats, 0, sizeof(parser->stats));
+#endif
+}
+
+/**
+ * Release everything a parser holds for its current source: the read-ahead
+ * thread, the push coroutine, mapped or copied data, the source hooks (which
+ * are closed), and a copied name.  The window and pins are kept for the next
+ * source.
+ * @param parser		The parser.
+ */
+static void
+spsps_clear_(Parser parser) {
+#ifdef SPSPS_STATS
+	// The counters are in the totals now, and must not be added again when
+	// a pooled parser is finally freed.
+	spsps_flush_stats_(parser);
+	memset(&parser->stats, 0, sizeof(parser->stats));
+#endif
+#ifdef SPSPS_HAVE_MMAP
+	if (parser->mapped > 0) munmap((void *) parser->buf, parser->mapped);
+#endif
+	if (parser->owns_data) free((void *) parser->buf);
+	parser->mapped = 0;
+	parser->owns_data = false;
+	parser->buf = NULL;
+	if (parser->readahead != NULL) spsps_stop_ahead_(parser);
+	if (parser->push != NULL) {
+		free(parser->push->stack);
+		free(parser->push);
+		parser->push = NULL;
+	}
+	if (parser->source.close != NULL) {
+		parser->source.close(parser->source_context);
 	}
+	parser->source = spsps_stream_source_;
+	parser->source_context = NULL;
+	parser->pending = NULL;
+	parser->pending_length = 0;
+	if (parser->owns_name) free(parser->name);
+	parser->name = NULL;
+	parser->owns_name = false;
+	parser->stream = NULL;
 }
 
 //======================================================================
 // Implementation of public interface.
 //======================================================================
 
+CharClass
+spsps_class_new(const char * members) {
+	struct spsps_class_ * cls = (struct spsps_class_ *) malloc(
+			sizeof(struct spsps_class_));
+	spsps_class_init_(cls, members);
+	return cls;
+}
+
+CharClass
+spsps_class_range(uint32_t low, uint32_t high) {
+	struct spsps_class_ * cls = (struct spsps_class_ *) malloc(
+			sizeof(struct spsps_class_));
+	spsps_class_init_(cls, NULL);
+	for (uint32_t code = low; code <= high && code < 256; ++code) {
+		cls->bits[code >> 3] |= (uint8_t) (1 << (code & 7));
+	} // Add the codes below 256 to the bitmap.
+	if (high >= 256 && high >= low) {
+		cls->wide = (uint32_t (*)[2]) malloc(sizeof(uint32_t[2]));
+		cls->wide[0][0] = (low < 256) ? 256 : low;
+		cls->wide[0][1] = high;
+		cls->nwide = 1;
+	}
+	spsps_class_runs_(cls);
+	return cls;
+}
+
+CharClass
+spsps_class_union(CharClass first, CharClass second) {
+	struct spsps_class_ * cls = (struct spsps_class_ *) malloc(
+			sizeof(struct spsps_class_));
+	spsps_class_init_(cls, NULL);
+	for (size_t index = 0; index < sizeof(cls->bits); ++index) {
+		cls->bits[index] = first->bits[index] | second->bits[index];
+	} // Combine the bitmaps.
+	cls->nwide = first->nwide + second->nwide;
+	if (cls->nwide > 0) {
+		cls->wide = (uint32_t (*)[2]) malloc(cls->nwide * sizeof(uint32_t[2]));
+		memcpy(cls->wide, first->wide, first->nwide * sizeof(uint32_t[2]));
+		memcpy(cls->wide + first->nwide, second->wide,
+				second->nwide * sizeof(uint32_t[2]));
+	}
+	spsps_class_runs_(cls);
+	return cls;
+}
+
+void
+spsps_class_free(CharClass cls) {
+	if (cls == NULL || cls->builtin) return;
+	free(cls->wide);
+	free((void *) cls);
+}
+
+bool
+spsps_class_has(CharClass cls, SPSPS_CHAR ch) {
+	// Nothing is allocated or deallocated by this method.
+	return spsps_class_has_(cls, ch);
+}
+
+int
+spsps_loc_format(const Loc * loc, char * buf, size_t size) {
+	// Nothing is allocated or deallocated by this method.
+	if (loc == NULL) return snprintf(buf, size, "%s", "");
+	return snprintf(buf, size, "%s:%" PRIu64 ":%" PRIu64, loc->name,
+			loc->line, loc->column);
+}
+
+void
+spsps_error_report(Parser parser, FILE * out, int code, const char * msg,
+		...) {
+	// Nothing is allocated or deallocated by this method.
+	va_list ap;
+	if (parser != NULL) SPSPS_COUNT_(parser, errors, 1);
+	if (parser == NULL || parser->error_mode == SPSPS_ERRORS_PRINT) {
+		if (out == NULL) out = stderr;
+		// Write the whole line at once, so that errors from parsers on other
+		// threads sharing the stream are not interleaved with it.
+		char local[256];
+		char * line = local;
+		va_start(ap, msg);
+		size_t len = spsps_render_report_(parser, line, sizeof(local), msg,
+				ap);
+		va_end(ap);
+		if (len >= sizeof(local)) {
+			line = (char *) malloc(len + 1);
+			if (line == NULL) return;
+			va_start(ap, msg);
+			spsps_render_report_(parser, line, len + 1, msg, ap);
+			va_end(ap);
+		}
+		line[len - 1] = '\n';
+		fwrite(line, 1, len, out);
+		if (line != local) free(line);
+		return;
+	}
+	// A parser that stopped at its first error ignores the rest.
+	if (parser->stopped) return;
+	spsps_error * error =
+			&parser->errors[parser->error_total % SPSPS_ERROR_RING];
+	parser->error_total++;
+	error->code = code;
+	error->loc = spsps_location(parser);
+	error->msg = (msg != NULL) ? msg : "Unspecified error.";
+	va_start(ap, msg);
+	spsps_capture_args_(error, &ap);
+	va_end(ap);
+	if (parser->error_mode == SPSPS_ERRORS_FIRST) spsps_stop_(parser);
+}
+
+void
+spsps_set_error_mode(Parser parser, spsps_error_mode mode) {
+	parser->error_mode = mode;
+}
+
+size_t
+spsps_error_count(Parser parser) {
+	return parser->error_total;
+}
+
+const spsps_error *
+spsps_error_at(Parser parser, size_t index) {
+	size_t kept = parser->error_total < SPSPS_ERROR_RING
+			? parser->error_total : SPSPS_ERROR_RING;
+	if (index >= kept) return NULL;
+	return &parser->errors[(parser->error_total - kept + index)
+			% SPSPS_ERROR_RING];
+}
+
+void
+spsps_clear_errors(Parser parser) {
+	parser->error_total = 0;
+}
+
+int
+spsps_error_format(const spsps_error * error, char * buf, size_t size) {
+	// Nothing is allocated or deallocated by this method.
+	size_t len = 0;
+	if (size > 0) buf[0] = 0;
+	spsps_append_(buf, size, &len, "ERROR %s:%" PRIu64 ":%" PRIu64 ": ",
+			error->loc.name, error->loc.line, error->loc.column);
+	const char * fmt = error->msg;
+	size_t arg = 0;
+	spsps_spec_ spec;
+	bool more = true;
+	while (more) {
+		more = spsps_next_spec_(fmt, &spec) && spec.conv != 0;
+		// Copy the text up to the specification, unescaping percent signs.
+		const char * upto = more ? spec.start : fmt + strlen(fmt);
+		while (fmt < upto) {
+			const char * pct = memchr(fmt, '%', (size_t) (upto - fmt));
+			const char * stop = (pct != NULL) ? pct + 1 : upto;
+			spsps_append_(buf, size, &len, "%.*s", (int) (stop - fmt), fmt);
+			fmt = (pct != NULL) ? pct + 2 : upto;
+		} // Copy the text.
+		if (! more) break;
+		fmt = spec.end;
+		if (arg + (size_t) spec.stars + 1 > error->nargs) {
+			// This argument was not recorded.
+			spsps_append_(buf, size, &len, "?");
+			continue;
+		}
+		// Rebuild the specification with the width and precision filled
+		// in, and with a length modifier that matches the recorded value.
+		char rebuilt[64];
+		size_t at = 0;
+		for (const char * here = spec.start; here < spec.mod; ++here) {
+			if (*here == '*') {
+				at += (size_t) snprintf(rebuilt + at, sizeof(rebuilt) - at,
+						"%d", (int) error->args[arg++].i);
+			} else if (at + 1 < sizeof(rebuilt)) {
+				rebuilt[at++] = *here;
+			}
+		} // Copy the flags, width, and precision.
+		if (at + 3 > sizeof(rebuilt)) at = sizeof(rebuilt) - 3;
+		const spsps_error_arg * value = &error->args[arg++];
+		switch (spec.conv) {
+		case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+			rebuilt[at++] = 'j';
+			rebuilt[at++] = spec.conv;
+			rebuilt[at] = 0;
+			if (spec.conv == 'd' || spec.conv == 'i') {
+				spsps_append_(buf, size, &len, rebuilt, value->i);
+			} else {
+				spsps_append_(buf, size, &len, rebuilt, value->u);
+			}
+			break;
+		case 'c':
+			rebuilt[at++] = 'c';
+			rebuilt[at] = 0;
+			spsps_append_(buf, size, &len, rebuilt, (int) value->i);
+			break;
+		case 'e': case 'E': case 'f': case 'F':
+		case 'g': case 'G': case 'a': case 'A':
+			rebuilt[at++] = spec.conv;
+			rebuilt[at] = 0;
+			spsps_append_(buf, size, &len, rebuilt, value->d);
+			break;
+		case 's':
+			rebuilt[at++] = 's';
+			rebuilt[at] = 0;
+			spsps_append_(buf, size, &len, rebuilt, error->text + value->s);
+			break;
+		case 'p':
+			rebuilt[at++] = 'p';
+			rebuilt[at] = 0;
+			spsps_append_(buf, size, &len, rebuilt, value->p);
+			break;
+		default:
+			// Nothing is written for the count, or for unknown conversions.
+			break;
+		}
+	} // Render the message.
+	return (int) len;
+}
+
 Parser
 spsps_new(char * name, FILE * stream) {
 	// Allocate a new parser.  Duplicate the name.
+	return spsps_new_ex(name, stream, NULL);
+}
+
+Parser
+spsps_new_ex(char * name, FILE * stream, const spsps_options * options) {
+	// Allocate a new parser.  Duplicate the name.  The window is allocated
+	// on first use.
 	Parser parser = (Parser) calloc(1, sizeof(struct spsps_parser_));
-	parser->at_eof = false;
-	parser->block = 0;
-	parser->eof_count = 0;
-	parser->look_count = 0;
-	if (name != NULL) parser->name = strdup(name);
-	else parser->name = strdup("(unknown)");
-	parser->next = 0;
-	if (stream != NULL) parser->stream = stream;
-	else parser->stream = stdin;
-	parser->column = 1;
-	parser->line = 1;
-	parser->errno = OK;
-	parser->initialized = false;
+	parser->window = NULL;
+	parser->capacity = 0;
+	parser->pins = NULL;
+	parser->pins_capacity = 0;
+	parser->push = NULL;
+	parser->readahead = NULL;
+	parser->mapped = 0;
+	parser->owns_data = false;
+	spsps_configure_(parser, options);
+	spsps_init_(parser, stream);
+	parser->name = strdup(name != NULL ? name : "(unknown)");
+	parser->owns_name = true;
+	return parser;
+}
+
+Parser
+spsps_new_source(char * name, const spsps_source * source, void * context) {
+	// Allocate a new parser.  Duplicate the name.  The window is allocated
+	// on first use, and only if a block has to be copied.
+	if (source == NULL || (source->read == NULL && source->map == NULL)) {
+		return NULL;
+	}
+	Parser parser = spsps_new(name, NULL);
+	parser->stream = NULL;
+	parser->source = *source;
+	parser->source_context = context;
+	return parser;
+}
+
+#ifdef SPSPS_HAVE_IOV
+/**
+ * The state of a source over an iovec.
+ */
+typedef struct spsps_iov_ {
+	/// The number of segments.
+	size_t count;
+	/// The number of segments handed over.
+	size_t at;
+	/// The segments.
+	struct iovec segments[];
+} spsps_iov_;
+
+/**
+ * The map hook of a source over an iovec.  Each segment is handed over as
+ * a block.
+ * @param context		The iovec state.
+ * @param length		Set to the length of the block.
+ * @return				The block, or NULL after the last segment.
+ */
+static const SPSPS_CHAR *
+spsps_iov_map_(void * context, size_t * length) {
+	spsps_iov_ * iov = (spsps_iov_ *) context;
+	// An empty block would end the source, so skip empty segments.
+	while (iov->at < iov->count) {
+		const struct iovec * segment = &iov->segments[iov->at++];
+		*length = segment->iov_len / sizeof(SPSPS_CHAR);
+		if (*length > 0) return (const SPSPS_CHAR *) segment->iov_base;
+	} // Find a segment that is not empty.
+	return NULL;
+}
+
+/**
+ * The close hook of a source over an iovec.
+ * @param context		The iovec state.
+ */
+static void
+spsps_iov_close_(void * context) {
+	free(context);
+}
+#endif
+
+Parser
+spsps_new_iov(char * name, const struct iovec * iov, size_t count) {
+#ifdef SPSPS_HAVE_IOV
+	// The segment list is copied; the segments themselves are borrowed.
+	if (iov == NULL && count > 0) return NULL;
+	spsps_iov_ * state = (spsps_iov_ *) malloc(sizeof(spsps_iov_) +
+			count * sizeof(struct iovec));
+	if (state == NULL) return NULL;
+	state->count = count;
+	state->at = 0;
+	if (count > 0) memcpy(state->segments, iov, count * sizeof(struct iovec));
+	spsps_source source = { NULL, spsps_iov_map_, spsps_iov_close_ };
+	return spsps_new_source(name, &source, state);
+#else
+	// There is no iovec on this platform.
+	return NULL;
+#endif
+}
+
+/**
+ * Create a parser over a memory-backed source.  The parser borrows the data,
+ * which must remain valid until the parser is freed.
+ * @param name 			The name of the source.
+ * @param data 			The characters to parse.  May be NULL if length is 0.
+ * @param length 		The number of characters to parse.
+ * @return 				The new parser instance.
+ */
+static Parser
+spsps_new_memory_(char * name, const SPSPS_CHAR * data, size_t length) {
+	// The whole source is already there, so there is nothing to read.
+	Parser parser = spsps_new(name, NULL);
+	parser->stream = NULL;
+	parser->buf = data;
+	parser->limit = (data != NULL) ? length : 0;
+	parser->drained = true;
+	parser->in_memory = true;
+	return parser;
+}
+
+Parser
+spsps_new_buffer(char * name, const SPSPS_CHAR * data, size_t length) {
+	return spsps_new_memory_(name, data, length);
+}
+
+Parser
+spsps_new_xstring(char * name, xstring str) {
+	return spsps_new_memory_(name, xstr_data(str), xstr_length(str));
+}
+
+Parser
+spsps_new_push(char * name, spsps_rule rule, void * context,
+		size_t stack_size) {
+#ifdef SPSPS_HAVE_PUSH
+	if (rule == NULL) return NULL;
+	if (stack_size == 0) stack_size = SPSPS_PUSH_STACK;
+	void * stack = malloc(stack_size);
+	if (stack == NULL) return NULL;
+	Parser parser = spsps_new(name, NULL);
+	parser->stream = NULL;
+	parser->push = (struct spsps_push_ *) calloc(1,
+			sizeof(struct spsps_push_));
+	parser->push->rule = rule;
+	parser->push->context = context;
+	parser->push->result = NULL;
+	parser->push->started = false;
+	parser->push->running = false;
+	parser->push->done = false;
+	parser->push->stack = stack;
+	parser->push->stack_size = stack_size;
+	return parser;
+#else
+	// There is no coroutine support on this platform.
+	return NULL;
+#endif
+}
+
+bool
+spsps_feed(Parser parser, const SPSPS_CHAR * chunk, size_t length) {
+	// The window may be allocated or grown by this method.
+	if (parser->push == NULL) return false;
+	if (parser->drained) return parser->push->done;
+	if (length > 0) {
+		if (! spsps_make_room_(parser, length)) return false;
+		memcpy(parser->window + parser->limit, chunk,
+				length * sizeof(SPSPS_CHAR));
+		parser->limit += length;
+		spsps_utf8_check_(parser);
+	}
+	spsps_resume_(parser);
+	return parser->push->done;
+}
+
+void *
+spsps_finish(Parser parser) {
+	// Nothing is allocated or deallocated by this method.
+	if (parser->push == NULL) return NULL;
+	parser->drained = true;
+	spsps_utf8_check_(parser);
+	spsps_resume_(parser);
+	return parser->push->result;
+}
+
+bool
+spsps_readahead(Parser parser, size_t blocks) {
+#ifdef SPSPS_HAVE_READAHEAD
+	// Only a parser that reads its own stream can read ahead.
+	if (parser->stream == NULL || parser->in_memory || parser->push != NULL ||
+			parser->readahead != NULL || parser->drained) {
+		return false;
+	}
+	if (blocks < 2) blocks = 2;
+	struct spsps_readahead_ * ahead = (struct spsps_readahead_ *) calloc(1,
+			sizeof(struct spsps_readahead_));
+	ahead->blocks = blocks;
+	ahead->ring = (spsps_ahead_block_ *) calloc(blocks,
+			sizeof(spsps_ahead_block_));
+	for (size_t index = 0; index < blocks; ++index) {
+		ahead->ring[index].data = (SPSPS_CHAR *) malloc(
+				SPSPS_READAHEAD_BLOCK * sizeof(SPSPS_CHAR));
+	} // Allocate the blocks.
+	ahead->head = 0;
+	ahead->tail = 0;
+	atomic_init(&ahead->stop, false);
+	sem_init(&ahead->empty, 0, (unsigned int) blocks);
+	sem_init(&ahead->full, 0, 0);
+	ahead->taken = 0;
+	ahead->holding = false;
+	ahead->stream = parser->stream;
+	parser->readahead = ahead;
+	if (pthread_create(&ahead->thread, NULL, spsps_read_ahead_main_,
+			ahead) != 0) {
+		// No thread, so just read the stream as usual.
+		sem_destroy(&ahead->empty);
+		sem_destroy(&ahead->full);
+		for (size_t index = 0; index < blocks; ++index) {
+			free(ahead->ring[index].data);
+		} // Free the blocks.
+		free(ahead->ring);
+		free(ahead);
+		parser->readahead = NULL;
+		return false;
+	}
+	return true;
+#else
+	// There is no thread support on this platform.
+	return false;
+#endif
+}
+
+/**
+ * Close a stream opened by the parser.  This is the close hook of a parser
+ * that spsps_new_mmap made over a stream.
+ * @param context		The stream.
+ */
+static void
+spsps_close_stream_(void * context) {
+	fclose((FILE *) context);
+}
+
+Parser
+spsps_new_mmap(char * name, char * path) {
+	if (path == NULL) return NULL;
+	FILE * stream = fopen(path, "rb");
+	if (stream == NULL) return NULL;
+	// Pipes and other streams that cannot seek have no size.
+	long size = -1;
+	if (fseek(stream, 0L, SEEK_END) == 0) size = ftell(stream);
+	const SPSPS_CHAR * data = NULL;
+	size_t length = (size > 0) ? (size_t) size / sizeof(SPSPS_CHAR) : 0;
+	size_t mapped = 0;
+	bool owns_data = false;
+	if (length > 0) {
+#ifdef SPSPS_HAVE_MMAP
+		void * map = mmap(NULL, (size_t) size, PROT_READ, MAP_PRIVATE,
+				fileno(stream), 0);
+		if (map != MAP_FAILED) {
+			// We read the mapping front to back.
+			madvise(map, (size_t) size, MADV_SEQUENTIAL);
+			data = (const SPSPS_CHAR *) map;
+			mapped = (size_t) size;
+		}
+#else
+		// No mmap here.  Read the whole file into memory instead, which
+		// still avoids the refill on every block.
+		SPSPS_CHAR * buf = (SPSPS_CHAR *) malloc(length * sizeof(SPSPS_CHAR));
+		rewind(stream);
+		if (buf != NULL &&
+				fread(buf, sizeof(SPSPS_CHAR), length, stream) == length) {
+			data = buf;
+			owns_data = true;
+		} else {
+			free(buf);
+		}
+#endif
+	}
+	if (data == NULL) {
+		// The file could not be mapped (it may be a pipe, or report no
+		// size), so read it as a stream, which the parser then owns.
+		if (size >= 0) rewind(stream);
+		clearerr(stream);
+		Parser parser = spsps_new(name != NULL ? name : path, stream);
+		parser->source.close = spsps_close_stream_;
+		return parser;
+	}
+	// The mapping remains valid after the file is closed.
+	fclose(stream);
+	Parser parser = spsps_new_memory_(name != NULL ? name : path, data,
+			length);
+	parser->mapped = mapped;
+	parser->owns_data = owns_data;
+	return parser;
+}
+
+void
+spsps_free(Parser parser) {
+	// Free the parser name and the parser itself.  Release any data we
+	// mapped or allocated for a memory-backed source.
+	spsps_clear_(parser);
+	spsps_drop_window_(parser);
+	free(parser->pins);
+	parser->pins = NULL;
+	parser->at_eof = true;
+	free(parser);
+}
+
+void
+spsps_reset(Parser parser, const char * name, FILE * stream) {
+	// The window and pins are kept; anything else held for the old source
+	// is released.
+	spsps_clear_(parser);
+	spsps_init_(parser, stream);
+	parser->name = (char *) (name != NULL ? name : "(unknown)");
+}
+
+void
+spsps_reset_buffer(Parser parser, const char * name, const SPSPS_CHAR * data,
+		size_t length) {
+	// Nothing is allocated by this method.
+	spsps_reset(parser, name, NULL);
+	parser->stream = NULL;
+	parser->buf = data;
+	parser->limit = (data != NULL) ? length : 0;
+	parser->drained = true;
+	parser->in_memory = true;
+}
+
+//======================================================================
+// Parser pools.
+//======================================================================
+
+/// The parsers released by this thread, waiting to be acquired again.
+static _Thread_local Parser spsps_pool_[SPSPS_POOL_SIZE];
+
+/// The number of parsers in the pool of this thread.
+static _Thread_local size_t spsps_pooled_ = 0;
+
+Parser
+spsps_acquire(const char * name, FILE * stream) {
+	// A parser is only allocated if the pool is empty.
+	Parser parser;
+	if (spsps_pooled_ > 0) {
+		parser = spsps_pool_[--spsps_pooled_];
+		// The options of whoever released the parser do not carry over.  A
+		// window from another allocator is given back to it first.
+		if (parser->allocator != spsps_default_allocator_) {
+			spsps_drop_window_(parser);
+		}
+		spsps_configure_(parser, NULL);
+		spsps_init_(parser, stream);
+	} else {
+		parser = (Parser) calloc(1, sizeof(struct spsps_parser_));
+		spsps_configure_(parser, NULL);
+		spsps_init_(parser, stream);
+	}
+	parser->name = (char *) (name != NULL ? name : "(unknown)");
+	return parser;
+}
+
+Parser
+spsps_acquire_buffer(const char * name, const SPSPS_CHAR * data,
+		size_t length) {
+	// A parser is only allocated if the pool is empty.
+	Parser parser = spsps_acquire(name, NULL);
+	spsps_reset_buffer(parser, name, data, length);
 	return parser;
 }
 
 void
-spsps_free(Parser parser) {
-	// Free the parser name and the parser itself.
-	free(parser->name);
-	parser->at_eof = true;
-	parser->name = NULL;
-	parser->stream = NULL;
-	free(parser);
+spsps_release(Parser parser) {
+	// The parser is freed if the pool is full.  A window that grew large is
+	// not worth keeping.
+	if (spsps_pooled_ == SPSPS_POOL_SIZE) {
+		spsps_free(parser);
+		return;
+	}
+	spsps_clear_(parser);
+	if (parser->capacity > SPSPS_POOL_WINDOW) spsps_drop_window_(parser);
+	spsps_pool_[spsps_pooled_++] = parser;
+}
+
+void
+spsps_pool_drain(void) {
+	// Every pooled parser is freed.
+	while (spsps_pooled_ > 0) spsps_free(spsps_pool_[--spsps_pooled_]);
 }
 
 SPSPS_CHAR
@@ -205,113 +2285,341 @@ spsps_consume(Parser parser) {
 	// Nothing is allocated or deallocated by this method.
 	SPSPS_CHAR ch = spsps_look_(parser, 0);
 	spsps_consume_n(parser, 1);
-	parser->errno = OK;
+	parser->status = OK;
 	return ch;
 }
 
 void
 spsps_consume_n(Parser parser, size_t n) {
-	// Nothing is allocated or deallocated by this method.
-	if (n >= SPSPS_LOOK) {
-		// Lookahead too large.
-		parser->errno = LOOKAHEAD_TOO_LARGE;
-		return;
-	}
-
-	if(!parser->initialized){
-		spsps_initialize_parser_(parser);
-	}
-
-	parser->errno = OK;
+	// The window may be allocated or grown by this method.
+	parser->status = OK;
 	parser->look_count = 0;
 	if (parser->at_eof) {
 		parser->eof_count++;
 		if (parser->eof_count > 1000) {
 			// Stalled at EOF.
-			parser->errno = STALLED_AT_EOF;
+			parser->status = STALLED_AT_EOF;
+			SPSPS_COUNT_(parser, stalls, 1);
 			return;
 		}
 	}
-	for (size_t count = 0; count < n; ++count) {
-		if (parser->blocks[parser->block][parser->next] == SPSPS_EOF) {
+	SPSPS_COUNT_(parser, consumes, 1);
+	// Skip what is buffered and read on, a block at a time, so that a long
+	// skip is not limited by the lookahead.
+	while (parser->next + n > parser->limit) {
+		n -= parser->limit - parser->next;
+		SPSPS_COUNT_(parser, consumed, parser->limit - parser->next);
+		parser->next = parser->limit;
+		if (! spsps_fill_(parser, 1)) {
+			// Fewer than n characters remained, so we consume the end of
+			// file.
 			parser->at_eof = true;
 			return;
 		}
-		parser->column++;
-		if (parser->blocks[parser->block][parser->next] == '\n') {
-			parser->line++;
-			parser->column = 1;
-		}
-		parser->next++;
-		if (parser->next >= SPSPS_LOOK) {
-			parser->next -= SPSPS_LOOK;
-			parser->block ^= 1;
-			spsps_read_other_(parser);
-		}
-	} // Loop to consume characters.
+	} // Read until n characters are buffered.
+	parser->next += n;
+	SPSPS_COUNT_(parser, consumed, n);
+}
+
+bool
+spsps_idle(Parser parser) {
+	// The window is deallocated by this method if nothing in it is needed.
+	if (parser->window == NULL) return true;
+	if (parser->npins > 0 || parser->next < parser->limit ||
+			parser->buf != parser->window || (parser->utf8 &&
+			parser->utf8_checked < parser->base + parser->limit)) {
+		return false;
+	}
+	// Everything buffered has been consumed, so only the location needs to
+	// be kept.
+	spsps_sync_loc_(parser);
+	parser->base += parser->next;
+	parser->next = 0;
+	parser->limit = 0;
+	spsps_drop_window_(parser);
+	return true;
 }
 
 void
 spsps_consume_whitespace(Parser parser) {
 	// Nothing is allocated or deallocated by this method.
-	while (strchr(" \t\r\n", spsps_peek(parser)) != NULL)
-		spsps_consume(parser);
-	parser->errno = OK;
+	spsps_scan_(parser, &spsps_whitespace_, true, NULL, SIZE_MAX);
+}
+
+size_t
+spsps_consume_while(Parser parser, const char * set) {
+	// Nothing is allocated or deallocated by this method.
+	struct spsps_class_ cls;
+	spsps_class_init_(&cls, set);
+	return spsps_scan_(parser, &cls, true, NULL, SIZE_MAX);
+}
+
+size_t
+spsps_consume_until(Parser parser, const char * set) {
+	// Nothing is allocated or deallocated by this method.
+	struct spsps_class_ cls;
+	spsps_class_init_(&cls, set);
+	return spsps_scan_(parser, &cls, false, NULL, SIZE_MAX);
+}
+
+size_t
+spsps_take_while(Parser parser, const char * set, SPSPS_CHAR * buf,
+		size_t max) {
+	// Nothing is allocated or deallocated by this method.
+	struct spsps_class_ cls;
+	spsps_class_init_(&cls, set);
+	return spsps_scan_(parser, &cls, true, buf, max);
+}
+
+bool
+spsps_peek_class(Parser parser, CharClass cls) {
+	// Nothing is allocated or deallocated by this method.
+	parser->status = OK;
+	SPSPS_COUNT_(parser, peeks, 1);
+	if (parser->next >= parser->limit && ! spsps_fill_(parser, 1)) {
+		return false;
+	}
+	return spsps_class_has_(cls, parser->buf[parser->next]);
+}
+
+size_t
+spsps_consume_class(Parser parser, CharClass cls) {
+	// Nothing is allocated or deallocated by this method.
+	return spsps_scan_(parser, cls, true, NULL, SIZE_MAX);
+}
+
+size_t
+spsps_take_class(Parser parser, CharClass cls, SPSPS_CHAR * buf,
+		size_t max) {
+	// Nothing is allocated or deallocated by this method.
+	return spsps_scan_(parser, cls, true, buf, max);
 }
 
 bool
 spsps_eof(Parser parser) {
 	// Nothing is allocated or deallocated by this method.
-	parser->errno = OK;
+	parser->status = OK;
 	return parser->at_eof;
 }
 
+spsps_errno
+spsps_get_errno(Parser parser) {
+	// Nothing is allocated or deallocated by this method.
+	return parser->status;
+}
+
+bool
+spsps_stats(Parser parser, spsps_parser_stats * stats) {
+	// Nothing is allocated or deallocated by this method.
+#ifdef SPSPS_STATS
+	*stats = parser->stats;
+	return true;
+#else
+	memset(stats, 0, sizeof(*stats));
+	return false;
+#endif
+}
+
+bool
+spsps_stats_total(spsps_parser_stats * stats) {
+	// Nothing is allocated or deallocated by this method.
+	memset(stats, 0, sizeof(*stats));
+#ifdef SPSPS_STATS
+	for (spsps_shard_ * shard = atomic_load_explicit(&spsps_shards_,
+			memory_order_acquire); shard != NULL; shard = shard->next) {
+#define SPSPS_TOTAL_FIELD_(m_name) \
+		stats->m_name += atomic_load_explicit(&shard->m_name, \
+				memory_order_relaxed);
+		SPSPS_STATS_FIELDS_(SPSPS_TOTAL_FIELD_)
+#undef SPSPS_TOTAL_FIELD_
+	} // Add up the shards.
+	return true;
+#else
+	return false;
+#endif
+}
+
 Loc *
 spsps_loc(Parser parser) {
 	// A loc instance is allocated by this method.
-	parser->errno = OK;
 	Loc * loc = (Loc *) malloc(sizeof(struct spsps_loc_));
-	loc->name = parser->name;
-	loc->line = parser->line;
-	loc->column = parser->column;
+	*loc = spsps_location(parser);
+	return loc;
+}
+
+Loc
+spsps_location(Parser parser) {
+	// Nothing is allocated or deallocated by this method.
+	parser->status = OK;
+	spsps_sync_loc_(parser);
+	Loc loc;
+	loc.name = parser->name;
+	loc.line = parser->loc_line;
+	loc.column = parser->loc_column;
+	loc.offset = parser->loc_offset;
 	return loc;
 }
 
+uint64_t
+spsps_offset(Parser parser) {
+	// Nothing is allocated or deallocated by this method.
+	parser->status = OK;
+	return parser->base + parser->next;
+}
+
+Mark
+spsps_mark(Parser parser) {
+	// The pins may be allocated or grown by this method.
+	parser->status = OK;
+	Mark mark;
+	mark.offset = parser->base + parser->next;
+	spsps_pin_(parser, mark.offset);
+	return mark;
+}
+
+const SPSPS_CHAR *
+spsps_slice(Parser parser, Mark mark, size_t * length) {
+	// Nothing is allocated or deallocated by this method.
+	parser->status = OK;
+	uint64_t here = parser->base + parser->next;
+	if (mark.offset < parser->base || mark.offset > here) {
+		// Not a live mark.
+		if (length != NULL) *length = 0;
+		return NULL;
+	}
+	if (length != NULL) *length = (size_t) (here - mark.offset);
+	return parser->buf + (mark.offset - parser->base);
+}
+
+void
+spsps_unmark(Parser parser, Mark mark) {
+	// Nothing is allocated or deallocated by this method.
+	parser->status = OK;
+	spsps_unpin_(parser, mark.offset);
+}
+
+Checkpoint
+spsps_checkpoint(Parser parser) {
+	// The pins may be allocated or grown by this method.
+	parser->status = OK;
+	// Bring the location up to date, so that the checkpoint does not depend
+	// on characters before it that may be discarded.
+	spsps_sync_loc_(parser);
+	Checkpoint checkpoint;
+	checkpoint.offset = parser->base + parser->next;
+	checkpoint.line = parser->loc_line;
+	checkpoint.column = parser->loc_column;
+	checkpoint.eof_count = parser->eof_count;
+	checkpoint.at_eof = parser->at_eof;
+	spsps_pin_(parser, checkpoint.offset);
+	SPSPS_COUNT_(parser, checkpoints, 1);
+	return checkpoint;
+}
+
+void
+spsps_restore(Parser parser, Checkpoint checkpoint) {
+	// Nothing is allocated or deallocated by this method.
+	parser->status = OK;
+	parser->look_count = 0;
+	// The pin kept everything from the checkpoint on, so this is just a
+	// matter of moving back.
+	parser->next = (size_t) (checkpoint.offset - parser->base);
+	parser->eof_count = checkpoint.eof_count;
+	parser->at_eof = checkpoint.at_eof;
+	if (parser->loc_offset > checkpoint.offset) {
+		parser->loc_offset = checkpoint.offset;
+		parser->loc_line = checkpoint.line;
+		parser->loc_column = checkpoint.column;
+	}
+	spsps_unpin_(parser, checkpoint.offset);
+}
+
+void
+spsps_commit(Parser parser, Checkpoint checkpoint) {
+	// Nothing is allocated or deallocated by this method.
+	parser->status = OK;
+	spsps_unpin_(parser, checkpoint.offset);
+}
+
 SPSPS_CHAR
 spsps_peek(Parser parser) {
 	// Nothing is allocated or deallocated by this method.
-	parser->errno = OK;
+	parser->status = OK;
+	SPSPS_COUNT_(parser, peeks, 1);
 	return spsps_look_(parser, 0);
 }
 
 char *
 spsps_peek_n(Parser parser, size_t n) {
 	// Allocates and returns a fixed-length string.
-	if (n >= SPSPS_LOOK) {
-		// Lookahead too large.
-		parser->errno = LOOKAHEAD_TOO_LARGE;
-		return "";
-	}
-	parser->errno = OK;
+	parser->status = OK;
+	SPSPS_COUNT_(parser, peeks, 1);
 	SPSPS_CHAR * buf = (SPSPS_CHAR *) malloc(sizeof(SPSPS_CHAR) * n);
-	for (size_t index = 0; index < n; ++index) {
-		buf[index] = spsps_look_(parser, index);
-	} // Read characters into buffer.
+	// Get all the characters at once, rather than looking at each in turn,
+	// so that long lookahead does not look like a stall.
+	size_t avail = n;
+	if (n > parser->max_lookahead) {
+		parser->status = LOOKAHEAD_TOO_LARGE;
+		avail = 0;
+	} else if (parser->next + n > parser->limit && ! spsps_fill_(parser, n)) {
+		avail = parser->limit - parser->next;
+	}
+	if (avail > 0) {
+		memcpy(buf, parser->buf + parser->next, avail * sizeof(SPSPS_CHAR));
+	}
+	for (size_t index = avail; index < n; ++index) {
+		buf[index] = SPSPS_EOF;
+	} // Pad with the end of file.
 	return buf;
 }
 
+const SPSPS_CHAR *
+spsps_window(Parser parser, size_t need, size_t * available) {
+	// Nothing is allocated or deallocated by this method.
+	parser->status = OK;
+	SPSPS_COUNT_(parser, peeks, 1);
+	if (parser->next + need > parser->limit) {
+		spsps_fill_(parser, need);
+	}
+	*available = parser->limit - parser->next;
+	return parser->buf == NULL ? NULL : parser->buf + parser->next;
+}
+
+const SPSPS_CHAR *
+spsps_peek_view(Parser parser, size_t n) {
+	// Nothing is allocated or deallocated by this method.
+	parser->status = OK;
+	SPSPS_COUNT_(parser, peeks, 1);
+	if (parser->next + n > parser->limit && ! spsps_fill_(parser, n)) {
+		return NULL;
+	}
+	return parser->buf == NULL ? NULL : parser->buf + parser->next;
+}
+
 bool
 spsps_peek_str(Parser parser, char * next) {
 	// Nothing is allocated or deallocated by this method.
 	size_t n = strlen(next);
-	if (n >= SPSPS_LOOK) {
-		// Lookahead too large.
-		parser->errno = LOOKAHEAD_TOO_LARGE;
+	parser->status = OK;
+	SPSPS_COUNT_(parser, peeks, 1);
+	// The empty string is always next, even where there is no buffer.
+	if (n == 0) return true;
+	// If we look too long without progressing, the parser may be stalled.
+	if (++parser->look_count > SPSPS_STALL_LOOKS) {
+		parser->status = STALLED;
+		SPSPS_COUNT_(parser, stalls, 1);
+		return false;
+	}
+	// The characters are contiguous in buf, so compare them all at once.
+	// The end of input is where the characters run out, so a character
+	// that happens to equal SPSPS_EOF is not mistaken for it.
+	if (parser->next + n > parser->limit && ! spsps_fill_(parser, n)) {
 		return false;
 	}
-	parser->errno = OK;
+	const SPSPS_CHAR * here = parser->buf + parser->next;
+	if (sizeof(SPSPS_CHAR) == 1) return memcmp(here, next, n) == 0;
 	for (size_t index = 0; index < n; ++index) {
-		if (next[index] != spsps_look_(parser, index)) return false;
+		if (next[index] != here[index]) return false;
 	} // Check all characters.
 	return true;
 }
@@ -319,7 +2627,7 @@ spsps_peek_str(Parser parser, char * next) {
 bool
 spsps_peek_and_consume(Parser parser, char * next) {
 	// Nothing is allocated or deallocated by this method.
-	parser->errno = OK;
+	parser->status = OK;
 	if (spsps_peek_str(parser, next)) {
 		spsps_consume_n(parser, strlen(next));
 		return true;
@@ -327,3 +2635,728 @@ spsps_peek_and_consume(Parser parser, char * next) {
 		return false;
 	}
 }
+
+bool
+spsps_set_utf8(Parser parser, bool utf8) {
+	// Nothing is allocated or deallocated by this method.
+	if (sizeof(SPSPS_CHAR) != 1) return false;
+	// Bring the location up to date first, so that only columns from here
+	// on count code points.
+	spsps_sync_loc_(parser);
+	parser->utf8 = utf8;
+	if (utf8) {
+		parser->utf8_checked = parser->base + parser->next;
+		spsps_utf8_check_(parser);
+	}
+	return true;
+}
+
+uint64_t
+spsps_utf8_error(Parser parser) {
+	// Nothing is allocated or deallocated by this method.
+	return parser->utf8_bad;
+}
+
+/**
+ * Decode the next code point.
+ * @param parser		The parser.
+ * @param length		Set to the number of characters it occupies, which is
+ * 						zero at the end of file.
+ * @return				The code point, U+FFFD if the input is not valid, or
+ * 						SPSPS_EOF_CP at the end of file.
+ */
+static int32_t
+spsps_decode_cp_(Parser parser, size_t * length) {
+	parser->status = OK;
+	// Most text is ASCII, and that needs no decoding.
+	if (parser->next < parser->limit) {
+		unsigned char lead = (unsigned char) parser->buf[parser->next];
+		if (lead < 0x80) {
+			*length = 1;
+			return lead;
+		}
+	}
+	spsps_fill_(parser, 4);
+	if (parser->next >= parser->limit) {
+		*length = 0;
+		return SPSPS_EOF_CP;
+	}
+	int32_t cp;
+	int count = spsps_utf8_decode_(
+			(const unsigned char *) parser->buf + parser->next,
+			parser->limit - parser->next, &cp);
+	if (count <= 0) {
+		parser->status = INVALID_UTF8;
+		count = 1;
+	}
+	*length = (size_t) count;
+	return cp;
+}
+
+int32_t
+spsps_peek_cp(Parser parser) {
+	// The window may be allocated or grown by this method.
+	size_t length;
+	SPSPS_COUNT_(parser, peeks, 1);
+	return spsps_decode_cp_(parser, &length);
+}
+
+int32_t
+spsps_consume_cp(Parser parser) {
+	// The window may be allocated or grown by this method.
+	size_t length;
+	int32_t cp = spsps_decode_cp_(parser, &length);
+	spsps_errno error = parser->status;
+	spsps_consume_n(parser, length > 0 ? length : 1);
+	if (parser->status == OK) parser->status = error;
+	return cp;
+}
+
+//======================================================================
+// Numbers.
+//======================================================================
+
+// Eight digits can be checked and converted at once on a little-endian
+// machine when characters are bytes.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#  define SPSPS_SWAR_DIGITS_
+#endif
+
+/// The largest value that can take eight more digits without overflow.
+#define SPSPS_SWAR_LIMIT_ UINT64_C(184467440736)
+
+/// UINT64_MAX / 10, the largest value that can take one more digit.
+#define SPSPS_DIGIT_LIMIT_ UINT64_C(1844674407370955161)
+
+/// The kinds of number the scanner knows.
+typedef enum spsps_number_kind_ {
+	SPSPS_UINT64_, SPSPS_INT64_, SPSPS_HEX_, SPSPS_DOUBLE_
+} spsps_number_kind_;
+
+static inline bool
+spsps_is_digit_(SPSPS_CHAR ch) {
+	return ch >= '0' && ch <= '9';
+}
+
+#ifdef SPSPS_SWAR_DIGITS_
+/**
+ * Check whether eight characters, loaded as one word, are all digits.
+ */
+static inline bool
+spsps_eight_digits_(uint64_t word) {
+	return ((word & UINT64_C(0xF0F0F0F0F0F0F0F0)) |
+			(((word + UINT64_C(0x0606060606060606)) &
+			UINT64_C(0xF0F0F0F0F0F0F0F0)) >> 4)) ==
+			UINT64_C(0x3333333333333333);
+}
+
+/**
+ * Convert eight digits, loaded as one word, to their value.  Pairs, then
+ * quads, then the whole word are combined with three multiplies.
+ */
+static inline uint32_t
+spsps_convert_eight_(uint64_t word) {
+	word -= UINT64_C(0x3030303030303030);
+	word = (word * 10) + (word >> 8);
+	word = (((word & UINT64_C(0x000000FF000000FF)) *
+			UINT64_C(0x000F424000000064)) +
+			(((word >> 16) & UINT64_C(0x000000FF000000FF)) *
+			UINT64_C(0x0000271000000001))) >> 32;
+	return (uint32_t) word;
+}
+#endif
+
+/**
+ * Accumulate a run of decimal digits into a value.  Digits that would
+ * overflow are not accumulated, but are counted, along with every digit
+ * after them.
+ * @param text			The characters.
+ * @param length		The number of characters.
+ * @param value			The value to accumulate into.
+ * @param dropped		Incremented for each digit not accumulated.
+ * @return				The number of digits in the run.
+ */
+static size_t
+spsps_digits_(const SPSPS_CHAR * text, size_t length, uint64_t * value,
+		size_t * dropped) {
+	size_t index = 0;
+	uint64_t accumulated = *value;
+#ifdef SPSPS_SWAR_DIGITS_
+	if (sizeof(SPSPS_CHAR) == 1) {
+		while (index + 8 <= length && accumulated <= SPSPS_SWAR_LIMIT_ &&
+				*dropped == 0) {
+			uint64_t word;
+			memcpy(&word, text + index, 8);
+			if (! spsps_eight_digits_(word)) break;
+			accumulated = accumulated * 100000000 +
+					spsps_convert_eight_(word);
+			index += 8;
+		} // Take eight digits at a time.
+	}
+#endif
+	for (; index < length && spsps_is_digit_(text[index]); ++index) {
+		unsigned digit = (unsigned) (text[index] - '0');
+		if (*dropped == 0 && (accumulated < SPSPS_DIGIT_LIMIT_ ||
+				(accumulated == SPSPS_DIGIT_LIMIT_ && digit <= 5))) {
+			accumulated = accumulated * 10 + digit;
+		} else {
+			++*dropped;
+		}
+	} // Take the rest one at a time.
+	*value = accumulated;
+	return index;
+}
+
+#ifdef SPSPS_HAVE_USELOCALE
+/// The "C" locale that numbers are converted in, made on first use.
+static _Atomic(locale_t) spsps_c_locale_ = (locale_t) 0;
+#endif
+
+/**
+ * Convert a number with strtod in the "C" locale, so that the decimal point
+ * is a dot whatever LC_NUMERIC says.
+ * @param str			The number.
+ * @return				The value.  The errno is set as strtod sets it.
+ */
+static double
+spsps_strtod_(const char * str) {
+#ifdef SPSPS_HAVE_USELOCALE
+	locale_t c_locale = atomic_load_explicit(&spsps_c_locale_,
+			memory_order_acquire);
+	if (c_locale == (locale_t) 0) {
+		// Whichever thread gets here first makes the locale, and it is
+		// kept for the life of the process.
+		locale_t made = newlocale(LC_NUMERIC_MASK, "C", (locale_t) 0);
+		locale_t expected = (locale_t) 0;
+		if (made != (locale_t) 0 && ! atomic_compare_exchange_strong(
+				&spsps_c_locale_, &expected, made)) {
+			freelocale(made);
+			made = expected;
+		}
+		c_locale = made;
+	}
+	if (c_locale != (locale_t) 0) {
+		locale_t old = uselocale(c_locale);
+		double result = strtod(str, NULL);
+		int error = errno;
+		uselocale(old);
+		errno = error;
+		return result;
+	}
+#endif
+	return strtod(str, NULL);
+}
+
+/// Powers of ten that are exact as doubles.
+static const double spsps_exact_tens_[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+	1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/**
+ * Scan a decimal floating point number: an optional minus sign, digits, an
+ * optional fraction, and an optional exponent.  A dot or an exponent marker
+ * not followed by digits is not part of the number.
+ * @param text			The characters.
+ * @param length		The number of characters.
+ * @param value			Set to the value.
+ * @param range			Set if the value overflowed or underflowed.
+ * @param end			Set if the scan ran into the end of the characters,
+ *						so that more of them might have changed the result.
+ * @return				The number of characters in the number, or zero if
+ *						there is none.
+ */
+static size_t
+spsps_scan_double_(const SPSPS_CHAR * text, size_t length, double * value,
+		bool * range, bool * end) {
+#define SPSPS_AT_(m_index) \
+	((m_index) < length ? text[m_index] : (*end = true, (SPSPS_CHAR) 0))
+	size_t index = 0;
+	bool negative = SPSPS_AT_(0) == '-';
+	if (negative) ++index;
+	if (! spsps_is_digit_(SPSPS_AT_(index))) return 0;
+	uint64_t mantissa = 0;
+	size_t dropped = 0;
+	index += spsps_digits_(text + index, length - index, &mantissa,
+			&dropped);
+	int64_t exponent = (int64_t) dropped;
+	if (SPSPS_AT_(index) == '.' && spsps_is_digit_(SPSPS_AT_(index + 1))) {
+		size_t before = dropped;
+		size_t count = spsps_digits_(text + index + 1, length - index - 1,
+				&mantissa, &dropped);
+		exponent -= (int64_t) (count - (dropped - before));
+		index += 1 + count;
+	}
+	SPSPS_CHAR ch = SPSPS_AT_(index);
+	if (ch == 'e' || ch == 'E') {
+		size_t at = index + 1;
+		bool negexp = SPSPS_AT_(at) == '-';
+		if (negexp || SPSPS_AT_(at) == '+') ++at;
+		if (spsps_is_digit_(SPSPS_AT_(at))) {
+			int64_t power = 0;
+			for (; spsps_is_digit_(SPSPS_AT_(at)); ++at) {
+				// Past this the result is zero or infinite anyway.
+				if (power < 100000) power = power * 10 + (text[at] - '0');
+			} // Accumulate the exponent.
+			exponent += negexp ? -power : power;
+			index = at;
+		}
+	}
+	if (index == length) *end = true;
+#undef SPSPS_AT_
+
+	// When the digits are exact and the power of ten is exact, one
+	// correctly rounded multiply or divide gives the correctly rounded
+	// result (Clinger's fast path).  This covers most numbers in practice.
+	double result;
+#if FLT_EVAL_METHOD == 0
+	if (dropped == 0 && mantissa == 0) {
+		*value = negative ? -0.0 : 0.0;
+		return index;
+	}
+	if (dropped == 0 && mantissa <= (UINT64_C(1) << 53)) {
+		if (exponent > 22 && exponent <= 22 + 15) {
+			// Move some of the power into the mantissa if it stays exact.
+			uint64_t scale = 1;
+			for (int64_t count = 22; count < exponent; ++count) scale *= 10;
+			if (mantissa <= (UINT64_C(1) << 53) / scale) {
+				mantissa *= scale;
+				exponent = 22;
+			}
+		}
+		if (exponent >= 0 && exponent <= 22) {
+			result = (double) mantissa * spsps_exact_tens_[exponent];
+			*value = negative ? -result : result;
+			return index;
+		}
+		if (exponent < 0 && exponent >= -22) {
+			result = (double) mantissa / spsps_exact_tens_[-exponent];
+			*value = negative ? -result : result;
+			return index;
+		}
+	}
+#endif
+	// Otherwise fall back on strtod, which is exact.
+	char small[64];
+	char * copy = index < sizeof(small) ? small : (char *) malloc(index + 1);
+	if (copy == NULL) {
+		// Without memory the number cannot be converted exactly, so there
+		// is no number rather than a wrong one.
+		return 0;
+	}
+	for (size_t at = 0; at < index; ++at) copy[at] = (char) text[at];
+	copy[index] = 0;
+	int saved = errno;
+	errno = 0;
+	result = spsps_strtod_(copy);
+	*range = errno == ERANGE;
+	errno = saved;
+	if (copy != small) free(copy);
+	*value = result;
+	return index;
+}
+
+/**
+ * Scan a number of the given kind.
+ * @param kind			The kind of number.
+ * @param text			The characters.
+ * @param length		The number of characters.
+ * @param value			Where to put the value; its type depends on the kind.
+ * @param range			Set if the value did not fit.
+ * @param end			Set if the scan ran into the end of the characters.
+ * @return				The number of characters in the number, or zero if
+ *						there is none.
+ */
+static size_t
+spsps_scan_number_(spsps_number_kind_ kind, const SPSPS_CHAR * text,
+		size_t length, void * value, bool * range, bool * end) {
+	*range = false;
+	*end = false;
+	if (kind == SPSPS_DOUBLE_) {
+		return spsps_scan_double_(text, length, (double *) value, range, end);
+	}
+	size_t index = 0;
+	uint64_t accumulated = 0;
+	size_t dropped = 0;
+	if (kind == SPSPS_HEX_) {
+		for (; index < length; ++index) {
+			SPSPS_CHAR ch = text[index];
+			unsigned digit;
+			if (ch >= '0' && ch <= '9') digit = (unsigned) (ch - '0');
+			else if (ch >= 'a' && ch <= 'f') digit = (unsigned) (ch - 'a' + 10);
+			else if (ch >= 'A' && ch <= 'F') digit = (unsigned) (ch - 'A' + 10);
+			else break;
+			if (accumulated >> 60 != 0) ++dropped;
+			else accumulated = accumulated << 4 | digit;
+		} // Accumulate the hexadecimal digits.
+		if (index == length) *end = true;
+		if (index == 0) return 0;
+		if (dropped > 0) {
+			*range = true;
+			accumulated = UINT64_MAX;
+		}
+		*(uint64_t *) value = accumulated;
+		return index;
+	}
+	bool negative = false;
+	if (kind == SPSPS_INT64_ && index < length && text[index] == '-') {
+		negative = true;
+		++index;
+	}
+	if (index == length) *end = true;
+	if (index == length || ! spsps_is_digit_(text[index])) return 0;
+	index += spsps_digits_(text + index, length - index, &accumulated,
+			&dropped);
+	if (index == length) *end = true;
+	if (kind == SPSPS_UINT64_) {
+		if (dropped > 0) {
+			*range = true;
+			accumulated = UINT64_MAX;
+		}
+		*(uint64_t *) value = accumulated;
+	} else if (negative) {
+		if (dropped > 0 || accumulated > (uint64_t) INT64_MAX + 1) {
+			*range = true;
+			*(int64_t *) value = INT64_MIN;
+		} else {
+			*(int64_t *) value = accumulated == (uint64_t) INT64_MAX + 1 ?
+					INT64_MIN : -(int64_t) accumulated;
+		}
+	} else {
+		if (dropped > 0 || accumulated > (uint64_t) INT64_MAX) {
+			*range = true;
+			accumulated = INT64_MAX;
+		}
+		*(int64_t *) value = (int64_t) accumulated;
+	}
+	return index;
+}
+
+/**
+ * Parse a number of the given kind from the parser.  The number is scanned
+ * where it lies in the buffer.  Only if it runs into the end of what is
+ * buffered is more read, and the number scanned again.
+ * @param parser		The parser.
+ * @param kind			The kind of number.
+ * @param value			Where to put the value.
+ * @return				True if there was a number.
+ */
+static bool
+spsps_parse_number_(Parser parser, spsps_number_kind_ kind, void * value) {
+	size_t available;
+	const SPSPS_CHAR * text = spsps_window(parser, 1, &available);
+	bool range, end;
+	size_t used = spsps_scan_number_(kind, text, available, value, &range,
+			&end);
+	while (end) {
+		// A number longer than the lookahead limit cannot be seen whole, so
+		// it is not taken at all.
+		if (available >= parser->max_lookahead && ! (parser->drained &&
+				parser->limit - parser->next == available)) {
+			parser->status = LOOKAHEAD_TOO_LARGE;
+			return false;
+		}
+		size_t more;
+		size_t want = available + parser->block;
+		if (want > parser->max_lookahead) want = parser->max_lookahead;
+		text = spsps_window(parser, want, &more);
+		if (more <= available) break;
+		available = more;
+		used = spsps_scan_number_(kind, text, available, value, &range,
+				&end);
+	} // Read on until the number ends.
+	parser->status = OK;
+	if (used == 0) return false;
+	spsps_consume_n(parser, used);
+	if (range) parser->status = NUMBER_OUT_OF_RANGE;
+	return true;
+}
+
+bool
+spsps_parse_uint64(Parser parser, uint64_t * value) {
+	// Nothing is allocated or deallocated by this method.
+	return spsps_parse_number_(parser, SPSPS_UINT64_, value);
+}
+
+bool
+spsps_parse_int64(Parser parser, int64_t * value) {
+	// Nothing is allocated or deallocated by this method.
+	return spsps_parse_number_(parser, SPSPS_INT64_, value);
+}
+
+bool
+spsps_parse_hex(Parser parser, uint64_t * value) {
+	// Nothing is allocated or deallocated by this method.
+	return spsps_parse_number_(parser, SPSPS_HEX_, value);
+}
+
+bool
+spsps_parse_double(Parser parser, double * value) {
+	// Only a number too long for the fast path allocates, and frees, a copy.
+	return spsps_parse_number_(parser, SPSPS_DOUBLE_, value);
+}
+
+size_t
+spsps_scan_double(const SPSPS_CHAR * text, size_t length, double * value) {
+	// Only a number too long for the fast path allocates, and frees, a copy.
+	bool range, end;
+	return spsps_scan_double_(text, length, value, &range, &end);
+}
+
+//======================================================================
+// Skipping whitespace and comments.
+//======================================================================
+
+/**
+ * A comment that a skip set knows how to skip.
+ */
+typedef struct spsps_comment_ {
+	/// The characters that start the comment.
+	char * open;
+	/// The number of characters in open.
+	size_t open_length;
+	/// The characters that end a block comment, or NULL for a line comment.
+	char * close;
+	/// The number of characters in close.
+	size_t close_length;
+	/// The class holding the first character of close, or a newline for a
+	/// line comment.  The body of the comment is scanned up to one of these.
+	struct spsps_class_ stop;
+} spsps_comment_;
+
+/**
+ * A compiled skip set.
+ */
+struct spsps_skip_ {
+	/// The whitespace.
+	struct spsps_class_ space;
+	/// The first characters of every comment, so that a character that
+	/// cannot start one is rejected at once.
+	struct spsps_class_ starts;
+	/// The comments, longest opening delimiter first.
+	spsps_comment_ * comments;
+	/// The number of comments.
+	size_t ncomments;
+};
+
+/**
+ * Add a comment to a skip set under construction, keeping the comments
+ * ordered longest opening delimiter first.
+ * @param skip			The skip set, with room for another comment.
+ * @param open			The opening delimiter.
+ * @param close			The closing delimiter, or NULL for a line comment.
+ */
+static void
+spsps_skip_add_(SkipSet skip, const char * open, const char * close) {
+	// An empty delimiter would match everywhere, so it is ignored.
+	if (open[0] == 0 || (close != NULL && close[0] == 0)) return;
+	size_t length = strlen(open);
+	size_t at = skip->ncomments++;
+	while (at > 0 && skip->comments[at - 1].open_length < length) {
+		skip->comments[at] = skip->comments[at - 1];
+		--at;
+	} // Find the place for the comment.
+	spsps_comment_ * comment = &skip->comments[at];
+	comment->open = strdup(open);
+	comment->open_length = length;
+	comment->close = (close != NULL) ? strdup(close) : NULL;
+	comment->close_length = (close != NULL) ? strlen(close) : 0;
+	char stop[2] = { (close != NULL) ? close[0] : '\n', 0 };
+	spsps_class_init_(&comment->stop, stop);
+	unsigned char code = (unsigned char) open[0];
+	skip->starts.bits[code >> 3] |= (uint8_t) (1 << (code & 7));
+}
+
+SkipSet
+spsps_skip_compile(CharClass space, char ** line, char ** block) {
+	SkipSet skip = (SkipSet) calloc(1, sizeof(struct spsps_skip_));
+	// Copy the whitespace, including any ranges above the bitmap.
+	if (space == NULL) space = &spsps_whitespace_;
+	skip->space = *space;
+	skip->space.builtin = false;
+	if (space->nwide > 0) {
+		skip->space.wide = (uint32_t (*)[2]) malloc(space->nwide *
+				sizeof(uint32_t[2]));
+		memcpy(skip->space.wide, space->wide,
+				space->nwide * sizeof(uint32_t[2]));
+	}
+	// Collect the comments.
+	size_t total = 0;
+	for (size_t index = 0; line != NULL && line[index] != NULL; ++index) {
+		++total;
+	} // Count the line comments.
+	for (size_t index = 0; block != NULL && block[index] != NULL &&
+			block[index + 1] != NULL; index += 2) {
+		++total;
+	} // Count the block comments.
+	skip->comments = (spsps_comment_ *) calloc(total > 0 ? total : 1,
+			sizeof(spsps_comment_));
+	spsps_class_init_(&skip->starts, NULL);
+	for (size_t index = 0; line != NULL && line[index] != NULL; ++index) {
+		spsps_skip_add_(skip, line[index], NULL);
+	} // Add the line comments.
+	for (size_t index = 0; block != NULL && block[index] != NULL &&
+			block[index + 1] != NULL; index += 2) {
+		spsps_skip_add_(skip, block[index], block[index + 1]);
+	} // Add the block comments.
+	return skip;
+}
+
+void
+spsps_skip_free(SkipSet skip) {
+	if (skip == NULL) return;
+	for (size_t index = 0; index < skip->ncomments; ++index) {
+		free(skip->comments[index].open);
+		free(skip->comments[index].close);
+	} // Free the delimiters.
+	free(skip->comments);
+	free(skip->space.wide);
+	free(skip);
+}
+
+size_t
+spsps_skip(Parser parser, SkipSet skip) {
+	// The window may be allocated or grown by this method.
+	uint64_t start = parser->base + parser->next;
+	spsps_errno status = OK;
+	while (true) {
+		spsps_scan_(parser, &skip->space, true, NULL, SIZE_MAX);
+		// Stop unless a comment could start here.
+		if (parser->next >= parser->limit && ! spsps_fill_(parser, 1)) break;
+		if (! spsps_class_has_(&skip->starts, parser->buf[parser->next])) {
+			break;
+		}
+		const spsps_comment_ * comment = NULL;
+		for (size_t index = 0; index < skip->ncomments; ++index) {
+			if (spsps_peek_str(parser, skip->comments[index].open)) {
+				comment = &skip->comments[index];
+				break;
+			}
+		} // Find the comment that starts here.
+		if (comment == NULL) break;
+		spsps_consume_n(parser, comment->open_length);
+		if (comment->close == NULL) {
+			// The newline is left for the whitespace, if it is whitespace.
+			spsps_scan_(parser, &comment->stop, false, NULL, SIZE_MAX);
+			continue;
+		}
+		while (true) {
+			spsps_scan_(parser, &comment->stop, false, NULL, SIZE_MAX);
+			if (spsps_peek_str(parser, comment->close)) {
+				spsps_consume_n(parser, comment->close_length);
+				break;
+			}
+			if (parser->next >= parser->limit && ! spsps_fill_(parser, 1)) {
+				status = UNTERMINATED_COMMENT;
+				break;
+			}
+			// Only the first character of the delimiter was there.
+			spsps_consume_n(parser, 1);
+		} // Find the end of the block comment.
+		if (status != OK) break;
+	} // Skip whitespace and comments.
+	parser->status = status;
+	return (size_t) (parser->base + parser->next - start);
+}
+
+//======================================================================
+// Keyword matching.
+//======================================================================
+
+/**
+ * A compiled keyword matcher.  This is a trie whose transitions are kept in
+ * one table, indexed by node and by character class.  Only the characters that
+ * occur in some keyword get a class, so the table stays small.
+ */
+struct spsps_keywords_ {
+	/// The class of each character, or zero if it is in no keyword.
+	uint8_t classes[256];
+	/// The number of classes, including zero.
+	size_t nclasses;
+	/// The transitions.  The entry for node n and class c is at
+	/// n * nclasses + c, and is the next node, or zero for none.  The root
+	/// is node zero, which is never the target of a transition.
+	uint32_t * next;
+	/// For each node, the index of the keyword ending there, or -1.
+	int * accept;
+	/// The number of nodes.
+	size_t nodes;
+	/// The length of the longest keyword.
+	size_t longest;
+};
+
+Keywords
+spsps_keywords_compile(char ** list) {
+	Keywords keywords = (Keywords) calloc(1, sizeof(struct spsps_keywords_));
+	// Assign classes, and bound the number of nodes.
+	size_t total = 1;
+	keywords->nclasses = 1;
+	keywords->longest = 0;
+	for (size_t index = 0; list != NULL && list[index] != NULL; ++index) {
+		size_t length = strlen(list[index]);
+		total += length;
+		if (length > keywords->longest) keywords->longest = length;
+		for (size_t here = 0; here < length; ++here) {
+			unsigned char ch = (unsigned char) list[index][here];
+			if (keywords->classes[ch] == 0) {
+				keywords->classes[ch] = (uint8_t) keywords->nclasses++;
+			}
+		} // Classify the characters.
+	} // Scan the keywords.
+	keywords->next = (uint32_t *) calloc(total * keywords->nclasses,
+			sizeof(uint32_t));
+	keywords->accept = (int *) malloc(total * sizeof(int));
+	for (size_t index = 0; index < total; ++index) {
+		keywords->accept[index] = -1;
+	} // Nothing is accepted yet.
+	keywords->nodes = 1;
+	// Insert the keywords.  An earlier duplicate wins.
+	for (size_t index = 0; list != NULL && list[index] != NULL; ++index) {
+		size_t node = 0;
+		for (char * here = list[index]; *here != 0; ++here) {
+			uint32_t * slot = &keywords->next[node * keywords->nclasses +
+					keywords->classes[(unsigned char) *here]];
+			if (*slot == 0) *slot = (uint32_t) keywords->nodes++;
+			node = *slot;
+		} // Walk or extend the trie.
+		if (keywords->accept[node] < 0) keywords->accept[node] = (int) index;
+	} // Insert all keywords.
+	return keywords;
+}
+
+void
+spsps_keywords_free(Keywords keywords) {
+	if (keywords == NULL) return;
+	free(keywords->next);
+	free(keywords->accept);
+	free(keywords);
+}
+
+int
+spsps_match_keyword(Parser parser, Keywords keywords, bool consume) {
+	// The window may be allocated or grown by this method.
+	parser->status = OK;
+	int match = keywords->accept[0];
+	size_t length = 0;
+	size_t node = 0;
+	for (size_t index = 0; index < keywords->longest; ++index) {
+		// Only ask for more characters when the trie still wants them.
+		if (parser->next + index >= parser->limit &&
+				! spsps_fill_(parser, index + 1)) {
+			break;
+		}
+		SPSPS_CHAR ch = parser->buf[parser->next + index];
+		uint32_t code = (sizeof(SPSPS_CHAR) == 1)
+				? (uint32_t) (unsigned char) ch : (uint32_t) ch;
+		if (code >= 256 || keywords->classes[code] == 0) break;
+		node = keywords->next[node * keywords->nclasses +
+				keywords->classes[code]];
+		if (node == 0) break;
+		if (keywords->accept[node] >= 0) {
+			match = keywords->accept[node];
+			length = index + 1;
+		}
+	} // Walk the trie.
+	if (match >= 0 && consume) spsps_consume_n(parser, length);
+	return match;
+}
@@ -59,6 +59,8 @@ struct xstring_ {
 	 */
 	xchar * cstr;
 	size_t length;
+	/* Whether cstr belongs to someone else, and must not be freed. */
+	bool borrowed;
 };
 
 struct mstring_ {
@@ -143,6 +145,7 @@ xstr_new() {
 	xstring empty = (xstring) malloc(sizeof(struct xstring_));
 	empty->length = 0;
 	empty->cstr = NULL;
+	empty->borrowed = false;
 	return empty;
 }
 
@@ -168,7 +171,7 @@ xstr_free(xstring value) {
 	// always check the length in lieu of the cstr.
 	value->length = 0;
 	if (value->cstr != NULL) {
-		free(value->cstr);
+		if (! value->borrowed) free(value->cstr);
 		value->cstr = NULL;
 	}
 	free(value);
@@ -207,6 +210,28 @@ xstr_wrap(char * value) {
 	return str;
 }
 
+xstring
+xstr_wrap_n(const xchar * value, size_t length) {
+	// If the length is zero, don't allocate anything.
+	if (value == NULL || length == 0) return NULL;
+	xstring str = xstr_new();
+	str->length = length;
+	str->cstr = (xchar *) malloc(length * SPSPS_CHAR_SIZE);
+	memcpy(str->cstr, value, length * SPSPS_CHAR_SIZE);
+	return str;
+}
+
+xstring
+xstr_borrow(const xchar * value, size_t length) {
+	// If the length is zero, don't allocate anything.
+	if (value == NULL || length == 0) return NULL;
+	xstring str = xstr_new();
+	str->length = length;
+	str->cstr = (xchar *) value;
+	str->borrowed = true;
+	return str;
+}
+
 xstring
 xstr_wrap_f(char * value) {
 	xstring ret = xstr_wrap(value);
@@ -555,6 +580,12 @@ xstr_char(xstring value, size_t index) {
 	return value->cstr[index];
 }
 
+const xchar *
+xstr_data(xstring value) {
+	if (value == NULL) return NULL;
+	return value->cstr;
+}
+
 xchar
 mstr_char(mstring value, size_t index) {
 	if (value == NULL) return 0;
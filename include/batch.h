@@ -0,0 +1,151 @@
+#ifndef SPSPS_BATCH_H_
+#define SPSPS_BATCH_H_
+
+/**
+ * @file
+ * Parse many files in parallel.
+ *
+ * @verbatim
+ * SPSPS
+ * Stacy's Pathetically Simple Parsing System
+ * https://github.com/sprowell/spsps
+ *
+ * Copyright (c) 2014, Stacy Prowell
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * @endverbatim
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "parser.h"
+
+/**
+ * What a result of a batch is for.
+ */
+typedef struct spsps_batch_item_ {
+	/// The index of the file in the list of paths.
+	size_t index;
+	/// The path of the file.
+	const char * path;
+	/// Whether the file could be read.  If not, the rule was not run and the
+	/// parser is NULL.
+	bool opened;
+	/// Which piece of the file this is, counting from zero.
+	size_t piece;
+	/// How many pieces the file was split into.  This is one unless the file
+	/// was split.
+	size_t pieces;
+	/// The offset of the piece in the file, in characters.  Locations from
+	/// the parser are relative to the start of the piece.
+	uint64_t offset;
+	/// The length of the piece, in characters.
+	size_t length;
+	/// The parser that parsed the piece.  It is only valid during the
+	/// callback, and can be asked for its location and recorded errors.
+	Parser parser;
+} spsps_batch_item;
+
+/**
+ * Receive the value a rule returned for a file or a piece of a file.  This
+ * is called on the worker threads, possibly on several at once, so it must
+ * be thread-safe.  It takes over the value.
+ * @param context		The context given to spsps_parse_batch.
+ * @param item			What the value is for.
+ * @param value			The value the rule returned.
+ */
+typedef void (*spsps_batch_result)(void * context,
+		const spsps_batch_item * item, void * value);
+
+/**
+ * Find where a file may be split, for grammars whose input is a sequence of
+ * independent records (such as one JSON document per line).  This is called
+ * on a worker thread.
+ * @param context		The context given to spsps_parse_batch_ex.
+ * @param data			The characters of the file.
+ * @param length		The number of characters.
+ * @param at			Where a split is wanted.
+ * @return				The first place at or after at where a new piece may
+ * 						start, or length if there is none.
+ */
+typedef size_t (*spsps_batch_split)(void * context, const SPSPS_CHAR * data,
+		size_t length, size_t at);
+
+/**
+ * Options for spsps_parse_batch_ex.  A zero field means the default.
+ */
+typedef struct spsps_batch_options_ {
+	/// The number of threads to use.  The default is the number of
+	/// processors.
+	size_t threads;
+	/// If not NULL, files longer than piece characters are split into
+	/// pieces of about that length, where this says they may be, and the
+	/// pieces are parsed separately.
+	spsps_batch_split split;
+	/// The length of a piece.  The default is 1 MiB worth of characters.
+	size_t piece;
+} spsps_batch_options;
+
+/**
+ * Parse files in parallel.  Each file is mapped into memory and parsed by
+ * the rule, and the value the rule returns is handed to the result callback.
+ * The files are shared out among worker threads, each with a deque of files
+ * to parse, and a thread that runs out steals from the others, so that a few
+ * large files do not hold up the rest.  Each worker reuses one parser for
+ * all of its files.  The rule runs on the worker threads, so it must not
+ * touch shared state without locking.  This returns when every file has been
+ * parsed.
+ * @param paths			The files to parse.
+ * @param n				The number of files.
+ * @param rule			The rule to parse each file with.  It is passed the
+ * 						context.
+ * @param result		Called with what the rule returns for each file.
+ * @param context		Passed to the rule and the callback.
+ * @param threads		The number of threads to use, or zero for the number
+ * 						of processors.
+ * @return				The number of files that could not be read.
+ */
+size_t spsps_parse_batch(char ** paths, size_t n, spsps_rule rule,
+		spsps_batch_result result, void * context, size_t threads);
+
+/**
+ * Parse files in parallel, as spsps_parse_batch does, with options.  If a
+ * split function is given, large files are split into pieces that are
+ * scheduled separately, so that one huge file is spread across threads.
+ * @param paths			The files to parse.
+ * @param n				The number of files.
+ * @param rule			The rule to parse each file or piece with.
+ * @param result		Called with what the rule returns for each file or
+ * 						piece.
+ * @param context		Passed to the rule, the split function, and the
+ * 						callback.
+ * @param options		The options, or NULL for the defaults.
+ * @return				The number of files that could not be read.
+ */
+size_t spsps_parse_batch_ex(char ** paths, size_t n, spsps_rule rule,
+		spsps_batch_result result, void * context,
+		const spsps_batch_options * options);
+
+#endif /* SPSPS_BATCH_H_ */
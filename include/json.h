@@ -5,6 +5,10 @@
  * @file
  * Definitions for the JSON parser.
  *
+ * Thread safety: json_parse_value may run on many threads at once, each
+ * with its own parser.  A JSON value is not locked, so it may be read by
+ * many threads at once, but only while no thread changes or frees it.
+ *
  * @verbatim
  * SPSPS
  * Stacy's Pathetically Simple Parsing System
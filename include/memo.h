@@ -0,0 +1,139 @@
+#ifndef SPSPS_MEMO_H_
+#define SPSPS_MEMO_H_
+
+/**
+ * @file
+ * Packrat memoization for recursive-descent rules.
+ *
+ * @verbatim
+ * SPSPS
+ * Stacy's Pathetically Simple Parsing System
+ * https://github.com/sprowell/spsps
+ *
+ * Copyright (c) 2014, Stacy Prowell
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * @endverbatim
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "parser.h"
+
+/**
+ * A memo table.  This remembers, for a rule and an input offset, what the
+ * rule produced and where it stopped, so that a backtracking parser does not
+ * parse the same rule at the same place twice.  Rules are identified by small
+ * integers chosen by the caller.
+ *
+ * A typical rule looks like this.
+ *
+ * @verbatim
+ * void * value;
+ * if (spsps_memo_lookup(memo, parser, RULE_EXPR, &value)) return value;
+ * uint64_t start = spsps_offset(parser);
+ * value = ...parse the rule...;
+ * spsps_memo_store(memo, RULE_EXPR, start, spsps_offset(parser), value);
+ * return value;
+ * @endverbatim
+ */
+typedef struct spsps_memo_ * Memo;
+
+/**
+ * Counts kept for each rule, so that you can tell whether memoizing the rule
+ * pays off.  A rule with few hits per store is probably not worth it.
+ */
+typedef struct spsps_memo_stats_ {
+	/// The number of lookups that found an entry.
+	uint64_t hits;
+	/// The number of lookups that did not.
+	uint64_t misses;
+	/// The number of entries stored.
+	uint64_t stores;
+	/// The number of entries discarded because they fell out of the window.
+	uint64_t evictions;
+} spsps_memo_stats;
+
+/**
+ * Make a new memo table.  Entries for offsets more than window characters
+ * behind the latest stored offset are discarded, so that the table stays
+ * small while parsing a long stream.  The window should be at least as far as
+ * the grammar ever backtracks; a window of zero keeps everything.
+ * @param rules			The number of rules.  Rule identifiers are below this.
+ * @param window		How far back to keep entries, in characters, or zero.
+ * @param release		If not NULL, called on each value the table discards.
+ * @return				The new table.
+ */
+Memo spsps_memo_new(size_t rules, uint64_t window, void (* release)(void *));
+
+/**
+ * Free a memo table.  The release function, if any, is called on every value
+ * still in the table.
+ * @param memo			The table.
+ */
+void spsps_memo_free(Memo memo);
+
+/**
+ * Look for the result of a rule at the parser's next character.  If there is
+ * one, the parser consumes up to where the rule stopped, and the stored value
+ * is returned.  The value is shared with the table, so it must not be freed
+ * by the caller unless the table has no release function.
+ * @param memo			The table.
+ * @param parser		The parser.
+ * @param rule			The rule identifier.
+ * @param value			Set to the stored value on a hit.
+ * @return				True iff there was an entry.
+ */
+bool spsps_memo_lookup(Memo memo, Parser parser, unsigned rule, void ** value);
+
+/**
+ * Record the result of a rule.  If there is already an entry for the rule and
+ * start, it is replaced.
+ * @param memo			The table.
+ * @param rule			The rule identifier.
+ * @param start			The offset at which the rule started.
+ * @param end			The offset at which the rule stopped.
+ * @param value			The value the rule produced.  NULL is a fine value,
+ * 						for instance to record that the rule failed.
+ */
+void spsps_memo_store(Memo memo, unsigned rule, uint64_t start, uint64_t end,
+		void * value);
+
+/**
+ * Discard every entry.  The release function, if any, is called on each
+ * value.  The counts are kept.
+ * @param memo			The table.
+ */
+void spsps_memo_clear(Memo memo);
+
+/**
+ * Get the counts for a rule.
+ * @param memo			The table.
+ * @param rule			The rule identifier.
+ * @return				The counts, or all zeros if the rule is out of range.
+ */
+spsps_memo_stats spsps_memo_rule_stats(Memo memo, unsigned rule);
+
+#endif /* SPSPS_MEMO_H_ */
@@ -5,6 +5,16 @@
  * @file
  * The main public interface to the SPSPS library.
  *
+ * Thread safety: the library keeps no global state that parsers share, so
+ * any number of threads may each run their own parsers at once.  A single
+ * Parser must not be used by two threads at the same time.  Character
+ * classes and keyword matchers are never changed once built, so they may be
+ * shared freely; the built-in classes are constants.  Errors printed through
+ * SPSPS_ERR are written a line at a time, so that lines from different
+ * threads on one stream do not interleave.  spsps_printchar returns a buffer
+ * that belongs to the calling thread, and spsps_printchar_r uses the
+ * caller's.
+ *
  * @verbatim
  * SPSPS
  * Stacy's Pathetically Simple Parsing System
@@ -37,13 +47,15 @@
  * @endverbatim
  */
 
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-/// The number of characters to read at once.  This is also the lookahead limit.
-/// To override this value \#define it prior to inclusion.
+/// The number of characters to read at once.  There is no lookahead limit;
+/// the parser's buffer grows as needed.  To override this value \#define it
+/// prior to inclusion.
 #ifndef SPSPS_LOOK
     #define SPSPS_LOOK (4096)
 #endif
@@ -54,15 +66,39 @@
  	#define SPSPS_CHAR char
 #endif
 
-/// The end of file marker.
+/// The end of file marker.  The parser knows where its input ends from how
+/// many characters there are, not from this value, but functions that return
+/// a single character use it to say there is none.  In binary or Latin-1
+/// input it is also a valid character, so use spsps_peek_view, spsps_window,
+/// or spsps_offset when the difference matters.
 #define SPSPS_EOF ((SPSPS_CHAR)-1)
 
+/// The end of file marker for code points.  Unlike SPSPS_EOF, this cannot be
+/// confused with a character.
+#define SPSPS_EOF_CP (-1)
+
+/// The number of characters read at once by the read-ahead thread.  To
+/// override this value \#define it prior to inclusion.
+#ifndef SPSPS_READAHEAD_BLOCK
+	#define SPSPS_READAHEAD_BLOCK (16*SPSPS_LOOK)
+#endif
+
+/// The default size, in bytes, of the stack on which a push parser runs its
+/// rule.  To override this value \#define it prior to inclusion.
+#ifndef SPSPS_PUSH_STACK
+	#define SPSPS_PUSH_STACK (256*1024)
+#endif
+
+#include "xstring.h"
+
 // If you #define SPSPS_SHORTHAND, then you get shorter names for the methods
 // that might conflict with other names.  It's up to you.
 #ifdef SPSPS_SHORTHAND
 #define consume()				spsps_consume()
 #define consume_n(m_n)			spsps_consume_n(m_n)
 #define consume_whitespace()	spsps_consume_whitespace()
+#define consume_while(m_set)	spsps_consume_while(parser, m_set)
+#define consume_until(m_set)	spsps_consume_until(parser, m_set)
 #define eof()					spsps_eof()
 #define loc()					spsps_loc()
 #define peek()					spsps_peek()
@@ -82,26 +118,99 @@ typedef struct spsps_loc_ {
 	char * name;
 
 	/** The line number of the next character to read. */
-	uint32_t line;
+	uint64_t line;
 
 	/** The column number of the next character to read. */
-	uint32_t column;
+	uint64_t column;
+
+	/**
+	 * The zero-based offset of the next character to read, counted in
+	 * characters from the start of the source.
+	 */
+	uint64_t offset;
 } Loc;
 
+/**
+ * A marked position in the input.  While a mark is held, the characters from
+ * the mark on are kept by the parser, so that they can be obtained with
+ * spsps_slice without being copied.
+ */
+typedef struct spsps_mark_ {
+	/** The zero-based offset of the marked character. */
+	uint64_t offset;
+} Mark;
+
+/**
+ * A saved parser state, for backtracking.  While a checkpoint is live the
+ * parser keeps every character from it on, so that restoring it never has to
+ * read the input again.
+ */
+typedef struct spsps_checkpoint_ {
+	/** The zero-based offset of the next character to read. */
+	uint64_t offset;
+	/** The line number of the next character to read. */
+	uint64_t line;
+	/** The column number of the next character to read. */
+	uint64_t column;
+	/** How many times the end of file had been consumed. */
+	uint16_t eof_count;
+	/** Whether the end of file had been consumed. */
+	bool at_eof;
+} Checkpoint;
+
 /**
  * Error codes returned by the parser.
  */
 typedef enum spsps_errno {
 	/// No errors.
 	OK = 0,
-	/// Lookahead past the SPSPS_LOOK limit.
+	/// Lookahead past the parser's limit, or past what it could allocate
+	/// room to hold.
 	LOOKAHEAD_TOO_LARGE,
 	/// The parser has likely stalled at the end of file.
 	STALLED_AT_EOF,
 	/// The parser has likely stalled.
-	STALLED
+	STALLED,
+	/// An error reported by a grammar through SPSPS_ERR.
+	PARSE_ERROR,
+	/// A code point was requested where the input is not valid UTF-8.
+	INVALID_UTF8,
+	/// A number was parsed that does not fit its type.
+	NUMBER_OUT_OF_RANGE,
+	/// A block comment skipped by spsps_skip ran to the end of the input.
+	UNTERMINATED_COMMENT
 } spsps_errno;
 
+/**
+ * Counters of the work a parser has done, for finding where parse time goes.
+ * These are only kept when the library is built with SPSPS_STATS; otherwise
+ * the counting compiles away and the counters read as zero.
+ */
+typedef struct spsps_parser_stats_ {
+	/// The number of characters consumed.  Characters consumed again after
+	/// a restore are counted again.
+	uint64_t consumed;
+	/// The number of calls that consumed characters.
+	uint64_t consumes;
+	/// The number of calls that peeked at characters.
+	uint64_t peeks;
+	/// The number of times the parser ran out of buffered characters and
+	/// had to go to the source (or wait to be fed).
+	uint64_t refills;
+	/// The number of reads from the source.  With read-ahead, this counts the
+	/// blocks read by the helper thread, and with a map hook the blocks
+	/// handed over.
+	uint64_t reads;
+	/// The time spent in those reads, in nanoseconds.
+	uint64_t read_nanos;
+	/// The number of times a stall was detected.
+	uint64_t stalls;
+	/// The number of checkpoints taken.
+	uint64_t checkpoints;
+	/// The number of errors reported.
+	uint64_t errors;
+} spsps_parser_stats;
+
 /**
  * Convert this location to a short string.  The caller assumes the
  * responsibility for deallocating the returned string.
@@ -109,6 +218,17 @@ typedef enum spsps_errno {
  */
 char * spsps_loc_to_string(Loc * loc);
 
+/**
+ * Write this location as a short string into the given buffer.  This is
+ * spsps_loc_to_string without the allocation.  As with snprintf, the output
+ * is truncated to fit and is always null-terminated if size is not zero.
+ * @param loc 			The location.
+ * @param buf 			The buffer.
+ * @param size 			The size of the buffer.
+ * @return 				The length of the full string, as with snprintf.
+ */
+int spsps_loc_format(const Loc * loc, char * buf, size_t size);
+
 /// The destination for error messages.  To override this \#define it prior to
 /// inclusion.  It must specify an open FILE* destination.
 #ifndef SPSPS_STDERR
@@ -116,48 +236,162 @@ char * spsps_loc_to_string(Loc * loc);
 #endif
 
 /**
- * Print an error message from a parser.  The message is sent to the
- * standard error stream.  If the parser is not NULL, then the location is
- * obtained and printed.  If the message is not NULL, then it is printed
- * (as a format string) and subsequent arguments are the arguments to the
- * format string.  If you wish to use a different stream, either redirect
- * standard error, or \#define SPSPS_STDERR to your stream.
+ * Report an error from a parser.  By default the message is printed to the
+ * standard error stream, along with the location if the parser is not NULL.
+ * The message is a format string, and subsequent arguments are the arguments
+ * to the format string.  If you wish to use a different stream, either
+ * redirect standard error, or \#define SPSPS_STDERR to your stream.  If the
+ * parser has been told to record errors (see spsps_set_error_mode) then the
+ * error is recorded in the parser instead, and nothing is printed.
  * @param m_parser			The parser.
  * @param m_msg				The message (a format string) plus arguments.
  */
-#define SPSPS_ERR(m_parser, m_msg, ...) { \
-	if ((m_parser) != NULL) { \
-		Loc * loc = spsps_loc(m_parser); \
-		if ((m_msg) != NULL) { \
-			fprintf(SPSPS_STDERR, "ERROR %s:%d:%d: " m_msg "\n", (loc)->name, \
-					(loc)->line, (loc)->column, ## __VA_ARGS__); \
-		} else { \
-			fprintf(SPSPS_STDERR, "ERROR %s:%d:%d: Unspecified error.\n", \
-					(loc)->name, (loc)->line, (loc)->column); \
-		} \
-		free(loc); \
-	} else { \
-		if ((m_msg) != NULL) { \
-			fprintf(SPSPS_STDERR, "ERROR: " m_msg "\n", ## __VA_ARGS__); \
-		} else { \
-			fprintf(SPSPS_STDERR, "ERROR: Unspecified error.\n"); \
-		} \
-	} \
-}
+#define SPSPS_ERR(m_parser, m_msg, ...) \
+	spsps_error_report((m_parser), SPSPS_STDERR, PARSE_ERROR, (m_msg), \
+			## __VA_ARGS__)
+
+/// The number of errors a parser keeps when recording errors.  To override
+/// this \#define it prior to inclusion.
+#ifndef SPSPS_ERROR_RING
+	#define SPSPS_ERROR_RING (8)
+#endif
+
+/// The most format arguments recorded with an error.  To override this
+/// \#define it prior to inclusion.
+#ifndef SPSPS_ERROR_ARGS
+	#define SPSPS_ERROR_ARGS (8)
+#endif
+
+/// The number of bytes of string arguments recorded with an error.  To
+/// override this \#define it prior to inclusion.
+#ifndef SPSPS_ERROR_TEXT
+	#define SPSPS_ERROR_TEXT (64)
+#endif
+
+/**
+ * How a parser handles reported errors.
+ */
+typedef enum spsps_error_mode_ {
+	/// Print each error to the stream given to SPSPS_ERR.  The default.
+	SPSPS_ERRORS_PRINT = 0,
+	/// Record errors in the parser, keeping the most recent
+	/// SPSPS_ERROR_RING of them.
+	SPSPS_ERRORS_RECORD,
+	/// Record the first error, then stop: the parser behaves as if it had
+	/// reached the end of the input, and later errors are ignored.
+	SPSPS_ERRORS_FIRST
+} spsps_error_mode;
+
+/**
+ * A recorded format argument.  Which member is valid depends on the
+ * conversion in the message.
+ */
+typedef union spsps_error_arg_ {
+	/// Signed integer conversions, and characters.
+	intmax_t i;
+	/// Unsigned integer conversions.
+	uintmax_t u;
+	/// Floating point conversions.
+	double d;
+	/// Pointer conversions.
+	void * p;
+	/// String conversions: the offset of the string in the error's text.
+	size_t s;
+} spsps_error_arg;
+
+/**
+ * An error recorded by a parser.  Recording an error does not allocate or
+ * format anything: the message (a format string) is kept by pointer, and
+ * serves as the message identifier, and the arguments are kept by value.
+ * Strings are copied into the record, truncated if they are long.  Use
+ * spsps_error_format to render the message if you want it.
+ */
+typedef struct spsps_error_ {
+	/// The error code.  SPSPS_ERR uses PARSE_ERROR.
+	int code;
+	/// Where the error was reported.
+	Loc loc;
+	/// The message, which is a format string.  This is not copied, so it
+	/// should be a string literal.
+	const char * msg;
+	/// The number of recorded arguments.
+	size_t nargs;
+	/// The recorded arguments.
+	spsps_error_arg args[SPSPS_ERROR_ARGS];
+	/// Storage for string arguments.
+	char text[SPSPS_ERROR_TEXT];
+} spsps_error;
 
 /**
  * A parser object is an opaque pointer.
  */
 typedef struct spsps_parser_ * Parser;
 
+/**
+ * A rule run by a push parser.  This is ordinary recursive-descent code; see
+ * spsps_new_push.
+ * @param parser		The parser.
+ * @param context		The context given to spsps_new_push.
+ * @return				The value to return from spsps_finish.
+ */
+typedef void * (* spsps_rule)(Parser parser, void * context);
+
+/**
+ * A compiled set of keywords, for choosing among many alternatives at once.
+ * See spsps_keywords_compile.
+ */
+typedef struct spsps_keywords_ * Keywords;
+
+/**
+ * A compiled description of what lies between tokens: whitespace, line
+ * comments, and block comments.  See spsps_skip_compile.
+ */
+typedef struct spsps_skip_ * SkipSet;
+
+/**
+ * A character class: a set of characters that can be tested, peeked, and
+ * consumed in bulk.  The built-in classes below follow the "C" locale, so
+ * they do not depend on the locale and never call the ctype functions.
+ * Make your own with spsps_class_new, spsps_class_range, and
+ * spsps_class_union.
+ */
+typedef const struct spsps_class_ * CharClass;
+
+/// The digits 0 to 9.
+extern const CharClass SPSPS_DIGIT;
+/// The hexadecimal digits 0 to 9, A to F, and a to f.
+extern const CharClass SPSPS_XDIGIT;
+/// The letters A to Z.
+extern const CharClass SPSPS_UPPER;
+/// The letters a to z.
+extern const CharClass SPSPS_LOWER;
+/// The letters A to Z and a to z.
+extern const CharClass SPSPS_ALPHA;
+/// The letters and digits.
+extern const CharClass SPSPS_ALNUM;
+/// Space, tab, newline, vertical tab, form feed, and carriage return.
+extern const CharClass SPSPS_SPACE;
+/// The printable ASCII characters, space to tilde.
+extern const CharClass SPSPS_PRINT;
+/// The printable ASCII characters other than space, letters, and digits.
+extern const CharClass SPSPS_PUNCT;
+/// The characters that may continue a C identifier: letters, digits, and _.
+extern const CharClass SPSPS_IDENT;
+/// The characters that may start a C identifier: letters and _.
+extern const CharClass SPSPS_IDENT_START;
+
+/// The size of a buffer big enough for spsps_printchar_r.
+#define SPSPS_PRINTCHAR_SIZE (32)
+
 /**
  * Format and return a string representation of the given character as a
- * Unicode character.  The same buffer is used every time, so do not
- * deallocate the return, but do copy it if you want to preserve it.
+ * Unicode character.  The same buffer is used every time by a thread (each
+ * thread has its own), so do not deallocate the return, but do copy it if
+ * you want to preserve it.
  * The return value will have the form "U+hhhh (c)", where hhhh is the four
  * digit hex value of the character (if it is 16-bit Unicode) and c is the
  * character itself (if it is printable).  If the character is not printable
- * (as determined by the isprint C library function, then the " (c)" part
+ * (that is, not in SPSPS_PRINT), then the " (c)" part
  * is suppressed.  If this is outside the 16-bit Unicode range, the results
  * are unpredictable.
  * @param xch			The character.
@@ -165,6 +399,74 @@ typedef struct spsps_parser_ * Parser;
  */
 char * spsps_printchar(SPSPS_CHAR xch);
 
+/**
+ * Format a character as spsps_printchar does, but into the caller's buffer.
+ * @param xch			The character.
+ * @param buf			The buffer.  SPSPS_PRINTCHAR_SIZE is always enough.
+ * @param size			The size of the buffer.
+ * @return				The buffer.
+ */
+char * spsps_printchar_r(SPSPS_CHAR xch, char * buf, size_t size);
+
+/**
+ * Report an error.  This is the implementation of SPSPS_ERR; see there.
+ * @param parser 		The parser, or NULL.
+ * @param out 			The stream to print to, if the error is printed.
+ * @param code 			The error code.
+ * @param msg 			The message, as a format string.
+ * @param ... 			The arguments to the format string.
+ */
+void spsps_error_report(Parser parser, FILE * out, int code,
+		const char * msg, ...)
+#if defined(__GNUC__) || defined(__clang__)
+	__attribute__((format(printf, 4, 5)))
+#endif
+	;
+
+/**
+ * Set how the parser handles errors reported with SPSPS_ERR.  Changing the
+ * mode does not discard errors already recorded.
+ * @param parser 		The parser.
+ * @param mode 			The new mode.
+ */
+void spsps_set_error_mode(Parser parser, spsps_error_mode mode);
+
+/**
+ * Get the number of errors recorded by the parser.  At most SPSPS_ERROR_RING
+ * errors are kept, so this may be more than the number available.
+ * @param parser 		The parser.
+ * @return 				The number of errors recorded.
+ */
+size_t spsps_error_count(Parser parser);
+
+/**
+ * Get a recorded error.  The errors kept are numbered from zero (the oldest
+ * kept) up.  The returned error belongs to the parser, and is valid until
+ * the parser records more errors, is cleared, or is freed.
+ * @param parser 		The parser.
+ * @param index 		The index of the error.
+ * @return 				The error, or NULL if there is no such error.
+ */
+const spsps_error * spsps_error_at(Parser parser, size_t index);
+
+/**
+ * Discard all recorded errors.  If the parser stopped at its first error
+ * it stays stopped.
+ * @param parser 		The parser.
+ */
+void spsps_clear_errors(Parser parser);
+
+/**
+ * Render a recorded error in the same form SPSPS_ERR prints, without the
+ * trailing newline.  As with snprintf, the output is truncated to fit and is
+ * always null-terminated if size is not zero.
+ * @param error 		The error.
+ * @param buf 			The buffer.
+ * @param size 			The size of the buffer.
+ * @return 				The length of the full message, as with snprintf.
+ */
+int spsps_error_format(const spsps_error * error, char * buf, size_t size);
+
 /**
  * Create a new parser instance.  The caller is responsible for freeing the
  * returned parser instance by calling spsps_free.  The provided file name is
@@ -177,7 +479,291 @@ char * spsps_printchar(SPSPS_CHAR xch);
 Parser spsps_new(char * name, FILE * stream);
 
 /**
- * Free a parser instance previously created with spsps_new.
+ * An allocator for a parser's buffer.  This works like realloc: it resizes
+ * the memory at ptr (or allocates new memory if ptr is NULL) and returns it,
+ * or returns NULL and leaves the memory alone if it cannot.  A new_size of
+ * zero means free the memory.  The old size is passed along for allocators,
+ * such as those that map huge pages, that need it.
+ * @param context 		The allocator context from the options.
+ * @param ptr 			The memory, or NULL.
+ * @param old_size 		The size of the memory at ptr, in bytes.
+ * @param new_size 		The size wanted, in bytes, or zero to free.
+ * @return 				The memory, or NULL.
+ */
+typedef void * (*spsps_allocator)(void * context, void * ptr, size_t old_size,
+		size_t new_size);
+
+/**
+ * Options for spsps_new_ex.  A zero field means the default, so start from
+ * a zeroed struct and set only what you need.
+ */
+typedef struct spsps_options_ {
+	/// The number of characters to read at once.  The buffer starts at
+	/// twice this.  The default is SPSPS_LOOK.
+	size_t block;
+	/// The most characters a peek may look ahead.  Looking further sets the
+	/// errno to LOOKAHEAD_TOO_LARGE and sees the end of file.  The default is
+	/// no limit.
+	size_t max_lookahead;
+	/// The allocator for the buffer.  The default uses realloc and free.
+	spsps_allocator allocator;
+	/// The context passed to the allocator.
+	void * allocator_context;
+} spsps_options;
+
+/**
+ * Create a new parser instance with options.  This is spsps_new, but with
+ * the buffer size, lookahead limit, and allocator given by the options.  The
+ * buffer is allocated when it is first needed.
+ * @param name 			The name of the stream.  Typically a file name.
+ * @param stream 		A stream to parse.
+ * @param options 		The options.  If NULL, the defaults are used.
+ * @return 				The new parser instance.
+ */
+Parser spsps_new_ex(char * name, FILE * stream, const spsps_options * options);
+
+/**
+ * Where a parser made by spsps_new_source gets its characters.  The hooks are
+ * given the context passed to spsps_new_source.  A source must have read or
+ * map; if it has map, read is never called.
+ */
+typedef struct spsps_source_ {
+	/// Read up to size characters into buf and return how many were read.
+	/// Reading fewer is fine; returning zero means the source is done.
+	size_t (*read)(void * context, SPSPS_CHAR * buf, size_t size);
+	/// Hand over the next block of characters in place, setting *length to
+	/// its size, or return NULL (or an empty block) when the source is
+	/// done.  The parser reads straight out of the block, and only copies
+	/// characters that a peek, mark, or checkpoint needs to keep across its
+	/// end.  The block must remain valid until the next call to map or
+	/// close.  May be NULL.
+	const SPSPS_CHAR * (*map)(void * context, size_t * length);
+	/// Release the source, once the parser is done with it.  May be NULL.
+	void (*close)(void * context);
+} spsps_source;
+
+/**
+ * Create a new parser instance that gets its characters from a source
+ * instead of a stream.  The hooks are copied, so the source struct need not
+ * outlive the call, but the context must remain valid until the source is
+ * closed.  The source is closed when the parser is freed or reset.  The
+ * name is copied, as with spsps_new.
+ * @param name 			The name of the source.  Typically a file name.
+ * @param source 		The hooks that provide the characters.
+ * @param context 		The context passed to the hooks.
+ * @return 				The new parser instance, or NULL if the source has
+ * 						neither read nor map.
+ */
+Parser spsps_new_source(char * name, const spsps_source * source,
+		void * context);
+
+/// The POSIX scatter/gather segment taken by spsps_new_iov.  Include
+/// <sys/uio.h> to make one.
+struct iovec;
+
+/**
+ * Create a new parser instance over characters scattered across several
+ * segments in memory, such as a chain of network buffers, without
+ * concatenating them.  The segments are parsed in place; characters are only
+ * copied when a peek, mark, or checkpoint reaches across the end of a
+ * segment.  The list of segments is copied, but the characters they point to
+ * are borrowed and must remain valid until the parser is freed.  Each iov_len
+ * is in bytes, and empty segments are skipped.  The name is copied, as with
+ * spsps_new.
+ * @param name 			The name of the source.
+ * @param iov 			The segments, in order.
+ * @param count 		The number of segments.
+ * @return 				The new parser instance, or NULL on platforms without
+ * 						iovec.
+ */
+Parser spsps_new_iov(char * name, const struct iovec * iov, size_t count);
+
+/**
+ * Tell a parser that it will be idle for a while, so that it can release its
+ * buffer.  This only happens if every character buffered has been consumed
+ * and nothing is pinned by a mark or checkpoint; otherwise the buffer is
+ * needed and kept.  A new buffer is allocated when the parser next needs
+ * one.  This is meant for parsers of connections that are mostly quiet.
+ * @param parser 		The parser.
+ * @return 				True iff the parser holds no buffer now.
+ */
+bool spsps_idle(Parser parser);
+
+/**
+ * Rewind a parser to parse a new stream, as if it had just been made with
+ * spsps_new, but keeping the buffers and options it already has.  Anything held
+ * for the old source (read-ahead, a push rule, a mapping) is released, a
+ * source from spsps_new_source is closed, and the error mode and UTF-8 mode
+ * go back to their defaults.  Unlike spsps_new, the name is not copied, so it
+ * must stay valid while the parser uses it.
+ * @param parser 		The parser.
+ * @param name 			The name of the stream.  Borrowed, not copied.
+ * @param stream 		A stream to parse.
+ */
+void spsps_reset(Parser parser, const char * name, FILE * stream);
+
+/**
+ * Rewind a parser to parse characters in memory, as spsps_new_buffer would.
+ * Both the name and the data are borrowed.
+ * @param parser 		The parser.
+ * @param name 			The name of the source.  Borrowed, not copied.
+ * @param data 			The characters to parse.  May be NULL if length is 0.
+ * @param length 		The number of characters to parse.
+ */
+void spsps_reset_buffer(Parser parser, const char * name,
+		const SPSPS_CHAR * data, size_t length);
+
+/// The most parsers kept in the pool of each thread.  To override this
+/// \#define it prior to inclusion when building the library.
+#ifndef SPSPS_POOL_SIZE
+	#define SPSPS_POOL_SIZE (8)
+#endif
+
+/// The largest window, in characters, kept by a parser that goes back into
+/// the pool.  To override this \#define it prior to inclusion when building
+/// the library.
+#ifndef SPSPS_POOL_WINDOW
+	#define SPSPS_POOL_WINDOW (16 * SPSPS_LOOK)
+#endif
+
+/**
+ * Get a parser for a stream from the pool of this thread, or make a new one
+ * if the pool is empty.  The parser is reset as by spsps_reset, so the name
+ * is borrowed, and has the default options whatever parser was released
+ * into the pool.  Give it back with spsps_release.
+ * @param name 			The name of the stream.  Borrowed, not copied.
+ * @param stream 		A stream to parse.
+ * @return 				The parser.
+ */
+Parser spsps_acquire(const char * name, FILE * stream);
+
+/**
+ * Get a parser for characters in memory from the pool of this thread, as
+ * spsps_reset_buffer would set it up.
+ * @param name 			The name of the source.  Borrowed, not copied.
+ * @param data 			The characters to parse.  May be NULL if length is 0.
+ * @param length 		The number of characters to parse.
+ * @return 				The parser.
+ */
+Parser spsps_acquire_buffer(const char * name, const SPSPS_CHAR * data,
+		size_t length);
+
+/**
+ * Give a parser back to the pool of this thread, or free it if the pool is
+ * full.  Any parser may be released, not just those acquired from the pool,
+ * but it must be released on the thread that will reuse it.
+ * @param parser 		The parser.
+ */
+void spsps_release(Parser parser);
+
+/**
+ * Free every parser in the pool of this thread.  Call this before a thread
+ * that used the pool exits.
+ */
+void spsps_pool_drain(void);
+
+/**
+ * Create a new parser instance that parses characters already in memory.
+ * The parser reads the caller's memory directly; nothing is copied, and the
+ * end of input is determined by the length, so the data may contain any
+ * character values.  The data is borrowed, not copied, and must remain
+ * valid and unmodified until the parser is freed.  The caller is responsible
+ * for freeing the returned parser by calling spsps_free, which does not
+ * free the data.
+ * @param name 			The name of the source.  Used by Loc.
+ * @param data 			The characters to parse.  May be NULL if length is 0.
+ * @param length 		The number of characters to parse.
+ * @return 				The new parser instance.
+ */
+Parser spsps_new_buffer(char * name, const SPSPS_CHAR * data, size_t length);
+
+/**
+ * Create a new parser instance that parses the characters of an xstring.
+ * This is the same as spsps_new_buffer on the string's characters, so the
+ * string is borrowed and must not be freed until the parser is freed.
+ * @param name 			The name of the source.  Used by Loc.
+ * @param str 			The string to parse.  NULL is the empty string.
+ * @return 				The new parser instance.
+ */
+Parser spsps_new_xstring(char * name, xstring str);
+
+/**
+ * Make a new push parser.  Rather than reading characters, a push parser is
+ * given them with spsps_feed, a chunk at a time, and told there are no more
+ * with spsps_finish.  The parsing is done by the given rule, which runs as a
+ * coroutine on its own stack: when the rule needs characters that have not
+ * been fed yet it is suspended, and spsps_feed returns; the next call to
+ * spsps_feed resumes it.  So the rule is written just as it would be for any
+ * other parser, and one thread can keep many push parsers going at once.
+ * Push parsers are not available on every platform.
+ * @param name			The name of the source.  May be NULL.
+ * @param rule			The rule to run.
+ * @param context		Passed to the rule.
+ * @param stack_size	The size of the rule's stack, in bytes, or zero for
+ * 						SPSPS_PUSH_STACK.
+ * @return				The new parser, or NULL if push parsers are not
+ * 						available.
+ */
+Parser spsps_new_push(char * name, spsps_rule rule, void * context,
+		size_t stack_size);
+
+/**
+ * Give characters to a push parser, and run its rule until it needs more or
+ * is done.  The characters are copied, so the chunk can be reused as soon as
+ * this returns.  Characters fed after the rule is done are kept, and can be
+ * read with the usual methods.
+ * @param parser		The push parser.
+ * @param chunk			The characters.
+ * @param length		The number of characters.
+ * @return				True iff the rule is done.
+ */
+bool spsps_feed(Parser parser, const SPSPS_CHAR * chunk, size_t length);
+
+/**
+ * Tell a push parser there are no more characters, so that the rule sees the
+ * end of file, and run the rule until it is done.
+ * @param parser		The push parser.
+ * @return				The value returned by the rule.
+ */
+void * spsps_finish(Parser parser);
+
+/**
+ * Have a helper thread read the stream ahead of the parser, so that the
+ * parser does not wait on each read.  The thread reads blocks of
+ * SPSPS_READAHEAD_BLOCK characters, up to the given number of blocks ahead.
+ * This helps most when reading is slow, as on a pipe or a file that is not
+ * cached.  Once this is called the stream belongs to the thread until the
+ * parser is freed, and freeing the parser waits for any read in progress.
+ * @param parser		A parser that reads a stream.
+ * @param blocks		How many blocks to read ahead; at least two are used.
+ * @return				True iff the thread was started.  This is false for
+ * 						memory-backed and push parsers, and on platforms
+ * 						without thread support.
+ */
+bool spsps_readahead(Parser parser, size_t blocks);
+
+/**
+ * Create a new parser instance that reads the named file through a memory
+ * mapping.  The parser indexes directly into the mapping, so characters are
+ * never copied and there is no block refill.  Apart from that the parser
+ * behaves exactly like one created by spsps_new.  Where memory mapping is
+ * not available the whole file is read into memory instead.  A file that
+ * opens but cannot be mapped or read whole, such as a named pipe, a
+ * /dev/fd path, or a file that reports no size, is read as a stream
+ * instead; the parser then owns the stream and closes it when it is freed.
+ * The caller is responsible for freeing the returned parser by calling
+ * spsps_free, which also releases the mapping.
+ * @param name 			The name of the stream.  If NULL, the path is used.
+ * @param path 			The path of the file to map.
+ * @return 				The new parser instance, or NULL if the file cannot
+ * 						be opened.
+ */
+Parser spsps_new_mmap(char * name, char * path);
+
+/**
+ * Free a parser instance previously created with spsps_new.  Freeing a push
+ * parser whose rule is suspended abandons the rule, so anything the rule has
+ * allocated is lost.
  * @param parser 		The parser to free.
  */
 void spsps_free(Parser parser);
@@ -204,6 +790,44 @@ void spsps_consume_n(Parser parser, size_t n);
  */
 void spsps_consume_whitespace(Parser parser);
 
+/**
+ * Consume and discard all characters that are in the given set.  When this
+ * method returns the next character is the first character not in the set,
+ * or the end of file has been reached.  The set is given as a C string of
+ * its members, so `"0123456789"` is the set of decimal digits.  Buffered
+ * characters are scanned in bulk (16 or 32 at a time where SSE2 or AVX2 is
+ * available), which is much faster than a loop over spsps_peek and
+ * spsps_consume.  Lines and columns are kept up to date.
+ * @param parser 		The parser.
+ * @param set 			The members of the set.
+ * @return 				The number of characters consumed.
+ */
+size_t spsps_consume_while(Parser parser, const char * set);
+
+/**
+ * Consume and discard all characters that are not in the given set.  When
+ * this method returns the next character is the first character in the set,
+ * or the end of file has been reached.  See spsps_consume_while.
+ * @param parser 		The parser.
+ * @param set 			The members of the set.
+ * @return 				The number of characters consumed.
+ */
+size_t spsps_consume_until(Parser parser, const char * set);
+
+/**
+ * Consume up to max characters that are in the given set, and copy them
+ * into the provided buffer.  This is spsps_consume_while for callers that
+ * need the characters, such as the digits of a number.  If this returns
+ * max there may be more characters from the set waiting in the stream.
+ * @param parser 		The parser.
+ * @param set 			The members of the set.
+ * @param buf 			The buffer to receive the characters.
+ * @param max 			The capacity of the buffer.
+ * @return 				The number of characters consumed.
+ */
+size_t spsps_take_while(Parser parser, const char * set, SPSPS_CHAR * buf,
+		size_t max);
+
 /**
  * Determine if the end of file has been consumed.
  * @param parser 		The parser.
@@ -211,15 +835,124 @@ void spsps_consume_whitespace(Parser parser);
  */
 bool spsps_eof(Parser parser);
 
+/**
+ * Get the error code left by the most recent call on the parser.  Most calls
+ * clear it on entry, so check it right after the call of interest.
+ * @param parser 		The parser.
+ * @return 				The error code, which is OK if there was no error.
+ */
+spsps_errno spsps_get_errno(Parser parser);
+
+/**
+ * Get the counters of a parser.
+ * @param parser 		The parser.
+ * @param stats 		Set to the counters.
+ * @return 				True iff counters are kept, which needs the library to
+ * 						be built with SPSPS_STATS.
+ */
+bool spsps_stats(Parser parser, spsps_parser_stats * stats);
+
+/**
+ * Get the counters of all parsers freed so far, from every thread.  Each
+ * thread adds to its own share of the totals when it frees a parser, so the
+ * parsers do not contend with each other; this adds up the shares.
+ * @param stats 		Set to the counters.
+ * @return 				True iff counters are kept, which needs the library to
+ * 						be built with SPSPS_STATS.
+ */
+bool spsps_stats_total(spsps_parser_stats * stats);
+
 /**
  * Get the current location in the stream.  This is the location of the next
  * character to be read, unless the end of stream has been reached.  The caller
- * is responsible for freeing the returned location via free.
+ * is responsible for freeing the returned location via free.  The parser only
+ * tracks the offset as characters are consumed; the line and column are
+ * computed here, by counting newlines since the last location computed.
  * @param parser		The parser.
  * @return				The location of the next character to be read.
  */
 Loc * spsps_loc(Parser parser);
 
+/**
+ * Get the offset of the next character to be read, counted in characters
+ * from the start of the stream.  This is cheap, and does not compute the
+ * line and column.
+ * @param parser		The parser.
+ * @return				The zero-based offset of the next character.
+ */
+uint64_t spsps_offset(Parser parser);
+
+/**
+ * Mark the position of the next character to be read.  Until the mark is
+ * released with spsps_unmark, the parser keeps every character from the mark
+ * on, so spsps_slice can return them without copying.  Marks may nest and
+ * overlap; each must be released exactly once.  Holding a mark across a very
+ * long stretch of a stream makes the parser hold all of that stretch.
+ * @param parser		The parser.
+ * @return				The mark.
+ */
+Mark spsps_mark(Parser parser);
+
+/**
+ * Get the characters consumed since a mark.  The returned pointer is into the
+ * parser's own buffer; it is not null-terminated, and it is only valid until
+ * the next peek or consume (which may move the buffer).  The characters
+ * themselves remain available, via another call to this method, until the
+ * mark is released.
+ * @param parser		The parser.
+ * @param mark			A mark that has not been released.
+ * @param length		If not NULL, set to the number of characters.
+ * @return				The first character since the mark, or NULL if the
+ * 						mark is not live or lies ahead of the parser.
+ */
+const SPSPS_CHAR * spsps_slice(Parser parser, Mark mark, size_t * length);
+
+/**
+ * Release a mark.  Once released, the parser may discard the characters it
+ * was keeping for the mark.
+ * @param parser		The parser.
+ * @param mark			The mark to release.
+ */
+void spsps_unmark(Parser parser, Mark mark);
+
+/**
+ * Save the state of the parser, so that it can be restored later.  Every
+ * checkpoint must be either restored with spsps_restore or dropped with
+ * spsps_commit, exactly once.  Checkpoints may nest; they need not be
+ * released in any particular order.  A typical use is to try one alternative
+ * of a grammar, and restore the checkpoint if the alternative fails.
+ * @param parser		The parser.
+ * @return				The checkpoint.
+ */
+Checkpoint spsps_checkpoint(Parser parser);
+
+/**
+ * Return the parser to a checkpoint and release the checkpoint.  The next
+ * character, the location, and the end of file state are all as they were
+ * when the checkpoint was taken.  Nothing is read, so this is cheap.  Errors
+ * reported since the checkpoint are not affected.
+ * @param parser		The parser.
+ * @param checkpoint	A checkpoint that has not been released.
+ */
+void spsps_restore(Parser parser, Checkpoint checkpoint);
+
+/**
+ * Release a checkpoint without restoring it, keeping everything consumed
+ * since.  Once released, the parser may discard the characters it was
+ * keeping for the checkpoint.
+ * @param parser		The parser.
+ * @param checkpoint	A checkpoint that has not been released.
+ */
+void spsps_commit(Parser parser, Checkpoint checkpoint);
+
+/**
+ * Get the current location in the stream.  This is spsps_loc, but the
+ * location is returned by value, so nothing is allocated.
+ * @param parser		The parser.
+ * @return				The location of the next character to be read.
+ */
+Loc spsps_location(Parser parser);
+
 /**
  * Peek and return the next character in the stream.  The character is not
  * consumed.
@@ -230,8 +963,7 @@ SPSPS_CHAR spsps_peek(Parser parser);
 
 /**
  * Peek ahead at the next few characters in the stream, and return them.  The
- * return value is a string, so nulls may cause an issue.  The number of
- * characters must be below the lookahead limit.  End of file causes the
+ * return value is a string, so nulls may cause an issue.  End of file causes the
  * returned string to be populated by EOF characters.  The caller is
  * responsible for freeing the returned fixed-length string.
  * @param parser		The parser.
@@ -240,10 +972,39 @@ SPSPS_CHAR spsps_peek(Parser parser);
  */
 SPSPS_CHAR * spsps_peek_n(Parser parser, size_t n);
 
+/**
+ * Expose the buffered characters starting at the next character, without
+ * copying them.  At least the requested number of characters are made
+ * available unless the stream ends first (or the request exceeds the
+ * maximum lookahead), and more may be.  The returned pointer is only valid
+ * until the next call that reads or consumes; nothing is consumed by this
+ * method.  This is the primitive that generated parsers use to scan runs of
+ * characters in place.
+ * @param parser		The parser.
+ * @param need			The number of characters wanted.
+ * @param available		Set to the number of characters available.
+ * @return				The next characters, or NULL if none are buffered.
+ */
+const SPSPS_CHAR * spsps_window(Parser parser, size_t need, size_t * available);
+
+/**
+ * Peek ahead at the next n characters in place, without copying them.  The
+ * characters are contiguous however far ahead they reach.  Unlike
+ * spsps_peek_n, nothing is allocated and nothing is padded: if fewer than n
+ * characters remain before the end of the input, NULL is returned, so the
+ * end can never be confused with a character.  The returned pointer is only
+ * valid until the next call that reads or consumes.
+ * @param parser		The parser.
+ * @param n				The number of characters to look ahead.
+ * @return				The next n characters, or NULL if there are fewer.
+ */
+const SPSPS_CHAR * spsps_peek_view(Parser parser, size_t n);
+
 /**
  * Peek ahead and determine if the next characters in the stream are the given
  * characters, in sequence.  That is, the given string must be the next thing
- * in the stream.
+ * in the stream.  The characters are compared all at once, and never match
+ * past the end of the input.
  * @param parser		The parser
  * @param next			The characters.
  * @return				True iff the stream contains the given string next.
@@ -259,4 +1020,249 @@ bool spsps_peek_str(Parser parser, SPSPS_CHAR * next);
  */
 bool spsps_peek_and_consume(Parser parser, char * next);
 
+/**
+ * Make a character class from the characters of a C string.
+ * @param members		The members of the class.  May be NULL (empty).
+ * @return				The new class.  Free it with spsps_class_free.
+ */
+CharClass spsps_class_new(const char * members);
+
+/**
+ * Make a character class from a range of character codes.  The range may
+ * include codes above 255, for a wide SPSPS_CHAR.
+ * @param low			The lowest code in the class.
+ * @param high			The highest code in the class.
+ * @return				The new class.  Free it with spsps_class_free.
+ */
+CharClass spsps_class_range(uint32_t low, uint32_t high);
+
+/**
+ * Make a character class holding the members of two others.  For instance,
+ * spsps_class_union(SPSPS_DIGIT, spsps_class_new("+-")).
+ * @param first			The first class.
+ * @param second		The second class.
+ * @return				The new class.  Free it with spsps_class_free.
+ */
+CharClass spsps_class_union(CharClass first, CharClass second);
+
+/**
+ * Free a character class.  The built-in classes are never freed, so it is
+ * safe to pass them here.
+ * @param cls			The class.
+ */
+void spsps_class_free(CharClass cls);
+
+/**
+ * Determine whether a character is in a class.
+ * @param cls			The class.
+ * @param ch			The character.
+ * @return				True iff the character is in the class.
+ */
+bool spsps_class_has(CharClass cls, SPSPS_CHAR ch);
+
+/**
+ * Determine whether the next character is in a class, without consuming it.
+ * @param parser		The parser.
+ * @param cls			The class.
+ * @return				True iff the next character is in the class.  At
+ * 						the end of file this is false.
+ */
+bool spsps_peek_class(Parser parser, CharClass cls);
+
+/**
+ * Consume and discard all characters that are in a class.  This is like
+ * spsps_consume_while, but the class is built once rather than on each call.
+ * @param parser		The parser.
+ * @param cls			The class.
+ * @return				The number of characters consumed.
+ */
+size_t spsps_consume_class(Parser parser, CharClass cls);
+
+/**
+ * Consume characters that are in a class, copying them into a buffer, until
+ * a character not in the class is found or max characters have been taken.
+ * @param parser		The parser.
+ * @param cls			The class.
+ * @param buf			The buffer, which must hold at least max characters.
+ * @param max			The most characters to take.
+ * @return				The number of characters taken.
+ */
+size_t spsps_take_class(Parser parser, CharClass cls, SPSPS_CHAR * buf,
+		size_t max);
+
+/**
+ * Treat the input as UTF-8 from here on.  Input is validated as it is read,
+ * a block at a time, and columns count code points rather than bytes.
+ * Offsets are still in bytes.  This is only available when SPSPS_CHAR is a
+ * single byte.
+ * @param parser		The parser.
+ * @param utf8			Whether the input is UTF-8.
+ * @return				True if the mode was set, and false if SPSPS_CHAR is
+ * 						not a single byte.
+ */
+bool spsps_set_utf8(Parser parser, bool utf8);
+
+/**
+ * Get the offset of the first invalid UTF-8 validated so far.  Input is
+ * validated as it is read into the parser, so this can report an error in
+ * lookahead that has not been consumed yet.
+ * @param parser		The parser.
+ * @return				The offset, or UINT64_MAX if all input seen so far is
+ * 						valid.
+ */
+uint64_t spsps_utf8_error(Parser parser);
+
+/**
+ * Peek at the next code point, decoding as much lookahead as it needs.  If
+ * the input there is not valid UTF-8 then the errno is set to INVALID_UTF8
+ * and U+FFFD is returned.
+ * @param parser		The parser.
+ * @return				The next code point, or SPSPS_EOF_CP at the end of
+ * 						file.
+ */
+int32_t spsps_peek_cp(Parser parser);
+
+/**
+ * Consume the next code point.  If the input is not valid UTF-8 then a single
+ * character is consumed, the errno is set to INVALID_UTF8, and U+FFFD is
+ * returned, so that parsing can carry on past the damage.
+ * @param parser		The parser.
+ * @return				The code point consumed, or SPSPS_EOF_CP at the end
+ * 						of file.
+ */
+int32_t spsps_consume_cp(Parser parser);
+
+/**
+ * Parse an unsigned decimal integer.  The digits are converted eight at a
+ * time where the machine allows, straight from the parser's buffer.  If the
+ * value does not fit, all the digits are still consumed, the value is
+ * UINT64_MAX, and the errno is set to NUMBER_OUT_OF_RANGE.  A number
+ * longer than the parser's max_lookahead is not parsed at all: nothing is
+ * consumed, false is returned, and the errno is set to LOOKAHEAD_TOO_LARGE.
+ * This holds for all of the number functions.
+ * @param parser		The parser.
+ * @param value			Set to the value.
+ * @return				True if a number was parsed, and false (with nothing
+ * 						consumed) if the next character is not a digit.
+ */
+bool spsps_parse_uint64(Parser parser, uint64_t * value);
+
+/**
+ * Parse a decimal integer with an optional minus sign.  This is otherwise
+ * spsps_parse_uint64, and a value that does not fit is INT64_MIN or
+ * INT64_MAX.
+ * @param parser		The parser.
+ * @param value			Set to the value.
+ * @return				True if a number was parsed.
+ */
+bool spsps_parse_int64(Parser parser, int64_t * value);
+
+/**
+ * Parse hexadecimal digits, in either case, with no prefix.  This is
+ * otherwise spsps_parse_uint64.
+ * @param parser		The parser.
+ * @param value			Set to the value.
+ * @return				True if a number was parsed.
+ */
+bool spsps_parse_hex(Parser parser, uint64_t * value);
+
+/**
+ * Parse a decimal floating point number: an optional minus sign, digits,
+ * an optional fraction, and an optional exponent, as in JSON.  A dot or an
+ * exponent marker that is not followed by digits is left unconsumed.  The
+ * result is correctly rounded.  Most numbers are converted with one
+ * multiply or divide: that takes significant digits that fit in 53 bits (up
+ * to 2^53, so 15 digits always and 16 digits usually) and a small exponent.
+ * Anything else goes to strtod, which is run in the "C" locale, so the
+ * decimal point is always a dot whatever the program's LC_NUMERIC (except
+ * on platforms without POSIX uselocale, where strtod uses LC_NUMERIC).  If
+ * the value overflows or underflows the errno is set to
+ * NUMBER_OUT_OF_RANGE.  If the memory for a very long number cannot be
+ * allocated, no number is parsed.
+ * @param parser		The parser.
+ * @param value			Set to the value.
+ * @return				True if a number was parsed.
+ */
+bool spsps_parse_double(Parser parser, double * value);
+
+/**
+ * Convert the floating point number at the start of some characters, as
+ * spsps_parse_double does.  This is for text that has already been matched,
+ * such as the text given to a generated parser's event.
+ * @param text			The characters.
+ * @param length		The number of characters.
+ * @param value			Set to the value.
+ * @return				The number of characters used, or zero if the text
+ * 						does not start with a number.
+ */
+size_t spsps_scan_double(const SPSPS_CHAR * text, size_t length,
+		double * value);
+
+/**
+ * Compile a list of keywords into a matcher.  The matcher is a trie, and is
+ * never changed once it is built, so it can be shared.  The keywords are
+ * copied, so the list is not needed after this call.
+ * @param list			The keywords, terminated by a NULL.
+ * @return				The matcher.  Free it with spsps_keywords_free.
+ */
+Keywords spsps_keywords_compile(char ** list);
+
+/**
+ * Free a matcher made by spsps_keywords_compile.
+ * @param keywords		The matcher.
+ */
+void spsps_keywords_free(Keywords keywords);
+
+/**
+ * Find which keyword, if any, comes next in the stream.  This takes a single
+ * pass over the lookahead, where a chain of spsps_peek_and_consume calls
+ * would start over for each keyword.  If more than one keyword matches, the
+ * longest wins, so "<=" is preferred to "<".  Note that a keyword can match
+ * the start of a longer word; check what follows if that matters.
+ * @param parser		The parser.
+ * @param keywords		The matcher.
+ * @param consume		Whether to consume the keyword matched.
+ * @return				The index of the keyword in the list given to
+ * 						spsps_keywords_compile, or -1 if none matches.
+ */
+int spsps_match_keyword(Parser parser, Keywords keywords, bool consume);
+
+/**
+ * Compile a description of what to skip between tokens.  Line comments run
+ * from an introducer up to, but not including, the next newline; block
+ * comments run from an opening delimiter through the matching closing
+ * delimiter, and do not nest.  Where one delimiter is a prefix of another,
+ * the longer is tried first.  Everything is copied, so the arguments are not
+ * needed after this call, and the result is never changed, so it can be
+ * shared.
+ * @param space			The whitespace, or NULL for the whitespace skipped by
+ * 						spsps_consume_whitespace.
+ * @param line			The line comment introducers, such as "#" or "//",
+ * 						terminated by a NULL.  May be NULL for none.
+ * @param block			The block comment delimiters in pairs, opening then
+ * 						closing, such as "/\*" and "*\/", terminated by a
+ * 						NULL.  May be NULL for none.
+ * @return				The skip set.  Free it with spsps_skip_free.
+ */
+SkipSet spsps_skip_compile(CharClass space, char ** line, char ** block);
+
+/**
+ * Free a skip set made by spsps_skip_compile.
+ * @param skip			The skip set.
+ */
+void spsps_skip_free(SkipSet skip);
+
+/**
+ * Consume whitespace and comments, as described by a skip set, up to the next
+ * character that is neither.  Runs of whitespace and the bodies of comments
+ * are consumed in bulk, as the class scanners do, so only the characters
+ * that might start a comment are looked at one at a time.  If a block
+ * comment runs to the end of the input, it is consumed and the errno is set
+ * to UNTERMINATED_COMMENT.
+ * @param parser		The parser.
+ * @param skip			The skip set.
+ * @return				The number of characters consumed.
+ */
+size_t spsps_skip(Parser parser, SkipSet skip);
+
 #endif /* SPSPS_PARSER_H_ */
@@ -0,0 +1,161 @@
+#ifndef SPSPS_PARSER_INLINE_H_
+#define SPSPS_PARSER_INLINE_H_
+
+/**
+ * @file
+ * Inline versions of the most frequent parser calls, for grammars whose time
+ * goes into peeking and consuming one character at a time.
+ *
+ * The functions here read the parser's cursor straight out of the parser, so
+ * a character that is already buffered costs a compare and a load instead of
+ * a call into the library.  Only when the buffered characters run out do they
+ * call the ordinary functions, which read more of the input.  Including this
+ * header is optional; Parser stays opaque to code that does not, and the
+ * library's interface is the same either way.
+ *
+ * The fast paths leave the errno alone, but otherwise behave as the
+ * functions they stand in for: peeks count toward stall detection, and
+ * consumes reset it.  When SPSPS_STATS is defined the functions always call
+ * the library, so that the performance counters see every call; compile
+ * with the same SPSPS_STATS setting as the library, or the counters will
+ * miss the calls served inline.
+ *
+ * @verbatim
+ * SPSPS
+ * Stacy's Pathetically Simple Parsing System
+ * https://github.com/sprowell/spsps
+ *
+ * Copyright (c) 2014, Stacy Prowell
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * @endverbatim
+ */
+
+#include "parser.h"
+
+/// How many times a parser may peek without consuming before it is taken to
+/// be stalled.
+#define SPSPS_STALL_LOOKS (1000)
+
+/**
+ * The start of every parser, laid out so that the functions below can find
+ * the buffered characters.  This is not part of the stable interface: only
+ * use it through these functions, and never write to it.
+ */
+typedef struct spsps_cursor_ {
+	/// The buffered characters.
+	const SPSPS_CHAR * buf;
+	/// The index in buf of the next character.
+	size_t next;
+	/// The number of characters in buf.
+	size_t limit;
+	/// How many times the parser has peeked without consuming.
+	uint16_t look_count;
+} spsps_cursor;
+
+/**
+ * Get the cursor at the start of a parser.
+ * @param m_parser		The parser.
+ */
+#define SPSPS_CURSOR_(m_parser) ((spsps_cursor *) (void *) (m_parser))
+
+/**
+ * Peek at the next character, as spsps_peek does.
+ * @param parser		The parser.
+ * @return				The next character, or SPSPS_EOF.
+ */
+static inline SPSPS_CHAR
+spsps_peek_inline(Parser parser) {
+	// Nothing is allocated or deallocated by this method.
+#ifndef SPSPS_STATS
+	// Leave the last look before a stall to the library, which reports it.
+	spsps_cursor * cursor = SPSPS_CURSOR_(parser);
+	if (cursor->next < cursor->limit &&
+			cursor->look_count < SPSPS_STALL_LOOKS) {
+		cursor->look_count++;
+		return cursor->buf[cursor->next];
+	}
+#endif
+	return spsps_peek(parser);
+}
+
+/**
+ * Consume the next character and return it, as spsps_consume does.
+ * @param parser		The parser.
+ * @return				The character consumed, or SPSPS_EOF.
+ */
+static inline SPSPS_CHAR
+spsps_consume_inline(Parser parser) {
+	// Nothing is allocated or deallocated by this method.
+#ifndef SPSPS_STATS
+	spsps_cursor * cursor = SPSPS_CURSOR_(parser);
+	if (cursor->next < cursor->limit) {
+		cursor->look_count = 0;
+		return cursor->buf[cursor->next++];
+	}
+#endif
+	return spsps_consume(parser);
+}
+
+/**
+ * Consume the next n characters, as spsps_consume_n does.
+ * @param parser		The parser.
+ * @param n				The number of characters to consume.
+ */
+static inline void
+spsps_consume_n_inline(Parser parser, size_t n) {
+	// The window may be allocated or grown by this method.
+#ifndef SPSPS_STATS
+	spsps_cursor * cursor = SPSPS_CURSOR_(parser);
+	if (n < cursor->limit - cursor->next) {
+		cursor->look_count = 0;
+		cursor->next += n;
+		return;
+	}
+#endif
+	spsps_consume_n(parser, n);
+}
+
+/**
+ * Expose the buffered characters starting at the next character, as
+ * spsps_window does.
+ * @param parser		The parser.
+ * @param need			The number of characters wanted.
+ * @param available		Set to the number of characters available.
+ * @return				The next characters, or NULL if none are buffered.
+ */
+static inline const SPSPS_CHAR *
+spsps_window_inline(Parser parser, size_t need, size_t * available) {
+	// Nothing is allocated or deallocated by this method.
+#ifndef SPSPS_STATS
+	spsps_cursor * cursor = SPSPS_CURSOR_(parser);
+	if (need <= cursor->limit - cursor->next && cursor->buf != NULL) {
+		*available = cursor->limit - cursor->next;
+		return cursor->buf + cursor->next;
+	}
+#endif
+	return spsps_window(parser, need, available);
+}
+
+#endif /* SPSPS_PARSER_INLINE_H_ */
@@ -5,6 +5,10 @@
  * @file
  * Public interface to the simple immutable string.
  *
+ * Thread safety: an xstring is never changed once made, so one may be read
+ * by any number of threads at once, as long as none of them frees it.  An
+ * mstring is not locked; each must be used by one thread at a time.
+ *
  * @verbatim
  * SPSPS
  * Stacy's Pathetically Simple Parsing System
@@ -161,6 +165,31 @@ xstring xstr_wrap(char * value);
  */
 xstring xstr_wrap_f(char * value);
 
+/**
+ * Copy an array of characters into an xstring.  The array need not be
+ * null-terminated, and may contain null characters.  The input is not
+ * needed subsequent to this call.
+ * O(length) because the characters must be copied, but this is a single
+ * copy.
+ * @param value			The characters.
+ * @param length		The number of characters.
+ * @return				The new immutable string.
+ */
+xstring xstr_wrap_n(const xchar * value, size_t length);
+
+/**
+ * Make an xstring that borrows an array of characters, without copying
+ * them.  The array must outlive the returned string, and must not change
+ * while the string is in use; freeing the string does not free the array.
+ * This is meant for spans of a parser's buffer (see spsps_slice) that are
+ * held by a mark, and for other long-lived buffers.
+ * O(1).
+ * @param value			The characters.
+ * @param length		The number of characters.
+ * @return				The new immutable string.
+ */
+xstring xstr_borrow(const xchar * value, size_t length);
+
 /**
  * Convert a C null-terminated string into an mstring.  The input
  * C string is converted to the proper characters and is not needed
@@ -397,6 +426,16 @@ xstring xstr_concat_f(xstring first, xstring second);
  */
 xchar xstr_char(xstring value, size_t index);
 
+/**
+ * Obtain a pointer to the characters of the given string.  The
+ * characters are not null-terminated; use xstr_length to find out
+ * how many there are.  The pointer belongs to the string and is valid
+ * until the string is freed.  The empty string yields NULL.  O(1).
+ * @param value			The string.
+ * @return				The characters of the string.
+ */
+const xchar * xstr_data(xstring value);
+
 /**
  * Obtain a character from the given string.  If the index is out
  * of range of the string, then the null character is returned (0).
@@ -0,0 +1,215 @@
+/*
+ * @file
+ * Tests for the batch driver.
+ *
+ * @verbatim
+ * SPSPS
+ * Stacy's Pathetically Simple Parsing System
+ * https://github.com/sprowell/spsps
+ *
+ * Copyright (c) 2014, Stacy Prowell
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * @endverbatim
+ */
+
+#include "batch.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/** Error count. */
+int error_count = 0;
+
+/**
+ * Generate an error message.  The first argument is a format string, and
+ * any remaining arguments are the arguments to the format string.
+ */
+#define ERR(...) { \
+	fprintf(stderr, "ERROR: " __VA_ARGS__); \
+	fputc('\n', stderr); \
+	++error_count; \
+}
+
+/// The number of files in the batch, one of which does not exist.
+#define FILES 6
+
+/// The file that does not exist.
+#define MISSING 4
+
+/// The file that is large enough to split.
+#define LARGE 2
+
+/**
+ * What the results add up to for each file.
+ */
+typedef struct totals_ {
+	/// Guards the rest.
+	pthread_mutex_t lock;
+	/// The sum of the numbers in each file.
+	uint64_t sums[FILES];
+	/// The number of results for each file.
+	size_t results[FILES];
+	/// The number of pieces reported for each file.
+	size_t pieces[FILES];
+	/// The number of files reported as not opened.
+	size_t missing;
+} totals;
+
+/**
+ * A rule that adds up the numbers in its input, one per line.
+ * @param parser			The parser.
+ * @param context			Ignored.
+ * @return					The sum, allocated.
+ */
+static void *
+sum_rule(Parser parser, void * context) {
+	uint64_t * sum = (uint64_t *) malloc(sizeof(uint64_t));
+	*sum = 0;
+	while (true) {
+		spsps_consume_whitespace(parser);
+		if (spsps_peek(parser) == SPSPS_EOF) break;
+		char digits[24];
+		size_t count = spsps_take_class(parser, SPSPS_DIGIT, digits, 23);
+		if (count == 0) {
+			SPSPS_ERR(parser, "Expected a number.");
+			break;
+		}
+		digits[count] = 0;
+		*sum += strtoull(digits, NULL, 10);
+	} // Add up the lines.
+	return sum;
+}
+
+/**
+ * Collect a result.
+ * @param context			The totals.
+ * @param item				What the result is for.
+ * @param value				The sum.
+ */
+static void
+collect(void * context, const spsps_batch_item * item, void * value) {
+	totals * all = (totals *) context;
+	pthread_mutex_lock(&all->lock);
+	if (! item->opened) {
+		all->missing++;
+	} else {
+		all->sums[item->index] += *(uint64_t *) value;
+	}
+	all->pieces[item->index] = item->pieces;
+	all->results[item->index]++;
+	pthread_mutex_unlock(&all->lock);
+	free(value);
+}
+
+/**
+ * Split after a newline.
+ * @param context			Ignored.
+ * @param data				The characters.
+ * @param length			The number of characters.
+ * @param at				Where a split is wanted.
+ * @return					Where the next piece may start.
+ */
+static size_t
+split_lines(void * context, const SPSPS_CHAR * data, size_t length,
+		size_t at) {
+	const char * newline = (const char *) memchr(data + at, '\n', length - at);
+	return (newline != NULL) ? (size_t) (newline - data) + 1 : length;
+}
+
+/**
+ * Run a batch and check the totals.
+ * @param paths				The files.
+ * @param expect			The sum expected for each file.
+ * @param options			The options.
+ */
+static void
+check_batch(char ** paths, uint64_t * expect, spsps_batch_options * options) {
+	totals all;
+	memset(&all, 0, sizeof(all));
+	pthread_mutex_init(&all.lock, NULL);
+	size_t failed = spsps_parse_batch_ex(paths, FILES, sum_rule, collect, &all,
+			options);
+	if (failed != 1 || all.missing != 1 || all.results[MISSING] != 1 ||
+			all.pieces[MISSING] != 1) {
+		ERR("With %lu threads, %lu files failed rather than one.",
+				options->threads, failed);
+	}
+	for (size_t index = 0; index < FILES; ++index) {
+		if (index == MISSING) continue;
+		if (all.sums[index] != expect[index] ||
+				all.results[index] != all.pieces[index]) {
+			ERR("With %lu threads, file %lu added up to %lu in %lu results.",
+					options->threads, index, (unsigned long) all.sums[index],
+					all.results[index]);
+		}
+	} // Check each file.
+	size_t pieces = options->split != NULL ? 10 : 1;
+	if (all.pieces[LARGE] < pieces) {
+		ERR("With %lu threads, the large file was parsed in %lu pieces.",
+				options->threads, all.pieces[LARGE]);
+	}
+	pthread_mutex_destroy(&all.lock);
+}
+
+int main(int argc, char * argv[]) {
+	error_count = 0;
+	char * paths[FILES];
+	uint64_t expect[FILES];
+	for (size_t index = 0; index < FILES; ++index) {
+		paths[index] = (char *) malloc(32);
+		snprintf(paths[index], 32, "batch_test_%lu.tmp", index);
+		expect[index] = 0;
+		if (index == MISSING) continue;
+		FILE * out = fopen(paths[index], "wb");
+		size_t lines = (index == LARGE) ? 20000 : index * 10;
+		for (size_t line = 0; line < lines; ++line) {
+			fprintf(out, "%lu\n", line * (index + 1));
+			expect[index] += line * (index + 1);
+		} // Write the lines.
+		fclose(out);
+	} // Write the files.
+
+	spsps_batch_options options = { 0 };
+	size_t threads[] = { 1, 3, 8 };
+	for (size_t which = 0; which < 3; ++which) {
+		options.threads = threads[which];
+		options.split = NULL;
+		check_batch(paths, expect, &options);
+		options.split = split_lines;
+		options.piece = 10000;
+		check_batch(paths, expect, &options);
+	} // Try each number of threads.
+
+	for (size_t index = 0; index < FILES; ++index) {
+		remove(paths[index]);
+		free(paths[index]);
+	} // Remove the files.
+	if (error_count > 0) {
+		fprintf(stderr, "%d errors.\n", error_count);
+		return 1;
+	}
+	return 0;
+}
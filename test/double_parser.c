@@ -1,23 +1,26 @@
 #include <math.h>
-#include <ctype.h>
 #include <string.h>
 #include <stdio.h>
 #include <parser.h>
 
 int
 parse_digits(Parser parser, int* count) {
+    SPSPS_CHAR buf[32];
+    size_t taken;
+    int value = 0;
     *count = 0;
-    if (! isdigit(spsps_peek(parser))) {
+    do {
+        taken = spsps_take_class(parser, SPSPS_DIGIT, buf, 32);
+        for (size_t index = 0; index < taken; ++index) {
+            value *= 10;
+            value += buf[index] - '0';
+        }
+        *count += (int) taken;
+    } while (taken == 32);
+    if (*count == 0) {
         SPSPS_ERR(parser, "Expected to find a digit, but instead found %s.",
                   spsps_printchar(spsps_peek(parser)));
-        return 0;
     }
-    int value = 0;
-    do {
-        value *= 10;
-        value += spsps_consume(parser) - '0';
-        *count += 1;
-    } while (isdigit(spsps_peek(parser)));
     return value;
 }
 
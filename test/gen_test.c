@@ -0,0 +1,546 @@
+/**
+ * @file
+ * Test the parsers generated by spsps_gen against the hand-written ones.
+ *
+ * @verbatim
+ * SPSPS
+ * Stacy's Pathetically Simple Parsing System
+ * https://github.com/sprowell/spsps
+ *
+ * Copyright (c) 2014, Stacy Prowell
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * @endverbatim
+ *
+ * Run with no arguments to test.  Run as "gen_test bench [rounds]" to time
+ * the generated parsers against the hand-written ones.
+ */
+
+#include <json.h>
+#include "json_gen.h"
+#include "number_gen.h"
+#include "backtrack_gen.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+/** Error count. */
+int error_count = 0;
+
+/**
+ * Generate an error message.  The first argument is a format string, and
+ * any remaining arguments are the arguments to the format string.
+ */
+#define ERR(...) { \
+	fprintf(stderr, "ERROR: " __VA_ARGS__); \
+	fputc('\n', stderr); \
+	++error_count; \
+}
+
+//======================================================================
+// Building JSON values from the generated parser's events.
+//======================================================================
+
+/// An entry on the builder's stack: a finished value and its key, or (with
+/// a NULL value) the start of an open object or array.
+typedef struct entry_ {
+	json_value * value;
+	char * key;
+} entry;
+
+/// The state of a builder.
+typedef struct builder_ {
+	entry * stack;			///< Values waiting for their container.
+	size_t depth;			///< The number of entries on the stack.
+	size_t capacity;		///< The capacity of the stack.
+	size_t * opens;			///< Stack positions of the open containers.
+	size_t open_count;		///< The number of open containers.
+	size_t open_capacity;	///< The capacity of the open stack.
+	char * key;				///< The key of the next member, if any.
+} builder;
+
+static void
+push_(builder * build, json_value * value) {
+	if (build->depth == build->capacity) {
+		build->capacity = build->capacity == 0 ? 64 : build->capacity * 2;
+		build->stack = (entry *) realloc(build->stack,
+				sizeof(entry) * build->capacity);
+	}
+	build->stack[build->depth].value = value;
+	build->stack[build->depth].key = build->key;
+	build->key = NULL;
+	++build->depth;
+}
+
+static void
+open_(builder * build) {
+	if (build->open_count == build->open_capacity) {
+		build->open_capacity = build->open_capacity == 0 ? 16 :
+				build->open_capacity * 2;
+		build->opens = (size_t *) realloc(build->opens,
+				sizeof(size_t) * build->open_capacity);
+	}
+	build->opens[build->open_count++] = build->depth;
+	push_(build, NULL);
+}
+
+/**
+ * Undo the escapes in a quoted string the way c/json.c does.
+ * @param text				The string, with its quotation marks.
+ * @param length			The length of the text.
+ * @return					The string, which the caller owns.
+ */
+static char *
+unescape_(const SPSPS_CHAR * text, size_t length) {
+	char * str = (char *) malloc(length);
+	size_t out = 0;
+	for (size_t index = 1; index + 1 < length; ++index) {
+		char ch = text[index];
+		if (ch != '\\') {
+			str[out++] = ch;
+			continue;
+		}
+		ch = text[++index];
+		switch (ch) {
+		case 'n':
+			str[out++] = '\n';
+			break;
+		case 'r':
+			str[out++] = '\r';
+			break;
+		case 't':
+			str[out++] = '\t';
+			break;
+		case '\r':
+			if (text[index + 1] == '\n') ++index;
+			break;
+		case '\n':
+			break;
+		case 'x':
+			if (index + 3 >= length) break;
+			str[out++] = (char) strtol((char[]) { text[index + 1],
+					text[index + 2], 0 }, NULL, 16);
+			index += 2;
+			break;
+		default:
+			str[out++] = ch;
+			break;
+		}
+	} // Copy the characters.
+	str[out] = 0;
+	return str;
+}
+
+void
+json_on_key(void * context, const SPSPS_CHAR * text, size_t length) {
+	((builder *) context)->key = unescape_(text, length);
+}
+
+void
+json_on_string(void * context, const SPSPS_CHAR * text, size_t length) {
+	push_((builder *) context, json_new_string(unescape_(text, length)));
+}
+
+void
+json_on_number(void * context, const SPSPS_CHAR * text, size_t length) {
+	char buf[64];
+	if (length >= sizeof(buf)) length = sizeof(buf) - 1;
+	memcpy(buf, text, length);
+	buf[length] = 0;
+	push_((builder *) context, json_new_number(strtod(buf, NULL)));
+}
+
+void
+json_on_true(void * context, const SPSPS_CHAR * text, size_t length) {
+	push_((builder *) context, json_new_boolean(true));
+}
+
+void
+json_on_false(void * context, const SPSPS_CHAR * text, size_t length) {
+	push_((builder *) context, json_new_boolean(false));
+}
+
+void
+json_on_null(void * context, const SPSPS_CHAR * text, size_t length) {
+	push_((builder *) context, json_new_null());
+}
+
+void
+json_on_begin_object(void * context, const SPSPS_CHAR * text,
+		size_t length) {
+	open_((builder *) context);
+}
+
+void
+json_on_end_object(void * context, const SPSPS_CHAR * text, size_t length) {
+	builder * build = (builder *) context;
+	size_t start = build->opens[--build->open_count];
+	json_object * object = NULL;
+	for (size_t index = start + 1; index < build->depth; ++index) {
+		object = json_object_insert(object, build->stack[index].key,
+				build->stack[index].value);
+	} // Insert the members.
+	json_value * value = (json_value *) malloc(sizeof(json_value));
+	value->kind = OBJECT;
+	value->content.objectvalue = object;
+	build->depth = start + 1;
+	build->stack[start].value = value;
+}
+
+void
+json_on_begin_array(void * context, const SPSPS_CHAR * text, size_t length) {
+	open_((builder *) context);
+}
+
+void
+json_on_end_array(void * context, const SPSPS_CHAR * text, size_t length) {
+	builder * build = (builder *) context;
+	size_t start = build->opens[--build->open_count];
+	json_value * value = json_new_array(build->depth - start - 1);
+	for (size_t index = start + 1; index < build->depth; ++index) {
+		json_set_array_element(value, index - start - 1,
+				build->stack[index].value);
+	} // Fill the array.
+	build->depth = start + 1;
+	build->stack[start].value = value;
+}
+
+/**
+ * Parse a document with the generated parser.
+ * @param parser			The parser.
+ * @return					The value, or NULL if the parse failed.
+ */
+static json_value *
+generated_parse_(Parser parser) {
+	builder build;
+	memset(&build, 0, sizeof(build));
+	json_value * result = NULL;
+	if (json_parse(parser, &build) && build.depth == 1) {
+		result = build.stack[0].value;
+		build.depth = 0;
+	}
+	for (size_t index = 0; index < build.depth; ++index) {
+		if (build.stack[index].value != NULL) {
+			json_free_value(build.stack[index].value);
+		}
+		free(build.stack[index].key);
+	} // Discard a partial parse.
+	free(build.key);
+	free(build.stack);
+	free(build.opens);
+	return result;
+}
+
+//======================================================================
+// Numbers.
+//======================================================================
+
+/// The numbers collected by the number grammar's event.
+typedef struct numbers_ {
+	double values[64];
+	size_t count;
+	double sum;
+} numbers;
+
+void
+number_on_double(void * context, const SPSPS_CHAR * text, size_t length) {
+	numbers * list = (numbers *) context;
+	double value;
+	spsps_scan_double(text, length, &value);
+	if (list->count < 64) list->values[list->count] = value;
+	++list->count;
+	list->sum += value;
+}
+
+//======================================================================
+// Tests.
+//======================================================================
+
+/**
+ * Write a value the way json_stream does, and return the text.
+ * @param value				The value.
+ * @return					The text, which the caller frees.
+ */
+static char *
+render_(json_value * value) {
+	FILE * stream = tmpfile();
+	json_stream(stream, value, 0);
+	long length = ftell(stream);
+	rewind(stream);
+	char * text = (char *) malloc((size_t) length + 1);
+	size_t got = fread(text, 1, (size_t) length, stream);
+	text[got] = 0;
+	fclose(stream);
+	return text;
+}
+
+/**
+ * Parse the same text with both JSON parsers and compare the values.
+ */
+static void
+check_json_(const char * text) {
+	Parser parser = spsps_new_buffer("hand", text, strlen(text));
+	json_value * hand = json_parse_value(parser);
+	spsps_free(parser);
+	parser = spsps_new_buffer("generated", text, strlen(text));
+	json_value * generated = generated_parse_(parser);
+	spsps_free(parser);
+	if (hand == NULL || generated == NULL) {
+		ERR("Parse failed (hand %p, generated %p): %s", (void *) hand,
+				(void *) generated, text);
+	} else {
+		char * expect = render_(hand);
+		char * got = render_(generated);
+		if (strcmp(expect, got) != 0) {
+			ERR("Parsers disagree on %s:\n%s\nversus\n%s", text, expect, got);
+		}
+		free(expect);
+		free(got);
+	}
+	if (hand != NULL) json_free_value(hand);
+	if (generated != NULL) json_free_value(generated);
+}
+
+static void
+reject_json_(const char * text) {
+	Parser parser = spsps_new_buffer("bad", text, strlen(text));
+	json_value * value = generated_parse_(parser);
+	if (value != NULL) {
+		ERR("Generated parser accepted: %s", text);
+		json_free_value(value);
+	}
+	spsps_free(parser);
+}
+
+/**
+ * Build a document of the given number of records.
+ */
+static char *
+build_document_(int records, size_t * length) {
+	size_t capacity = (size_t) records * 256 + 16;
+	char * document = (char *) malloc(capacity);
+	size_t len = 0;
+	len += (size_t) snprintf(document + len, capacity - len, "[\n");
+	for (int index = 0; index < records; ++index) {
+		len += (size_t) snprintf(document + len, capacity - len,
+				"  {\"id\": %d, \"name\": \"record \\\"%d\\\"\", "
+				"\"score\": %d.%03d, \"ratio\": %de-3, \"active\": %s, "
+				"\"tags\": [\"alpha\", \"beta\", %d], \"owner\": null}%s\n",
+				index, index, index * 7, index % 1000, index,
+				(index % 2) ? "true" : "false", index % 17,
+				(index + 1 < records) ? "," : "");
+	} // Write the records.
+	len += (size_t) snprintf(document + len, capacity - len, "]\n");
+	*length = len;
+	return document;
+}
+
+static void
+json_test() {
+	check_json_("null");
+	check_json_("  true ");
+	check_json_("false");
+	check_json_("-12.5e2");
+	check_json_("\"plain\"");
+	check_json_("\"esc \\\"aped\\\" \\n\\t\\x41 \\q\"");
+	check_json_("[]");
+	check_json_("[ 1, [2, [3, []]], {} ]");
+	check_json_("{ \"a\" : 1, \"b\" = [true, false, null], \"c\": {\"d\": \"e\"} }");
+	check_json_("{\"trailing\": 1,}");
+	// A number that stops short is taken as far as it goes, as the
+	// hand-written parser does.
+	check_json_("1.");
+	size_t length;
+	char * document = build_document_(50, &length);
+	check_json_(document);
+	free(document);
+	reject_json_("");
+	reject_json_("[1, 2");
+	reject_json_("[1,]");
+	reject_json_("{\"a\" 1}");
+	reject_json_("{\"a\": 1 \"b\": 2}");
+	reject_json_("tru");
+	reject_json_("[1.]");
+	reject_json_("-");
+	reject_json_("\"open");
+}
+
+static void
+number_test() {
+	const char * text = "0 -1 3.25 6.02e23 1E-3 -0.5e+2 12345678901234";
+	double expect[] = { 0, -1, 3.25, 6.02e23, 1e-3, -0.5e+2,
+			12345678901234.0 };
+	numbers list;
+	memset(&list, 0, sizeof(list));
+	Parser parser = spsps_new_buffer("numbers", text, strlen(text));
+	if (! number_parse(parser, &list) ||
+			spsps_offset(parser) != strlen(text)) {
+		ERR("Number grammar failed on: %s", text);
+	}
+	spsps_free(parser);
+	if (list.count != 7) ERR("Expected 7 numbers but got %zu.", list.count);
+	for (size_t index = 0; index < 7 && index < list.count; ++index) {
+		if (list.values[index] != expect[index]) {
+			ERR("Number %zu: expected %g but got %g.", index, expect[index],
+					list.values[index]);
+		}
+	} // Check the numbers.
+	// A number that stops short is taken as far as it goes, and leaves the
+	// rest of the input, as spsps_parse_double does.
+	const char * shorts[] = { "1e", "1. 2", "1e 2", "1e+" };
+	for (size_t index = 0; index < 4; ++index) {
+		memset(&list, 0, sizeof(list));
+		parser = spsps_new_buffer("short", shorts[index],
+				strlen(shorts[index]));
+		if (! number_parse(parser, &list) || list.count != 1 ||
+				list.values[0] != 1.0 || spsps_offset(parser) != 1) {
+			ERR("Number grammar took %zu numbers from %s, stopping at %lu.",
+					list.count, shorts[index],
+					(unsigned long) spsps_offset(parser));
+		}
+		spsps_free(parser);
+	} // Check each short number.
+}
+
+/**
+ * Check that the backtrack grammar matches the text exactly, or rejects it
+ * and leaves the input where it was.
+ */
+static void
+check_backtrack_(const char * text, bool match) {
+	Parser parser = spsps_new_buffer("backtrack", text, strlen(text));
+	bool matched = backtrack_parse(parser, NULL);
+	uint64_t offset = spsps_offset(parser);
+	if (matched != match || offset != (match ? strlen(text) : 0)) {
+		ERR("Backtrack grammar %s %s, stopping at %lu.",
+				matched ? "matched" : "rejected", text, (unsigned long) offset);
+	}
+	spsps_free(parser);
+}
+
+static void
+backtrack_test() {
+	check_backtrack_("Sac", true);
+	check_backtrack_("Sabac", true);
+	check_backtrack_("Sababac", true);
+	check_backtrack_("Sabax", false);
+	check_backtrack_("Oac", true);
+	check_backtrack_("Oabac", true);
+	check_backtrack_("Oabab", false);
+	check_backtrack_("Qac", true);
+	check_backtrack_("Qababac", true);
+	check_backtrack_("Qaba", false);
+	check_backtrack_("Pabac", true);
+	check_backtrack_("Pac", false);
+	check_backtrack_("Rac", true);
+	check_backtrack_("Rababac", true);
+	check_backtrack_("Raba", false);
+}
+
+//======================================================================
+// Benchmark.
+//======================================================================
+
+static double
+seconds_() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double) now.tv_sec + (double) now.tv_nsec * 1e-9;
+}
+
+static void
+bench(long rounds) {
+	size_t length;
+	char * document = build_document_(2000, &length);
+	double start = seconds_();
+	for (long round = 0; round < rounds; ++round) {
+		Parser parser = spsps_new_buffer("hand", document, length);
+		json_free_value(json_parse_value(parser));
+		spsps_free(parser);
+	} // Parse with the hand-written parser.
+	double hand = seconds_() - start;
+	start = seconds_();
+	for (long round = 0; round < rounds; ++round) {
+		Parser parser = spsps_new_buffer("generated", document, length);
+		json_free_value(generated_parse_(parser));
+		spsps_free(parser);
+	} // Parse with the generated parser.
+	double generated = seconds_() - start;
+	double mb = (double) length * (double) rounds / 1e6;
+	printf("json    hand %8.1f MB/s  generated %8.1f MB/s\n", mb / hand,
+			mb / generated);
+	free(document);
+
+	// A long list of numbers.
+	size_t capacity = 200000 * 24;
+	document = (char *) malloc(capacity);
+	length = 0;
+	for (int index = 0; index < 200000; ++index) {
+		length += (size_t) snprintf(document + length, capacity - length,
+				"%d.%03de%d ", index * 31, index % 1000, index % 20);
+	} // Write the numbers.
+	double sum = 0.0;
+	start = seconds_();
+	for (long round = 0; round < rounds; ++round) {
+		Parser parser = spsps_new_buffer("hand", document, length);
+		double value;
+		while (spsps_parse_double(parser, &value)) {
+			sum += value;
+			spsps_consume_whitespace(parser);
+		} // Parse all the numbers.
+		spsps_free(parser);
+	} // Parse with the hand-written parser.
+	hand = seconds_() - start;
+	numbers list;
+	memset(&list, 0, sizeof(list));
+	start = seconds_();
+	for (long round = 0; round < rounds; ++round) {
+		Parser parser = spsps_new_buffer("generated", document, length);
+		number_parse(parser, &list);
+		spsps_free(parser);
+	} // Parse with the generated parser.
+	generated = seconds_() - start;
+	mb = (double) length * (double) rounds / 1e6;
+	printf("numbers hand %8.1f MB/s  generated %8.1f MB/s  (%g %g)\n",
+			mb / hand, mb / generated, sum, list.sum);
+	free(document);
+}
+
+int
+main(int argc, char * argv[]) {
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		bench(argc > 2 ? atol(argv[2]) : 20);
+		return 0;
+	}
+	json_test();
+	number_test();
+	backtrack_test();
+	if (error_count > 0) {
+		fprintf(stderr, "Failed with %d errors.\n", error_count);
+		return 1;
+	}
+	printf("All tests passed.\n");
+	return 0;
+}
@@ -0,0 +1,168 @@
+/**
+ * @file
+ * Measure how JSON parsing scales across threads.
+ *
+ * @verbatim
+ * SPSPS
+ * Stacy's Pathetically Simple Parsing System
+ * https://github.com/sprowell/spsps
+ *
+ * Copyright (c) 2014, Stacy Prowell
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * @endverbatim
+ */
+
+#include <json.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/// The number of records in the document parsed.
+#define RECORDS 500
+
+/// The document parsed by every thread.
+static char * document = NULL;
+
+/// The length of the document.
+static size_t document_length = 0;
+
+/**
+ * What each thread does, and whether it worked.
+ */
+typedef struct work_ {
+	/// The number of times to parse the document.
+	long rounds;
+	/// The number of parses that failed.
+	long failures;
+} work;
+
+/**
+ * Build the document: an array of records with strings, numbers, nested
+ * arrays, and escapes, roughly the mix seen in service traffic.
+ */
+static void
+build_document() {
+	size_t capacity = RECORDS * 256;
+	document = (char *) malloc(capacity);
+	size_t len = 0;
+	len += (size_t) snprintf(document + len, capacity - len, "[\n");
+	for (int index = 0; index < RECORDS; ++index) {
+		len += (size_t) snprintf(document + len, capacity - len,
+				"  {\"id\": %d, \"name\": \"record \\\"%d\\\"\", "
+				"\"score\": %d.%03d, \"ratio\": %de-3, \"active\": %s, "
+				"\"tags\": [\"alpha\", \"beta\", %d], \"owner\": null}%s\n",
+				index, index, index * 7, index % 1000, index,
+				(index % 2) ? "true" : "false", index % 17,
+				(index + 1 < RECORDS) ? "," : "");
+	} // Write the records.
+	len += (size_t) snprintf(document + len, capacity - len, "]\n");
+	document_length = len;
+}
+
+/**
+ * Parse the document repeatedly.
+ * @param arg				The work to do.
+ * @return					NULL.
+ */
+static void *
+parse_main(void * arg) {
+	work * job = (work *) arg;
+	for (long round = 0; round < job->rounds; ++round) {
+		Parser parser = spsps_acquire_buffer("bench", document,
+				document_length);
+		json_value * value = json_parse_value(parser);
+		if (value == NULL) job->failures++;
+		else json_free_value(value);
+		spsps_release(parser);
+	} // Parse the document.
+	spsps_pool_drain();
+	return NULL;
+}
+
+/**
+ * Read a monotonic clock.
+ * @return					The time, in seconds.
+ */
+static double
+now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/**
+ * Parse a document on 1, 2, 4, ... threads, each doing the same amount of
+ * work, and report the throughput and how it scales.  With perfect scaling
+ * the time stays flat as threads are added.
+ * @param argc				Number of arguments.
+ * @param argv				Arguments: the most threads (by default, the
+ * 							number of processors) and the parses per thread.
+ */
+int main(int argc, char * argv[]) {
+	long most = (argc > 1) ? atol(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+	long rounds = (argc > 2) ? atol(argv[2]) : 200;
+	if (most < 1) most = 1;
+	if (rounds < 1) rounds = 1;
+	build_document();
+	fprintf(stdout, "Document of %zu bytes, %ld parses per thread.\n",
+			document_length, rounds);
+	fprintf(stdout, "%8s %12s %12s %10s\n", "threads", "seconds", "MB/s",
+			"speedup");
+
+	pthread_t * threads = (pthread_t *) malloc(most * sizeof(pthread_t));
+	work * jobs = (work *) malloc(most * sizeof(work));
+	double single = 0.0;
+	int status = 0;
+	for (long count = 1; count <= most;
+			count = (count < most && count * 2 > most) ? most : count * 2) {
+		double start = now();
+		for (long index = 0; index < count; ++index) {
+			jobs[index].rounds = rounds;
+			jobs[index].failures = 0;
+			pthread_create(&threads[index], NULL, parse_main, &jobs[index]);
+		} // Start the threads.
+		long failures = 0;
+		for (long index = 0; index < count; ++index) {
+			pthread_join(threads[index], NULL);
+			failures += jobs[index].failures;
+		} // Wait for the threads.
+		double seconds = now() - start;
+		double bytes = (double) document_length * (double) rounds *
+				(double) count;
+		double rate = bytes / seconds / 1e6;
+		if (count == 1) single = rate;
+		fprintf(stdout, "%8ld %12.3f %12.1f %10.2f\n", count, seconds, rate,
+				rate / single);
+		if (failures > 0) {
+			fprintf(stderr, "ERROR: %ld parses failed.\n", failures);
+			status = 1;
+		}
+	} // Try each number of threads, ending with the most.
+	free(jobs);
+	free(threads);
+	free(document);
+	return status;
+}
@@ -42,19 +42,21 @@
  * @param argv				Arguments.
  */
 int main(int argc, char * argv[]) {
-	// If a first argument is provided, it is the file name.  If no first
-	// argument is provided, then read from standard in.
-	FILE * input = stdin;
+	// If a first argument is provided, it is the file name, and we map the
+	// file (a pipe is read instead).  If no first argument is provided, then
+	// read from standard in.
+	Parser parser = NULL;
 	if (argc > 1) {
-		input = fopen(argv[1], "rt");
-		if (input == NULL) {
+		parser = spsps_new_mmap(argv[1], argv[1]);
+		if (parser == NULL) {
 			fprintf(stderr, "ERROR: Unable to read from file %s.\n", argv[1]);
 			exit(1);
 		}
+	} else {
+		parser = spsps_new(NULL, stdin);
 	}
 
-	// Now we have to read from the stream.  We read and parse JSON.
-	Parser parser = spsps_new(argv[1], input);
+	// Now we read and parse JSON.
 	json_value * value = json_parse_value(parser);
 	if (value != NULL) {
 		// Print the value!
@@ -65,8 +67,5 @@ int main(int argc, char * argv[]) {
 	}
 	spsps_free(parser);
 	// Done.
-	if (argc > 1) {
-		fclose(input);
-	}
 	exit(0);
 }
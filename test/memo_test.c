@@ -0,0 +1,235 @@
+/*
+ * @file
+ * Tests for the packrat memo table.
+ *
+ * @verbatim
+ * SPSPS
+ * Stacy's Pathetically Simple Parsing System
+ * https://github.com/sprowell/spsps
+ *
+ * Copyright (c) 2014, Stacy Prowell
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * @endverbatim
+ */
+
+#include "memo.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/** Error count. */
+int error_count = 0;
+
+/**
+ * Generate an error message.  The first argument is a format string, and
+ * any remaining arguments are the arguments to the format string.
+ */
+#define ERR(...) { \
+	fprintf(stderr, "ERROR: " __VA_ARGS__); \
+	fputc('\n', stderr); \
+	++error_count; \
+}
+
+/// The rules of the little grammar used to test the table.
+enum { RULE_TERM, RULE_EXPR, RULE_COUNT };
+
+/// How many times the term rule has actually been parsed.
+static size_t term_parses = 0;
+
+/// How many values have been released.
+static size_t released = 0;
+
+/**
+ * Count a released value.
+ * @param value				The value.
+ */
+static void
+release(void * value) {
+	(void) value;
+	++released;
+}
+
+/**
+ * Parse a term, which is a run of digits.  Its value is one plus the number
+ * of digits, so that success is never NULL.
+ * @verbatim
+ * term = ( '0'..'9' )+
+ * @endverbatim
+ * @param memo				The memo table, or NULL.
+ * @param parser			The parser.
+ * @return					The value, or NULL if there is no term.
+ */
+static void *
+term(Memo memo, Parser parser) {
+	void * value;
+	if (memo != NULL && spsps_memo_lookup(memo, parser, RULE_TERM, &value)) {
+		return value;
+	}
+	++term_parses;
+	uint64_t start = spsps_offset(parser);
+	size_t count = spsps_consume_while(parser, "0123456789");
+	value = (count > 0) ? (void *) (uintptr_t) (count + 1) : NULL;
+	if (memo != NULL) {
+		spsps_memo_store(memo, RULE_TERM, start, spsps_offset(parser), value);
+	}
+	return value;
+}
+
+/**
+ * Parse an expression.  The first alternative is tried, and when it fails the
+ * parser backs up and tries the second, so without the memo table the last
+ * term is parsed twice.
+ * @verbatim
+ * expr = term '+' expr | term
+ * @endverbatim
+ * @param memo				The memo table, or NULL.
+ * @param parser			The parser.
+ * @return					The value, or NULL if there is no expression.
+ */
+static void *
+expr(Memo memo, Parser parser) {
+	Checkpoint checkpoint = spsps_checkpoint(parser);
+	if (term(memo, parser) != NULL && spsps_peek_and_consume(parser, "+")) {
+		void * value = expr(memo, parser);
+		if (value != NULL) {
+			spsps_commit(parser, checkpoint);
+			return value;
+		}
+	}
+	spsps_restore(parser, checkpoint);
+	return term(memo, parser);
+}
+
+/**
+ * Test memoizing a backtracking grammar.
+ */
+void
+grammar_test() {
+	char * text = "1+22+333+4444+55555";
+	Parser parser = spsps_new_buffer("grammar", text, strlen(text));
+	term_parses = 0;
+	expr(NULL, parser);
+	size_t plain = term_parses;
+	spsps_free(parser);
+
+	parser = spsps_new_buffer("grammar", text, strlen(text));
+	Memo memo = spsps_memo_new(RULE_COUNT, 0, NULL);
+	term_parses = 0;
+	if (expr(memo, parser) == NULL || spsps_peek(parser) != SPSPS_EOF) {
+		ERR("The grammar did not parse the whole text.");
+	}
+	if (term_parses != 5 || plain != 6) {
+		ERR("The term rule was parsed %lu times with the table and %lu "
+				"times without.", term_parses, plain);
+	}
+	spsps_memo_stats stats = spsps_memo_rule_stats(memo, RULE_TERM);
+	if (stats.hits != 1 || stats.stores != 5 || stats.misses != 5) {
+		ERR("The term rule has %lu hits, %lu misses, and %lu stores.",
+				(size_t) stats.hits, (size_t) stats.misses,
+				(size_t) stats.stores);
+	}
+	stats = spsps_memo_rule_stats(memo, RULE_COUNT);
+	if (stats.hits != 0 || stats.misses != 0) {
+		ERR("A rule out of range has counts.");
+	}
+	spsps_memo_free(memo);
+	spsps_free(parser);
+}
+
+/**
+ * Test growing the table, and evicting entries outside the window.
+ */
+void
+window_test() {
+	size_t len = 20000;
+	char * text = (char *) malloc(len + 1);
+	memset(text, 'a', len);
+	text[len] = 0;
+	Parser parser = spsps_new_buffer("window", text, len);
+	Checkpoint start = spsps_checkpoint(parser);
+
+	// With no window everything is kept.
+	Memo memo = spsps_memo_new(RULE_COUNT, 0, release);
+	released = 0;
+	for (size_t offset = 0; offset < len; offset += 2) {
+		spsps_memo_store(memo, offset % RULE_COUNT, offset, offset + 1,
+				(void *) text);
+	} // Store entries.
+	void * value = NULL;
+	for (size_t offset = 0; offset < len; offset += 2) {
+		spsps_restore(parser, start);
+		start = spsps_checkpoint(parser);
+		spsps_consume_n(parser, offset);
+		if (! spsps_memo_lookup(memo, parser, offset % RULE_COUNT, &value) ||
+				value != text || spsps_offset(parser) != offset + 1) {
+			ERR("The entry at %lu was lost.", offset);
+			break;
+		}
+	} // Look up entries.
+	spsps_memo_free(memo);
+	if (released != len / 2) {
+		ERR("Freeing the table released %lu of %lu values.", released,
+				len / 2);
+	}
+
+	// With a window, old entries go away.
+	memo = spsps_memo_new(RULE_COUNT, 100, release);
+	released = 0;
+	for (size_t offset = 0; offset < len; ++offset) {
+		spsps_memo_store(memo, RULE_TERM, offset, offset, NULL);
+	} // Store entries.
+	spsps_memo_stats stats = spsps_memo_rule_stats(memo, RULE_TERM);
+	if (stats.evictions == 0 || stats.evictions != released) {
+		ERR("The window evicted %lu entries and released %lu values.",
+				(size_t) stats.evictions, released);
+	}
+	spsps_restore(parser, start);
+	start = spsps_checkpoint(parser);
+	spsps_consume_n(parser, len - 50);
+	if (! spsps_memo_lookup(memo, parser, RULE_TERM, &value)) {
+		ERR("The window lost a recent entry.");
+	}
+	spsps_memo_clear(memo);
+	if (released != len) {
+		ERR("Clearing the table released %lu of %lu values.", released, len);
+	}
+	if (spsps_memo_lookup(memo, parser, RULE_TERM, &value)) {
+		ERR("Clearing the table left an entry.");
+	}
+	spsps_memo_free(memo);
+	spsps_commit(parser, start);
+	spsps_free(parser);
+	free(text);
+}
+
+int main(int argc, char * argv[]) {
+	grammar_test();
+	window_test();
+	if (error_count > 0) {
+		fprintf(stderr, "%d errors.\n", error_count);
+		return 1;
+	}
+	return 0;
+}
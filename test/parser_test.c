@@ -0,0 +1,1963 @@
+/*
+ * @file
+ * Tests for the parser primitives.
+ *
+ * @verbatim
+ * SPSPS
+ * Stacy's Pathetically Simple Parsing System
+ * https://github.com/sprowell/spsps
+ *
+ * Copyright (c) 2014, Stacy Prowell
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * @endverbatim
+ */
+
+#include "parser.h"
+#include "parser_inline.h"
+#include <ctype.h>
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#if defined(__unix__) || defined(__unix) || defined(__APPLE__)
+#  include <sys/uio.h>
+#  include <unistd.h>
+#  define HAVE_IOV
+#endif
+
+/** Error count. */
+int error_count = 0;
+
+/**
+ * Generate an error message.  The first argument is a format string, and
+ * any remaining arguments are the arguments to the format string.
+ */
+#define ERR(...) { \
+	fprintf(stderr, "ERROR: " __VA_ARGS__); \
+	fputc('\n', stderr); \
+	++error_count; \
+}
+
+/// A scratch file used by the tests that need a file on disk.
+#define SCRATCH "parser_test.tmp"
+
+/**
+ * Write a scratch file with the given content.
+ * @param content			The content of the file.
+ */
+static void
+write_scratch(char * content) {
+	FILE * out = fopen(SCRATCH, "wb");
+	if (out == NULL) {
+		ERR("Unable to write the scratch file %s.", SCRATCH);
+		return;
+	}
+	fwrite(content, 1, strlen(content), out);
+	fclose(out);
+}
+
+/**
+ * Parse the given text with the given parser and make sure the parser
+ * returns exactly those characters, followed by the end of file.
+ * @param parser			The parser.
+ * @param text				The expected text.
+ * @param what				What kind of parser this is, for messages.
+ */
+static void
+check_text(Parser parser, char * text, char * what) {
+	size_t len = strlen(text);
+	for (size_t index = 0; index < len; ++index) {
+		SPSPS_CHAR ch = spsps_consume(parser);
+		if (ch != text[index]) {
+			ERR("The %s parser returned %s at index %lu.", what,
+					spsps_printchar(ch), index);
+			return;
+		}
+	} // Check every character.
+	if (spsps_peek(parser) != SPSPS_EOF) {
+		ERR("The %s parser did not reach the end of file.", what);
+	}
+	spsps_consume(parser);
+	if (! spsps_eof(parser)) {
+		ERR("The %s parser did not report the end of file.", what);
+	}
+}
+
+/**
+ * Test the memory-mapped parser.
+ */
+void
+mmap_test() {
+	char * text = "{ \"name\" = \"value\" }\nsecond line";
+	write_scratch(text);
+	Parser parser = spsps_new_mmap(NULL, SCRATCH);
+	if (parser == NULL) {
+		ERR("Unable to map the scratch file.");
+		return;
+	}
+	if (! spsps_peek_str(parser, "{ \"name\"")) {
+		ERR("The mapped parser did not see the expected prefix.");
+	}
+	check_text(parser, text, "mapped");
+	Loc * loc = spsps_loc(parser);
+	if (loc->line != 2 || strcmp(loc->name, SCRATCH) != 0) {
+		ERR("The mapped parser ended at %s:%" PRIu64 ":%" PRIu64 ".",
+				loc->name, loc->line, loc->column);
+	}
+	free(loc);
+	spsps_free(parser);
+
+	// The empty file cannot actually be mapped, but must still work.
+	write_scratch("");
+	parser = spsps_new_mmap("empty", SCRATCH);
+	check_text(parser, "", "empty mapped");
+	spsps_free(parser);
+	remove(SCRATCH);
+
+	if (spsps_new_mmap(NULL, SCRATCH) != NULL) {
+		ERR("Mapping a missing file did not fail.");
+	}
+
+#ifdef HAVE_IOV
+	// A pipe cannot be mapped, so it must be read as a stream instead.
+	int fds[2];
+	if (pipe(fds) != 0) {
+		ERR("Unable to create a pipe.");
+		return;
+	}
+	if (write(fds[1], text, strlen(text)) != (ssize_t) strlen(text)) {
+		ERR("Unable to write to the pipe.");
+	}
+	close(fds[1]);
+	char path[64];
+	snprintf(path, sizeof(path), "/dev/fd/%d", fds[0]);
+	parser = spsps_new_mmap("pipe", path);
+	close(fds[0]);
+	if (parser == NULL) {
+		ERR("Unable to read the pipe through %s.", path);
+		return;
+	}
+	check_text(parser, text, "piped");
+	spsps_free(parser);
+#endif
+}
+
+/**
+ * Test the parsers over memory buffers and xstrings.
+ */
+void
+buffer_test() {
+	// The end of input comes from the length, so a 0xff byte and a null
+	// in the middle of the data are just characters.
+	char data[] = { 'a', 'b', (char) 0xff, 0, 'c', 'd' };
+	Parser parser = spsps_new_buffer("buffer", data, sizeof(data));
+	for (size_t index = 0; index < sizeof(data); ++index) {
+		if (spsps_eof(parser)) {
+			ERR("The buffer parser reached the end of file at index %lu.",
+					index);
+			break;
+		}
+		SPSPS_CHAR ch = spsps_consume(parser);
+		if (ch != data[index]) {
+			ERR("The buffer parser returned %s at index %lu.",
+					spsps_printchar(ch), index);
+		}
+	} // Check every character.
+	spsps_consume(parser);
+	if (! spsps_eof(parser)) {
+		ERR("The buffer parser did not report the end of file.");
+	}
+	spsps_free(parser);
+
+	parser = spsps_new_buffer("empty", NULL, 0);
+	check_text(parser, "", "empty buffer");
+	spsps_free(parser);
+
+	char * text = "[ 1, 2, 3 ]";
+	xstring str = xstr_wrap(text);
+	parser = spsps_new_xstring("xstring", str);
+	check_text(parser, text, "xstring");
+	spsps_free(parser);
+	xstr_free(str);
+}
+
+/**
+ * Check the bulk scanners against the obvious character-by-character
+ * implementation on the given parser, which must be reading the text.
+ * @param parser			The parser.
+ * @param text				The text.
+ * @param what				What kind of parser this is, for messages.
+ */
+static void
+check_scanners(Parser parser, char * text, char * what) {
+	size_t len = strlen(text);
+	size_t index = 0;
+	uint64_t line = 1, column = 1;
+	SPSPS_CHAR buf[8];
+	while (index < len) {
+		// Runs of digits are taken, runs of blanks are consumed, and runs
+		// of anything else are consumed up to the next digit or blank.
+		size_t expect = 0, count = 0;
+		if (strchr("0123456789", text[index]) != NULL) {
+			while (index + expect < len && expect < 8 &&
+					strchr("0123456789", text[index + expect]) != NULL)
+				++expect;
+			count = spsps_take_while(parser, "0123456789", buf, 8);
+			if (count == expect && strncmp(buf, text + index, count) != 0) {
+				ERR("The %s parser took the wrong digits at %lu.", what, index);
+			}
+		} else if (strchr(" \t\r\n", text[index]) != NULL) {
+			while (index + expect < len &&
+					strchr(" \t\r\n", text[index + expect]) != NULL)
+				++expect;
+			count = spsps_consume_while(parser, " \t\r\n");
+		} else {
+			while (index + expect < len &&
+					strchr("0123456789 \t\r\n", text[index + expect]) == NULL)
+				++expect;
+			count = spsps_consume_until(parser, "0123456789 \t\r\n");
+		}
+		if (count != expect) {
+			ERR("The %s parser scanned %lu characters at %lu, but there "
+					"were %lu.", what, count, index, expect);
+			return;
+		}
+		for (size_t last = index + count; index < last; ++index) {
+			++column;
+			if (text[index] == '\n') {
+				++line;
+				column = 1;
+			}
+		} // Track the location.
+		Loc * loc = spsps_loc(parser);
+		if (loc->line != line || loc->column != column ||
+				loc->offset != index || spsps_offset(parser) != index) {
+			ERR("The %s parser is at %" PRIu64 ":%" PRIu64 " after scanning, "
+					"but should be at %" PRIu64 ":%" PRIu64 ".", what,
+					loc->line, loc->column, line, column);
+			free(loc);
+			return;
+		}
+		free(loc);
+	} // Scan the whole text.
+	if (spsps_consume_while(parser, "\xff") != 0 ||
+			spsps_consume_until(parser, "x") != 0) {
+		ERR("The %s parser scanned past the end of file.", what);
+	}
+	check_text(parser, "", what);
+}
+
+/**
+ * Test the bulk scanners.
+ */
+void
+scanner_test() {
+	// Make some text with runs of every length, long enough to cross
+	// several blocks.
+	size_t len = 5 * SPSPS_LOOK;
+	char * text = (char *) malloc(len + 1);
+	char * pieces[] = { "0123456789", " \t\r\n", "abc{}[]" };
+	size_t index = 0, run = 0;
+	srand(1);
+	while (index < len) {
+		char * piece = pieces[run % 3];
+		size_t count = (size_t) (rand() % 70) + 1;
+		for (size_t here = 0; here < count && index < len; ++here) {
+			text[index++] = piece[rand() % strlen(piece)];
+		} // Write a run.
+		++run;
+	} // Build the text.
+	text[len] = 0;
+
+	Parser parser = spsps_new_buffer("buffer", text, len);
+	check_scanners(parser, text, "buffer");
+	spsps_free(parser);
+
+	write_scratch(text);
+	FILE * stream = fopen(SCRATCH, "rb");
+	parser = spsps_new(SCRATCH, stream);
+	check_scanners(parser, text, "stream");
+	spsps_free(parser);
+	fclose(stream);
+	remove(SCRATCH);
+	free(text);
+}
+
+/**
+ * Check marks and slices on the given parser, which must be reading the text.
+ * @param parser			The parser.
+ * @param text				The text.
+ * @param what				What kind of parser this is, for messages.
+ */
+static void
+check_marks(Parser parser, char * text, char * what) {
+	size_t len = strlen(text);
+	// Hold a mark on the whole text while taking slices of every size,
+	// including some that are longer than the lookahead.
+	Mark outer = spsps_mark(parser);
+	size_t sizes[] = { 0, 1, 17, SPSPS_LOOK - 1, SPSPS_LOOK + 1,
+			3 * SPSPS_LOOK + 5 };
+	size_t offset = 0, which = 0;
+	while (offset < len) {
+		size_t size = sizes[which++ % 6];
+		if (size > len - offset) size = len - offset;
+		Mark mark = spsps_mark(parser);
+		if (mark.offset != offset) {
+			ERR("The %s mark is at %" PRIu64 " instead of %lu.", what,
+					mark.offset, offset);
+		}
+		spsps_consume_n(parser, size);
+		size_t length;
+		const SPSPS_CHAR * slice = spsps_slice(parser, mark, &length);
+		if (length != size || (size > 0 &&
+				memcmp(slice, text + offset, size) != 0)) {
+			ERR("The %s slice at %lu of %lu characters is wrong.", what,
+					offset, size);
+		}
+		xstring str = xstr_borrow(slice, length);
+		if (xstr_length(str) != size ||
+				(size > 0 && xstr_char(str, size - 1) != text[offset+size-1])) {
+			ERR("The %s borrowed string at %lu is wrong.", what, offset);
+		}
+		xstr_free(str);
+		spsps_unmark(parser, mark);
+		offset += size;
+	} // Take slices to the end.
+	size_t length;
+	const SPSPS_CHAR * slice = spsps_slice(parser, outer, &length);
+	if (length != len || memcmp(slice, text, len) != 0) {
+		ERR("The %s slice of the whole text is wrong.", what);
+	}
+	spsps_unmark(parser, outer);
+	if (spsps_peek(parser) != SPSPS_EOF) {
+		ERR("The %s parser did not end after the last slice.", what);
+	}
+}
+
+/**
+ * Test marks and slices.
+ */
+void
+mark_test() {
+	size_t len = 9 * SPSPS_LOOK + 11;
+	char * text = (char *) malloc(len + 1);
+	for (size_t index = 0; index < len; ++index) {
+		text[index] = (char) ('a' + (index * 7) % 26);
+	} // Build the text.
+	text[len] = 0;
+
+	Parser parser = spsps_new_buffer("buffer", text, len);
+	check_marks(parser, text, "buffer");
+	spsps_free(parser);
+
+	write_scratch(text);
+	FILE * stream = fopen(SCRATCH, "rb");
+	parser = spsps_new(SCRATCH, stream);
+	check_marks(parser, text, "stream");
+	spsps_free(parser);
+	fclose(stream);
+	remove(SCRATCH);
+
+	xstring str = xstr_wrap_n(text, 5);
+	if (xstr_length(str) != 5 || xstr_char(str, 4) != text[4]) {
+		ERR("Copying characters into an xstring failed.");
+	}
+	xstr_free(str);
+	free(text);
+}
+
+/**
+ * Check checkpoints on the given parser, which must be reading the text.
+ * @param parser			The parser.
+ * @param text				The text.
+ * @param what				What kind of parser this is, for messages.
+ */
+static void
+check_checkpoints(Parser parser, char * text, char * what) {
+	size_t len = strlen(text);
+	// Look far ahead, well past the size of a read.
+	size_t far = 2 * SPSPS_LOOK + 3;
+	SPSPS_CHAR * ahead = spsps_peek_n(parser, far);
+	if (memcmp(ahead, text, far) != 0) {
+		ERR("The %s parser could not look %lu characters ahead.", what, far);
+	}
+	free(ahead);
+
+	// Consume everything from inside two checkpoints, then back up to each.
+	Checkpoint outer = spsps_checkpoint(parser);
+	spsps_consume_n(parser, 3 * SPSPS_LOOK + 5);
+	Loc middle = spsps_location(parser);
+	Checkpoint inner = spsps_checkpoint(parser);
+	spsps_consume_n(parser, len);
+	spsps_consume(parser);
+	if (! spsps_eof(parser)) {
+		ERR("The %s parser did not reach the end of file.", what);
+	}
+	spsps_location(parser);
+	spsps_restore(parser, inner);
+	Loc loc = spsps_location(parser);
+	if (spsps_eof(parser) || loc.offset != middle.offset ||
+			loc.line != middle.line || loc.column != middle.column) {
+		ERR("Restoring the inner %s checkpoint gave %" PRIu64 ":%" PRIu64
+				" at %" PRIu64 " instead of %" PRIu64 ":%" PRIu64 " at %"
+				PRIu64 ".", what, loc.line, loc.column, loc.offset,
+				middle.line, middle.column, middle.offset);
+	}
+	if (spsps_peek(parser) != text[middle.offset]) {
+		ERR("The %s parser has the wrong character after a restore.", what);
+	}
+	spsps_restore(parser, outer);
+	loc = spsps_location(parser);
+	if (loc.offset != 0 || loc.line != 1 || loc.column != 1) {
+		ERR("Restoring the outer %s checkpoint did not reach the start.",
+				what);
+	}
+
+	// The whole text is still there, even though the stream is exhausted.
+	check_text(parser, text, what);
+}
+
+/**
+ * Test checkpoints and unbounded lookahead.
+ */
+void
+checkpoint_test() {
+	size_t len = 7 * SPSPS_LOOK + 3;
+	char * text = (char *) malloc(len + 1);
+	for (size_t index = 0; index < len; ++index) {
+		text[index] = (index % 61 == 60) ? '\n' : (char) ('a' + index % 26);
+	} // Build the text.
+	text[len] = 0;
+
+	Parser parser = spsps_new_buffer("buffer", text, len);
+	check_checkpoints(parser, text, "buffer");
+	spsps_free(parser);
+
+	write_scratch(text);
+	FILE * stream = fopen(SCRATCH, "rb");
+	parser = spsps_new(SCRATCH, stream);
+	check_checkpoints(parser, text, "stream");
+	spsps_free(parser);
+	fclose(stream);
+	remove(SCRATCH);
+	free(text);
+}
+
+/**
+ * A push parser rule that copies the whole input into the context, which is
+ * a buffer large enough to hold it.  It backtracks a little along the way,
+ * to make sure checkpoints work across feeds.
+ * @param parser			The parser.
+ * @param context			The buffer.
+ * @return					The buffer.
+ */
+static void *
+copy_rule(Parser parser, void * context) {
+	char * buf = (char * ) context;
+	size_t index = 0;
+	while (spsps_peek(parser) != SPSPS_EOF) {
+		Checkpoint checkpoint = spsps_checkpoint(parser);
+		spsps_consume_n(parser, 11);
+		spsps_restore(parser, checkpoint);
+		Mark mark = spsps_mark(parser);
+		spsps_consume_until(parser, "\n");
+		spsps_consume(parser);
+		size_t length;
+		const SPSPS_CHAR * slice = spsps_slice(parser, mark, &length);
+		memcpy(buf + index, slice, length);
+		index += length;
+		spsps_unmark(parser, mark);
+	} // Copy lines.
+	buf[index] = 0;
+	return buf;
+}
+
+/**
+ * A push parser rule that stops after a few characters.
+ * @param parser			The parser.
+ * @param context			Ignored.
+ * @return					The parser.
+ */
+static void *
+short_rule(Parser parser, void * context) {
+	spsps_consume_n(parser, 5);
+	return parser;
+}
+
+/**
+ * Test push parsers.
+ */
+void
+push_test() {
+	size_t len = 3 * SPSPS_LOOK + 7;
+	char * text = (char *) malloc(len + 1);
+	for (size_t index = 0; index < len; ++index) {
+		text[index] = (index % 37 == 36) ? '\n' : (char) ('a' + index % 26);
+	} // Build the text.
+	text[len] = 0;
+	char * copy = (char *) malloc(len + 1);
+
+	size_t chunks[] = { 1, 7, SPSPS_LOOK + 3 };
+	for (size_t which = 0; which < 3; ++which) {
+		Parser parser = spsps_new_push("push", copy_rule, copy, 0);
+		if (parser == NULL) {
+			fprintf(stderr, "Push parsers are not available; skipping.\n");
+			break;
+		}
+		memset(copy, 0, len + 1);
+		for (size_t offset = 0; offset < len; offset += chunks[which]) {
+			size_t size = chunks[which];
+			if (size > len - offset) size = len - offset;
+			if (spsps_feed(parser, text + offset, size)) {
+				ERR("The push rule finished early with chunks of %lu.",
+						chunks[which]);
+				break;
+			}
+		} // Feed the text.
+		if (spsps_finish(parser) != copy || strcmp(copy, text) != 0) {
+			ERR("The push rule did not copy the text with chunks of %lu.",
+					chunks[which]);
+		}
+		Loc loc = spsps_location(parser);
+		if (loc.offset != len || loc.line != 1 + len / 37) {
+			ERR("The push parser ended at line %" PRIu64 ", offset %" PRIu64
+					".", loc.line, loc.offset);
+		}
+		spsps_free(parser);
+	} // Try each chunk size.
+
+	Parser parser = spsps_new_push("push", short_rule, NULL, 0);
+	if (parser != NULL) {
+		if (! spsps_feed(parser, text, 8)) {
+			ERR("The short push rule did not finish.");
+		}
+		if (! spsps_peek_str(parser, "fgh")) {
+			ERR("The short push rule did not leave the rest of the input.");
+		}
+		if (spsps_finish(parser) != parser) {
+			ERR("The short push rule did not return its value.");
+		}
+		spsps_free(parser);
+	}
+	free(copy);
+	free(text);
+}
+
+/**
+ * Test reading ahead on a helper thread.
+ */
+void
+readahead_test() {
+	size_t len = 3 * SPSPS_READAHEAD_BLOCK + 5;
+	char * text = (char *) malloc(len + 1);
+	for (size_t index = 0; index < len; ++index) {
+		text[index] = (index % 53 == 52) ? '\n' : (char) ('a' + index % 26);
+	} // Build the text.
+	text[len] = 0;
+	write_scratch(text);
+
+	FILE * stream = fopen(SCRATCH, "rb");
+	Parser parser = spsps_new(SCRATCH, stream);
+	if (! spsps_readahead(parser, 2)) {
+		fprintf(stderr, "Read-ahead is not available; skipping.\n");
+	} else {
+		check_text(parser, text, "read-ahead");
+	}
+	spsps_free(parser);
+	fclose(stream);
+
+	stream = fopen(SCRATCH, "rb");
+	parser = spsps_new(SCRATCH, stream);
+	spsps_readahead(parser, 4);
+	check_marks(parser, text, "read-ahead");
+	spsps_free(parser);
+	fclose(stream);
+
+	// Free the parser while the thread is still reading.
+	stream = fopen(SCRATCH, "rb");
+	parser = spsps_new(SCRATCH, stream);
+	spsps_readahead(parser, 2);
+	if (spsps_consume(parser) != text[0]) {
+		ERR("The read-ahead parser did not start at the beginning.");
+	}
+	spsps_free(parser);
+	fclose(stream);
+	remove(SCRATCH);
+	free(text);
+}
+
+/**
+ * Check keyword matching on the given parser, which must be reading the text
+ * built by keyword_test.
+ * @param parser			The parser.
+ * @param keywords			The matcher.
+ * @param what				What kind of parser this is, for messages.
+ */
+static void
+check_keywords(Parser parser, Keywords keywords, char * what) {
+	int expect[] = { 2, 1, 0, 5, 6, 4, 3, 7, 6, -1 };
+	spsps_consume_whitespace(parser);
+	for (size_t index = 0; index < sizeof(expect) / sizeof(int); ++index) {
+		int match = spsps_match_keyword(parser, keywords, true);
+		if (match != expect[index]) {
+			ERR("The %s parser matched keyword %d instead of %d at %lu.",
+					what, match, expect[index], index);
+		}
+		spsps_consume_whitespace(parser);
+	} // Match each keyword.
+	if (! spsps_peek_str(parser, "foo")) {
+		ERR("The %s parser consumed characters when no keyword matched.",
+				what);
+	}
+}
+
+/**
+ * Test keyword matching.
+ */
+void
+keyword_test() {
+	char * list[] = { "<", "<=", "<<=", "if", "in", "int", "integer",
+			"then", "in", NULL };
+	Keywords keywords = spsps_keywords_compile(list);
+	// Put a keyword across the first refill of a stream.
+	char * words = "<<= <= < int integer in if then integer foo";
+	size_t pad = SPSPS_LOOK * 2 - 16;
+	char * text = (char *) malloc(pad + strlen(words) + 1);
+	memset(text, ' ', pad);
+	strcpy(text + pad, words);
+
+	Parser parser = spsps_new_buffer("buffer", text, strlen(text));
+	check_keywords(parser, keywords, "buffer");
+	spsps_free(parser);
+
+	write_scratch(text);
+	FILE * stream = fopen(SCRATCH, "rb");
+	parser = spsps_new(SCRATCH, stream);
+	check_keywords(parser, keywords, "stream");
+	spsps_free(parser);
+	fclose(stream);
+	remove(SCRATCH);
+
+	// Matching without consuming leaves the parser alone.
+	parser = spsps_new_buffer("buffer", "integral", 8);
+	if (spsps_match_keyword(parser, keywords, false) != 5 ||
+			spsps_peek(parser) != 'i') {
+		ERR("Matching a keyword without consuming it failed.");
+	}
+	spsps_free(parser);
+	spsps_keywords_free(keywords);
+	free(text);
+}
+
+/**
+ * Check that consuming a class agrees with testing one character at a time,
+ * over a text holding every byte.
+ * @param cls				The class.
+ * @param what				What the class is, for messages.
+ */
+static void
+check_class_scan(CharClass cls, char * what) {
+	size_t len = 4 * SPSPS_LOOK;
+	char * text = (char *) malloc(len + 1);
+	srand(2);
+	for (size_t index = 0; index < len; ++index) {
+		// Long runs of members, broken up by other characters.
+		text[index] = (char) (rand() % 4 ? 'a' + rand() % 26 : 1 + rand() % 255);
+	} // Build the text.
+	text[len] = 0;
+	Parser parser = spsps_new_buffer("class", text, len);
+	size_t offset = 0;
+	while (offset < len) {
+		size_t expect = 0;
+		while (offset + expect < len &&
+				spsps_class_has(cls, text[offset + expect])) ++expect;
+		size_t count = spsps_consume_class(parser, cls);
+		if (count != expect) {
+			ERR("Consuming %s at %lu took %lu instead of %lu.", what, offset,
+					count, expect);
+			break;
+		}
+		offset += count;
+		if (offset < len) {
+			spsps_consume(parser);
+			++offset;
+		}
+	} // Consume runs.
+	spsps_free(parser);
+	free(text);
+}
+
+/**
+ * Test character classes.
+ */
+void
+class_test() {
+	// The built-in classes agree with the "C" locale.
+	struct { CharClass cls; int (* ctype)(int); char * what; } builtins[] = {
+		{ SPSPS_DIGIT, isdigit, "digit" }, { SPSPS_XDIGIT, isxdigit, "xdigit" },
+		{ SPSPS_UPPER, isupper, "upper" }, { SPSPS_LOWER, islower, "lower" },
+		{ SPSPS_ALPHA, isalpha, "alpha" }, { SPSPS_ALNUM, isalnum, "alnum" },
+		{ SPSPS_SPACE, isspace, "space" }, { SPSPS_PRINT, isprint, "print" },
+		{ SPSPS_PUNCT, ispunct, "punct" },
+	};
+	for (size_t which = 0; which < sizeof(builtins) / sizeof(builtins[0]);
+			++which) {
+		for (int code = 0; code < 256; ++code) {
+			if (spsps_class_has(builtins[which].cls, (SPSPS_CHAR) code) !=
+					(builtins[which].ctype(code) != 0)) {
+				ERR("The %s class is wrong for %d.", builtins[which].what,
+						code);
+			}
+		} // Check every byte.
+		check_class_scan(builtins[which].cls, builtins[which].what);
+	} // Check all built-in classes.
+	if (! spsps_class_has(SPSPS_IDENT, '_') ||
+			spsps_class_has(SPSPS_IDENT_START, '0')) {
+		ERR("The identifier classes are wrong.");
+	}
+
+	// Made classes, including one with too many runs to vectorize.
+	CharClass sign = spsps_class_new("+-");
+	CharClass number = spsps_class_union(SPSPS_DIGIT, sign);
+	CharClass range = spsps_class_range('a', 300);
+	CharClass scattered = spsps_class_new("acegikmoqsuwy02468");
+	if (! spsps_class_has(number, '7') || ! spsps_class_has(number, '-') ||
+			spsps_class_has(number, 'x')) {
+		ERR("The union class is wrong.");
+	}
+	if (! spsps_class_has(range, 'z') || spsps_class_has(range, 'A') ||
+			! spsps_class_has(range, (SPSPS_CHAR) 0xff)) {
+		ERR("The range class is wrong.");
+	}
+	check_class_scan(number, "number");
+	check_class_scan(range, "range");
+	check_class_scan(scattered, "scattered");
+
+	Parser parser = spsps_new_buffer("class", "x1 ", 3);
+	if (spsps_peek_class(parser, SPSPS_DIGIT) ||
+			! spsps_peek_class(parser, SPSPS_IDENT_START)) {
+		ERR("Peeking a class failed.");
+	}
+	SPSPS_CHAR buf[4];
+	if (spsps_take_class(parser, SPSPS_IDENT, buf, 4) != 2 || buf[1] != '1') {
+		ERR("Taking a class failed.");
+	}
+	spsps_consume(parser);
+	if (spsps_peek_class(parser, SPSPS_PRINT)) {
+		ERR("Peeking a class at the end of file succeeded.");
+	}
+	spsps_free(parser);
+	spsps_class_free(sign);
+	spsps_class_free(number);
+	spsps_class_free(range);
+	spsps_class_free(scattered);
+	spsps_class_free(SPSPS_DIGIT);
+}
+
+/**
+ * Test recording errors.
+ */
+void
+error_test() {
+	char * text = "one\ntwo three";
+	Parser parser = spsps_new_buffer("errors", text, strlen(text));
+	spsps_set_error_mode(parser, SPSPS_ERRORS_RECORD);
+	spsps_consume_n(parser, 5);
+	SPSPS_ERR(parser, "Found %s, %d%% of %-4u|%5.*f|%c|%ld|%zu.",
+			spsps_printchar('w'), -5, 12u, 2, 3.14159, 'q', 7L, (size_t) 9);
+	// The character buffer is reused, but the error has its own copy.
+	spsps_printchar('z');
+	if (spsps_error_count(parser) != 1 || spsps_error_at(parser, 1) != NULL) {
+		ERR("Expected one recorded error, but found %lu.",
+				spsps_error_count(parser));
+	}
+	const spsps_error * error = spsps_error_at(parser, 0);
+	char buf[200];
+	if (error != NULL) {
+		if (error->loc.line != 2 || error->loc.column != 2 ||
+				error->loc.offset != 5 || error->code != PARSE_ERROR) {
+			ERR("The error was recorded at the wrong location.");
+		}
+		int len = spsps_error_format(error, buf, sizeof(buf));
+		char * expect = "ERROR errors:2:2: Found U+0077 (w), -5% of 12  "
+				"| 3.14|q|7|9.";
+		if (strcmp(buf, expect) != 0 || len != (int) strlen(expect)) {
+			ERR("The error was rendered as \"%s\", but should be \"%s\".",
+					buf, expect);
+		}
+		// Truncation works as with snprintf.
+		if (spsps_error_format(error, buf, 8) != len || strlen(buf) != 7) {
+			ERR("Rendering the error into a short buffer failed.");
+		}
+	}
+
+	// Only the most recent errors are kept.
+	for (int index = 0; index < SPSPS_ERROR_RING + 3; ++index) {
+		SPSPS_ERR(parser, "Error %d.", index);
+	} // Overflow the ring.
+	error = spsps_error_at(parser, 0);
+	if (spsps_error_count(parser) != SPSPS_ERROR_RING + 4 || error == NULL
+			|| error->args[0].i != 3
+			|| spsps_error_at(parser, SPSPS_ERROR_RING) != NULL) {
+		ERR("The error ring did not keep the most recent errors.");
+	}
+	spsps_clear_errors(parser);
+	if (spsps_error_count(parser) != 0) {
+		ERR("Clearing the errors did not discard them.");
+	}
+	spsps_free(parser);
+
+	// Printed errors are written whole, however long they are.
+	char shown[SPSPS_PRINTCHAR_SIZE];
+	if (strcmp(spsps_printchar_r('A', shown, sizeof(shown)), "U+0041 (A)")) {
+		ERR("A character was printed as %s.", shown);
+	}
+	parser = spsps_new_buffer("printed", text, strlen(text));
+	spsps_consume_n(parser, 4);
+	FILE * out = tmpfile();
+	char wide[400];
+	memset(wide, 'w', sizeof(wide) - 1);
+	wide[sizeof(wide) - 1] = 0;
+	spsps_error_report(parser, out, PARSE_ERROR, "Long %s.", wide);
+	spsps_error_report(parser, out, PARSE_ERROR, "Short %s.",
+			spsps_printchar('x'));
+	rewind(out);
+	char line[512];
+	if (fgets(line, sizeof(line), out) == NULL ||
+			strncmp(line, "ERROR printed:2:1: Long www", 27) != 0 ||
+			strlen(line) != 27 + 396 + 2) {
+		ERR("The long error was printed as \"%s\".", line);
+	}
+	if (fgets(line, sizeof(line), out) == NULL ||
+			strcmp(line, "ERROR printed:2:1: Short U+0078 (x).\n") != 0) {
+		ERR("The short error was printed as \"%s\".", line);
+	}
+	fclose(out);
+	spsps_free(parser);
+
+	// Stop at the first error, for both kinds of parser.
+	write_scratch(text);
+	FILE * stream = fopen(SCRATCH, "rb");
+	Parser parsers[] = {
+			spsps_new_buffer("first", text, strlen(text)),
+			spsps_new(SCRATCH, stream)
+	};
+	for (int index = 0; index < 2; ++index) {
+		parser = parsers[index];
+		spsps_set_error_mode(parser, SPSPS_ERRORS_FIRST);
+		spsps_consume_n(parser, 2);
+		SPSPS_ERR(parser, "First.");
+		SPSPS_ERR(parser, "Second.");
+		if (spsps_error_count(parser) != 1 ||
+				strcmp(spsps_error_at(parser, 0)->msg, "First.") != 0) {
+			ERR("Parser %d did not keep only the first error.", index);
+		}
+		if (spsps_peek(parser) != SPSPS_EOF ||
+				spsps_consume_until(parser, "x") != 0) {
+			ERR("Parser %d did not stop at the first error.", index);
+		}
+		spsps_consume(parser);
+		if (! spsps_eof(parser)) {
+			ERR("Parser %d did not reach the end after the first error.",
+					index);
+		}
+		spsps_free(parser);
+	} // Check both parsers.
+	fclose(stream);
+	remove(SCRATCH);
+}
+
+/**
+ * A push parser rule that sums the code points of its input.
+ * @param parser			The parser.
+ * @param context			A count and a sum, as two uint64_t.
+ * @return					The context.
+ */
+static void *
+code_point_rule(Parser parser, void * context) {
+	uint64_t * totals = (uint64_t *) context;
+	spsps_set_utf8(parser, true);
+	for (int32_t cp = spsps_consume_cp(parser); cp != SPSPS_EOF_CP;
+			cp = spsps_consume_cp(parser)) {
+		totals[0] += 1;
+		totals[1] += (uint64_t) cp;
+	} // Sum the code points.
+	return context;
+}
+
+/**
+ * Test UTF-8 decoding, validation, and columns.
+ */
+void
+utf8_test() {
+	// One line of a 2, 3, and 4 byte character, repeated so that characters
+	// straddle the ends of the window.
+	char * line = "a\xc3\xa9\xe2\x82\xac\xf0\x9d\x84\x9e\n";
+	int32_t expect[] = { 'a', 0xe9, 0x20ac, 0x1d11e, '\n' };
+	size_t lines = SPSPS_LOOK / 3;
+	size_t len = strlen(line);
+	char * text = (char *) malloc(lines * len + 1);
+	for (size_t index = 0; index < lines; ++index) {
+		memcpy(text + index * len, line, len);
+	} // Build the text.
+	text[lines * len] = 0;
+	write_scratch(text);
+
+	FILE * stream = fopen(SCRATCH, "rb");
+	Parser parser = spsps_new(SCRATCH, stream);
+	if (! spsps_set_utf8(parser, true)) {
+		fprintf(stderr, "UTF-8 is not available; skipping.\n");
+	} else {
+		for (size_t index = 0; index < lines * 5; ++index) {
+			if (index == 2 * 5 + 3) {
+				// Columns count code points.
+				Loc loc = spsps_location(parser);
+				if (loc.line != 3 || loc.column != 4 ||
+						loc.offset != 2 * len + 6) {
+					ERR("Before the clef the parser was at %" PRIu64 ":%"
+							PRIu64 ", offset %" PRIu64 ".", loc.line,
+							loc.column, loc.offset);
+				}
+			}
+			int32_t cp = spsps_peek_cp(parser);
+			if (cp != expect[index % 5] || spsps_consume_cp(parser) != cp) {
+				ERR("Expected U+%04X at code point %lu, but found U+%04X.",
+						(unsigned) expect[index % 5], index, (unsigned) cp);
+				break;
+			}
+		} // Check every code point.
+		if (spsps_peek_cp(parser) != SPSPS_EOF_CP ||
+				spsps_utf8_error(parser) != UINT64_MAX) {
+			ERR("The valid text did not end cleanly.");
+		}
+	}
+	spsps_free(parser);
+	fclose(stream);
+	remove(SCRATCH);
+
+	// A code point split at a block boundary, whose lead byte is consumed
+	// before the rest of it is read, is still valid.
+	write_scratch("abc\xc3\xa9xyz");
+	stream = fopen(SCRATCH, "rb");
+	spsps_options small = { 0 };
+	small.block = 2;
+	parser = spsps_new_ex(SCRATCH, stream, &small);
+	if (spsps_set_utf8(parser, true)) {
+		while (! spsps_eof(parser)) spsps_consume(parser);
+		if (spsps_utf8_error(parser) != UINT64_MAX) {
+			ERR("Valid UTF-8 split at a block boundary was flagged at %"
+					PRIu64 ".", spsps_utf8_error(parser));
+		}
+	}
+	spsps_free(parser);
+	fclose(stream);
+	remove(SCRATCH);
+
+	// Invalid bytes, an overlong, a surrogate, and a truncated sequence.
+	char * bad = "x\xff\xc0\x80\xed\xa0\x80y\xe2\x82";
+	parser = spsps_new_buffer("bad", bad, strlen(bad));
+	if (spsps_set_utf8(parser, true)) {
+		if (spsps_utf8_error(parser) != 1) {
+			ERR("The first invalid byte was reported at %" PRIu64 ".",
+					spsps_utf8_error(parser));
+		}
+		spsps_consume_cp(parser);
+		size_t count = 0;
+		while (spsps_peek_cp(parser) == 0xfffd) {
+			if (spsps_get_errno(parser) != INVALID_UTF8) {
+				ERR("Invalid UTF-8 did not set the errno.");
+			}
+			spsps_consume_cp(parser);
+			++count;
+		} // Skip the damage.
+		if (count != 6 || spsps_consume_cp(parser) != 'y' ||
+				spsps_get_errno(parser) != OK) {
+			ERR("Skipped %lu invalid bytes rather than 6.", count);
+		}
+		if (spsps_consume_cp(parser) != 0xfffd ||
+				spsps_consume_cp(parser) != 0xfffd ||
+				spsps_consume_cp(parser) != SPSPS_EOF_CP) {
+			ERR("The truncated sequence was not reported.");
+		}
+	}
+	spsps_free(parser);
+
+	// Feed a byte at a time, so every character is split across feeds.
+	uint64_t totals[2] = { 0, 0 };
+	parser = spsps_new_push("utf8", code_point_rule, totals, 0);
+	if (parser != NULL) {
+		for (size_t index = 0; index < 4 * len; ++index) {
+			spsps_feed(parser, text + index, 1);
+		} // Feed the text.
+		spsps_finish(parser);
+		if (totals[0] != 4 * 5 ||
+				totals[1] != 4 * ('a' + 0xe9 + 0x20ac + 0x1d11e + '\n') ||
+				spsps_utf8_error(parser) != UINT64_MAX) {
+			ERR("The push parser decoded %" PRIu64 " code points.",
+					totals[0]);
+		}
+		spsps_free(parser);
+	}
+	free(text);
+}
+
+/**
+ * Test the performance counters.
+ */
+void
+stats_test() {
+	char * text = "abc def\n";
+	write_scratch(text);
+	FILE * stream = fopen(SCRATCH, "rb");
+	Parser parser = spsps_new(SCRATCH, stream);
+	spsps_parser_stats before;
+	spsps_stats_total(&before);
+	spsps_parser_stats stats;
+	if (! spsps_stats(parser, &stats)) {
+		if (stats.consumed != 0 || stats.peeks != 0) {
+			ERR("Counters compiled out did not read as zero.");
+		}
+		fprintf(stderr, "Counters are not kept; skipping.\n");
+		spsps_free(parser);
+		fclose(stream);
+		remove(SCRATCH);
+		return;
+	}
+	spsps_peek(parser);
+	Checkpoint checkpoint = spsps_checkpoint(parser);
+	spsps_consume_n(parser, 2);
+	spsps_restore(parser, checkpoint);
+	spsps_consume_until(parser, " ");
+	spsps_consume_whitespace(parser);
+	spsps_peek_str(parser, "def");
+	spsps_consume_n(parser, 10);
+	spsps_set_error_mode(parser, SPSPS_ERRORS_RECORD);
+	SPSPS_ERR(parser, "Done.");
+	spsps_stats(parser, &stats);
+	if (stats.consumed != 2 + 3 + 1 + 4 || stats.consumes != 4 ||
+			stats.peeks != 2 || stats.checkpoints != 1 ||
+			stats.errors != 1 || stats.stalls != 0) {
+		ERR("The counters were consumed %" PRIu64 " in %" PRIu64 ", peeks %"
+				PRIu64 ", checkpoints %" PRIu64 ", errors %" PRIu64 ".",
+				stats.consumed, stats.consumes, stats.peeks,
+				stats.checkpoints, stats.errors);
+	}
+	if (stats.refills < 1 || stats.reads < 1) {
+		ERR("The counters did not see the stream being read.");
+	}
+	spsps_free(parser);
+	spsps_parser_stats after;
+	spsps_stats_total(&after);
+	if (after.consumed - before.consumed != stats.consumed ||
+			after.reads - before.reads != stats.reads) {
+		ERR("Freeing the parser did not add to the totals.");
+	}
+
+	// A pooled parser adds to the totals once, when it is released, and
+	// not again when the pool is drained.
+	parser = spsps_acquire_buffer("pool", text, strlen(text));
+	spsps_consume_n(parser, 3);
+	spsps_release(parser);
+	spsps_pool_drain();
+	spsps_parser_stats drained;
+	spsps_stats_total(&drained);
+	if (drained.consumed - after.consumed != 3) {
+		ERR("The pooled parser added %" PRIu64 " consumed to the totals.",
+				drained.consumed - after.consumed);
+	}
+	fclose(stream);
+	remove(SCRATCH);
+}
+
+/**
+ * Test resetting and pooling parsers.
+ */
+void
+reset_test() {
+	char * first = "one\ntwo";
+	char * second = "three\nfour\nfive";
+	write_scratch(first);
+	FILE * stream = fopen(SCRATCH, "rb");
+	Parser parser = spsps_new("first", stream);
+	spsps_set_error_mode(parser, SPSPS_ERRORS_RECORD);
+	spsps_set_utf8(parser, true);
+	spsps_readahead(parser, 2);
+	spsps_checkpoint(parser);
+	spsps_consume_n(parser, 5);
+	SPSPS_ERR(parser, "Left behind.");
+
+	// The checkpoint, the error, and the read-ahead do not survive a reset.
+	spsps_reset_buffer(parser, "second", second, strlen(second));
+	spsps_consume_until(parser, "v");
+	Loc loc = spsps_location(parser);
+	if (strcmp(loc.name, "second") != 0 || loc.line != 3 || loc.column != 3
+			|| loc.offset != 13 || spsps_error_count(parser) != 0) {
+		ERR("The reset buffer parser was at %s:%" PRIu64 ":%" PRIu64 ".",
+				loc.name, loc.line, loc.column);
+	}
+	rewind(stream);
+	spsps_reset(parser, "again", stream);
+	check_text(parser, first, "reset");
+	spsps_free(parser);
+
+	// Parsers come back out of the pool.
+	Parser pooled[SPSPS_POOL_SIZE + 1];
+	for (int index = 0; index <= SPSPS_POOL_SIZE; ++index) {
+		pooled[index] = spsps_acquire_buffer("pool", first, strlen(first));
+	} // Take more than the pool holds.
+	for (int index = 0; index <= SPSPS_POOL_SIZE; ++index) {
+		spsps_release(pooled[index]);
+	} // Give them back.
+	parser = spsps_acquire_buffer("pool", second, strlen(second));
+	if (parser != pooled[SPSPS_POOL_SIZE - 1]) {
+		ERR("The pool did not give back the last parser released.");
+	}
+	check_text(parser, second, "pooled");
+	spsps_release(parser);
+	rewind(stream);
+	parser = spsps_acquire("pool", stream);
+	check_text(parser, first, "pooled stream");
+	spsps_release(parser);
+	spsps_pool_drain();
+	fclose(stream);
+	remove(SCRATCH);
+}
+
+/**
+ * An allocator that counts the buffers it holds.
+ * @param context			The count, as a long.
+ * @param ptr				The memory, or NULL.
+ * @param old_size			The old size.
+ * @param new_size			The new size, or zero to free.
+ * @return					The memory.
+ */
+static void *
+counting_allocator(void * context, void * ptr, size_t old_size,
+		size_t new_size) {
+	long * count = (long *) context;
+	if (ptr == NULL && new_size > 0) ++*count;
+	if (new_size == 0) {
+		if (ptr != NULL) --*count;
+		free(ptr);
+		return NULL;
+	}
+	return realloc(ptr, new_size);
+}
+
+/**
+ * Test parsers made with options.
+ */
+void
+options_test() {
+	size_t len = 1000;
+	char * text = (char *) malloc(len + 1);
+	for (size_t index = 0; index < len; ++index) {
+		text[index] = (index % 10 == 9) ? '\n' : (char) ('0' + index % 10);
+	} // Build the text.
+	text[len] = 0;
+	write_scratch(text);
+
+	FILE * stream = fopen(SCRATCH, "rb");
+	long buffers = 0;
+	spsps_options options = { 0 };
+	options.block = 16;
+	options.max_lookahead = 100;
+	options.allocator = counting_allocator;
+	options.allocator_context = &buffers;
+	Parser parser = spsps_new_ex(SCRATCH, stream, &options);
+	if (buffers != 0) {
+		ERR("The buffer was allocated before it was needed.");
+	}
+	if (spsps_peek(parser) != '0' || buffers != 1) {
+		ERR("The buffer was not allocated on the first peek.");
+	}
+	char * look = spsps_peek_n(parser, 100);
+	if (look[99] != '\n' || spsps_get_errno(parser) != OK) {
+		ERR("Lookahead within the limit failed.");
+	}
+	free(look);
+	look = spsps_peek_n(parser, 101);
+	if (look[100] != SPSPS_EOF ||
+			spsps_get_errno(parser) != LOOKAHEAD_TOO_LARGE) {
+		ERR("Lookahead past the limit was not refused.");
+	}
+	free(look);
+	// Consuming is not limited.
+	spsps_consume_n(parser, 995);
+	if (spsps_peek(parser) != '5' || spsps_offset(parser) != 995) {
+		ERR("Consuming past the lookahead limit failed.");
+	}
+	if (spsps_idle(parser)) {
+		ERR("The parser went idle with characters still buffered.");
+	}
+	spsps_consume_n(parser, 5);
+	if (! spsps_idle(parser) || buffers != 0) {
+		ERR("The idle parser did not release its buffer.");
+	}
+	Loc loc = spsps_location(parser);
+	if (loc.line != 101 || loc.column != 1 || loc.offset != 1000) {
+		ERR("The idle parser lost its location.");
+	}
+	spsps_consume(parser);
+	if (! spsps_eof(parser)) {
+		ERR("The parser did not reach the end of file after going idle.");
+	}
+	spsps_free(parser);
+	if (buffers != 0) {
+		ERR("The allocator was not used to free the buffer.");
+	}
+
+	// An idle parser picks up where it left off.
+	rewind(stream);
+	parser = spsps_new_ex(SCRATCH, stream, &options);
+	spsps_consume_n(parser, 32);
+	if (! spsps_idle(parser)) {
+		ERR("The parser did not go idle at the end of its buffer.");
+	}
+	spsps_consume_n(parser, 3);
+	loc = spsps_location(parser);
+	if (spsps_peek(parser) != '5' || loc.line != 4 || loc.column != 6) {
+		ERR("The parser did not resume after going idle.");
+	}
+	spsps_free(parser);
+
+	// A pooled parser does not keep the options it was released with.
+	rewind(stream);
+	parser = spsps_new_ex(SCRATCH, stream, &options);
+	spsps_peek(parser);
+	spsps_release(parser);
+	parser = spsps_acquire_buffer("pool", text, len);
+	if (buffers != 0) {
+		ERR("The pooled parser kept the buffer of its old allocator.");
+	}
+	look = spsps_peek_n(parser, 101);
+	if (look[100] != '0' || spsps_get_errno(parser) != OK) {
+		ERR("The pooled parser kept its old lookahead limit.");
+	}
+	free(look);
+	spsps_release(parser);
+	spsps_pool_drain();
+	fclose(stream);
+	remove(SCRATCH);
+	free(text);
+}
+
+/**
+ * Check that a double is parsed exactly as strtod would, and that the rest
+ * of the text is left.
+ * @param text				The text, starting with the number.
+ * @param length			The number of characters in the number.
+ */
+static void
+check_double(char * text, size_t length) {
+	Parser parser = spsps_new_buffer("number", text, strlen(text));
+	double value;
+	if (! spsps_parse_double(parser, &value)) {
+		ERR("No double was parsed from %s.", text);
+	} else {
+		double expect = strtod(text, NULL);
+		if (value != expect || spsps_offset(parser) != length) {
+			ERR("Parsed %s as %.17g, using %" PRIu64 " characters.", text,
+					value, spsps_offset(parser));
+		}
+	}
+	spsps_free(parser);
+}
+
+static void
+number_test() {
+	char * integers = "18446744073709551615 18446744073709551616 "
+			"-9223372036854775808 9223372036854775807 9223372036854775808 "
+			"00000000000000000000000000042 DeadBeef 10000000000000000 x";
+	Parser parser = spsps_new_buffer("numbers", integers, strlen(integers));
+	uint64_t unsigned_value;
+	int64_t signed_value;
+	double value;
+	if (! spsps_parse_uint64(parser, &unsigned_value) ||
+			unsigned_value != UINT64_MAX || spsps_get_errno(parser) != OK) {
+		ERR("The largest unsigned value was not parsed.");
+	}
+	spsps_consume_whitespace(parser);
+	if (! spsps_parse_uint64(parser, &unsigned_value) ||
+			unsigned_value != UINT64_MAX ||
+			spsps_get_errno(parser) != NUMBER_OUT_OF_RANGE ||
+			spsps_peek(parser) != ' ') {
+		ERR("An unsigned overflow was not reported.");
+	}
+	spsps_consume_whitespace(parser);
+	if (! spsps_parse_int64(parser, &signed_value) ||
+			signed_value != INT64_MIN || spsps_get_errno(parser) != OK) {
+		ERR("The smallest signed value was not parsed.");
+	}
+	spsps_consume_whitespace(parser);
+	if (! spsps_parse_int64(parser, &signed_value) ||
+			signed_value != INT64_MAX || spsps_get_errno(parser) != OK) {
+		ERR("The largest signed value was not parsed.");
+	}
+	spsps_consume_whitespace(parser);
+	if (! spsps_parse_int64(parser, &signed_value) ||
+			signed_value != INT64_MAX ||
+			spsps_get_errno(parser) != NUMBER_OUT_OF_RANGE) {
+		ERR("A signed overflow was not reported.");
+	}
+	spsps_consume_whitespace(parser);
+	if (! spsps_parse_uint64(parser, &unsigned_value) ||
+			unsigned_value != 42) {
+		ERR("Leading zeros were not skipped.");
+	}
+	spsps_consume_whitespace(parser);
+	if (! spsps_parse_hex(parser, &unsigned_value) ||
+			unsigned_value != 0xdeadbeef) {
+		ERR("Hexadecimal was not parsed.");
+	}
+	spsps_consume_whitespace(parser);
+	if (! spsps_parse_hex(parser, &unsigned_value) ||
+			unsigned_value != UINT64_MAX ||
+			spsps_get_errno(parser) != NUMBER_OUT_OF_RANGE) {
+		ERR("A hexadecimal overflow was not reported.");
+	}
+	spsps_consume_whitespace(parser);
+	if (spsps_parse_int64(parser, &signed_value) ||
+			spsps_parse_double(parser, &value) ||
+			spsps_peek(parser) != 'x') {
+		ERR("Something that is not a number was consumed.");
+	}
+	spsps_free(parser);
+
+	// Doubles are correctly rounded, whichever path converts them.
+	char * doubles[] = {
+		"0", "-0", "1", "-12.5e2", "3.14159", "0.1", "1e22", "1e23",
+		"9007199254740993", "123456789012345678901234567890",
+		"2.2250738585072011e-308", "4.9e-324", "1.7976931348623157e308",
+		"1e-400", "0.000000000000000000000000001234", "7.0e+1", NULL
+	};
+	for (int index = 0; doubles[index] != NULL; ++index) {
+		check_double(doubles[index], strlen(doubles[index]));
+	} // Check each double.
+	// A dot or an exponent without digits is not part of the number.
+	check_double("1.", 1);
+	check_double("1e", 1);
+	check_double("1e+x", 1);
+	check_double("2.5.3", 3);
+	parser = spsps_new_buffer("huge", "1e400", 5);
+	if (! spsps_parse_double(parser, &value) ||
+			spsps_get_errno(parser) != NUMBER_OUT_OF_RANGE) {
+		ERR("A double overflow was not reported.");
+	}
+	spsps_free(parser);
+
+	// A number that runs across a refill is read whole.
+	char * text = "   12345678901234567.125e-3";
+	write_scratch(text);
+	FILE * stream = fopen(SCRATCH, "rb");
+	spsps_options options = { 0 };
+	options.block = 4;
+	parser = spsps_new_ex(SCRATCH, stream, &options);
+	spsps_consume_whitespace(parser);
+	if (! spsps_parse_double(parser, &value) ||
+			value != strtod(text, NULL) || spsps_offset(parser) != 27) {
+		ERR("A number across refills was parsed as %.17g.", value);
+	}
+	spsps_free(parser);
+	fclose(stream);
+
+	// A number longer than the lookahead limit is not cut short.
+	text = "123456789012345 rest";
+	write_scratch(text);
+	stream = fopen(SCRATCH, "rb");
+	options.max_lookahead = 8;
+	parser = spsps_new_ex(SCRATCH, stream, &options);
+	uint64_t number = 0;
+	if (spsps_parse_uint64(parser, &number) ||
+			spsps_get_errno(parser) != LOOKAHEAD_TOO_LARGE ||
+			spsps_offset(parser) != 0 || spsps_peek(parser) != '1') {
+		ERR("A number past the lookahead limit was parsed as %" PRIu64 ".",
+				number);
+	}
+	// One that fits within the limit is parsed.
+	text = "1234567 rest";
+	spsps_free(parser);
+	fclose(stream);
+	write_scratch(text);
+	stream = fopen(SCRATCH, "rb");
+	parser = spsps_new_ex(SCRATCH, stream, &options);
+	if (! spsps_parse_uint64(parser, &number) || number != 1234567 ||
+			spsps_get_errno(parser) != OK) {
+		ERR("A number at the lookahead limit was parsed as %" PRIu64 ".",
+				number);
+	}
+	spsps_free(parser);
+	fclose(stream);
+	remove(SCRATCH);
+
+	// Numbers too long for the fast path do not depend on the locale's
+	// decimal point.
+	const char * commas[] = { "de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8",
+			"fr_FR.utf8", NULL };
+	bool comma = false;
+	for (int index = 0; commas[index] != NULL && ! comma; ++index) {
+		comma = setlocale(LC_NUMERIC, commas[index]) != NULL &&
+				localeconv()->decimal_point[0] == ',';
+	} // Find a locale with a decimal comma.
+	if (comma) {
+		text = "3.14159265358979323846 1.5e300";
+		parser = spsps_new_buffer("locale", text, strlen(text));
+		double pi = 0.0, big = 0.0;
+		spsps_parse_double(parser, &pi);
+		spsps_consume_whitespace(parser);
+		spsps_parse_double(parser, &big);
+		if (pi != 3.14159265358979323846 || big != 1.5e300 ||
+				spsps_offset(parser) != strlen(text)) {
+			ERR("With a decimal comma the numbers were %g and %g.", pi, big);
+		}
+		spsps_free(parser);
+	} else {
+		fprintf(stderr, "No locale with a decimal comma; skipping.\n");
+	}
+	setlocale(LC_NUMERIC, "C");
+}
+
+/**
+ * A source over characters in memory, handed out a few at a time.
+ */
+typedef struct test_source_ {
+	/// The characters.
+	const char * text;
+	/// The number of characters.
+	size_t length;
+	/// The number of characters handed out.
+	size_t at;
+	/// The most characters handed out at once.
+	size_t chunk;
+	/// The number of times the source was closed.
+	int closed;
+} test_source;
+
+/**
+ * The read hook of a test source.
+ * @param context			The test source.
+ * @param buf				Where to put the characters.
+ * @param size				The most characters to read.
+ * @return					The number of characters read.
+ */
+static size_t
+test_read(void * context, SPSPS_CHAR * buf, size_t size) {
+	test_source * source = (test_source *) context;
+	size_t count = source->length - source->at;
+	if (count > source->chunk) count = source->chunk;
+	if (count > size) count = size;
+	memcpy(buf, source->text + source->at, count);
+	source->at += count;
+	return count;
+}
+
+/**
+ * The map hook of a test source.
+ * @param context			The test source.
+ * @param length			Set to the length of the block.
+ * @return					The block, or NULL at the end.
+ */
+static const SPSPS_CHAR *
+test_map(void * context, size_t * length) {
+	test_source * source = (test_source *) context;
+	if (source->at == source->length) return NULL;
+	const SPSPS_CHAR * block = source->text + source->at;
+	*length = source->length - source->at;
+	if (*length > source->chunk) *length = source->chunk;
+	source->at += *length;
+	return block;
+}
+
+/**
+ * The close hook of a test source.
+ * @param context			The test source.
+ */
+static void
+test_close(void * context) {
+	((test_source *) context)->closed++;
+}
+
+/**
+ * Run the parser checks on parsers over a test source.
+ * @param hooks				The hooks.
+ * @param text				The text.
+ * @param chunk				The most characters handed out at once.
+ * @param what				What kind of parser this is, for messages.
+ */
+static void
+check_sources(const spsps_source * hooks, char * text, size_t chunk,
+		char * what) {
+	void (*checks[])(Parser, char *, char *) = {
+		check_text, check_scanners, check_marks, check_checkpoints
+	};
+	for (size_t index = 0; index < sizeof(checks) / sizeof(checks[0]);
+			++index) {
+		test_source source = { text, strlen(text), 0, chunk, 0 };
+		Parser parser = spsps_new_source(what, hooks, &source);
+		checks[index](parser, text, what);
+		spsps_free(parser);
+		if (source.closed != 1) {
+			ERR("The %s source was closed %d times.", what, source.closed);
+		}
+	} // Run each check.
+}
+
+/**
+ * Test parsers that get their characters from read and map hooks.
+ */
+void
+source_test() {
+	size_t len = 5 * SPSPS_LOOK;
+	char * text = (char *) malloc(len + 1);
+	char * pieces[] = { "0123456789", " \t\r\n", "abc{}[]" };
+	size_t index = 0, run = 0;
+	srand(2);
+	while (index < len) {
+		char * piece = pieces[run % 3];
+		size_t count = (size_t) (rand() % 70) + 1;
+		for (size_t here = 0; here < count && index < len; ++here) {
+			text[index++] = piece[rand() % strlen(piece)];
+		} // Write a run.
+		++run;
+	} // Build the text.
+	text[len] = 0;
+
+	spsps_source reader = { test_read, NULL, test_close };
+	spsps_source mapper = { NULL, test_map, test_close };
+	check_sources(&reader, text, 3, "small read");
+	check_sources(&reader, text, 1000, "read");
+	check_sources(&mapper, text, 3, "small map");
+	check_sources(&mapper, text, 1000, "map");
+
+	// Blocks from map are parsed in place, and only copied when a peek
+	// reaches past the end of one.
+	test_source source = { text, len, 0, 1000, 0 };
+	Parser parser = spsps_new_source("map", &mapper, &source);
+	size_t available = 0;
+	spsps_consume_n(parser, 1000);
+	if (spsps_window(parser, 1, &available) != text + 1000 ||
+			available != 1000) {
+		ERR("A block from map was not parsed in place.");
+	}
+	spsps_consume_n(parser, 998);
+	if (! spsps_peek_str(parser, (char []) { text[1998], text[1999],
+			text[2000], 0 })) {
+		ERR("A peek across blocks from map failed.");
+	}
+	spsps_consume_n(parser, 1002);
+	if (spsps_window(parser, 1, &available) != text + 3000) {
+		ERR("A block from map was not parsed in place after a copy.");
+	}
+	spsps_reset(parser, "stream", NULL);
+	if (source.closed != 1) {
+		ERR("Resetting a parser did not close its source.");
+	}
+	spsps_free(parser);
+
+	spsps_source none = { NULL, NULL, NULL };
+	if (spsps_new_source("none", &none, NULL) != NULL) {
+		ERR("A source with no way to read was accepted.");
+	}
+	free(text);
+}
+
+/**
+ * Test parsers over an iovec.
+ */
+void
+iov_test() {
+#ifdef HAVE_IOV
+	size_t len = 4 * SPSPS_LOOK + 9;
+	char * text = (char *) malloc(len + 1);
+	for (size_t index = 0; index < len; ++index) {
+		text[index] = (index % 37 == 36) ? '\n' : (char) ('a' + index % 26);
+	} // Build the text.
+	text[len] = 0;
+
+	// Cut the text into segments of awkward sizes, some of them empty.
+	size_t sizes[] = { 1, 0, 7, 5000, 0, 300 };
+	struct iovec iov[64];
+	size_t count = 0, offset = 0;
+	while (offset < len) {
+		size_t size = sizes[count % 6];
+		if (size > len - offset) size = len - offset;
+		iov[count].iov_base = text + offset;
+		iov[count].iov_len = size;
+		offset += size;
+		++count;
+	} // Cut the text.
+
+	void (*checks[])(Parser, char *, char *) = {
+		check_text, check_marks, check_checkpoints
+	};
+	for (size_t index = 0; index < sizeof(checks) / sizeof(checks[0]);
+			++index) {
+		Parser parser = spsps_new_iov("iov", iov, count);
+		checks[index](parser, text, "iov");
+		spsps_free(parser);
+	} // Run each check.
+
+	// A segment that is reached with nothing held is parsed in place.
+	Parser parser = spsps_new_iov("iov", iov, count);
+	size_t available = 0;
+	spsps_consume_n(parser, 8);
+	if (spsps_window(parser, 1, &available) != text + 8 ||
+			available != 5000) {
+		ERR("A segment of an iovec was not parsed in place.");
+	}
+	Loc * loc = spsps_loc(parser);
+	if (loc->line != 1 || loc->column != 9) {
+		ERR("The iovec parser is at %" PRIu64 ":%" PRIu64 " instead of 1:9.",
+				loc->line, loc->column);
+	}
+	free(loc);
+	spsps_free(parser);
+
+	// A code point split across segments is still valid UTF-8.
+	char first[] = "a\xc3", second[] = "\xa9" "b";
+	struct iovec split[2] = { { first, 2 }, { second, 2 } };
+	parser = spsps_new_iov("split", split, 2);
+	if (spsps_set_utf8(parser, true)) {
+		while (! spsps_eof(parser)) spsps_consume(parser);
+		if (spsps_utf8_error(parser) != UINT64_MAX) {
+			ERR("Valid UTF-8 split across segments was flagged at %" PRIu64
+					".", spsps_utf8_error(parser));
+		}
+	}
+	spsps_free(parser);
+
+	parser = spsps_new_iov("empty", NULL, 0);
+	check_text(parser, "", "empty iov");
+	spsps_free(parser);
+	free(text);
+#else
+	fprintf(stderr, "Scatter/gather input is not available; skipping.\n");
+#endif
+}
+
+/**
+ * Check the inline functions on the given parser, which must be reading the
+ * text.  They are mixed with the ordinary functions, which must agree with
+ * them.
+ * @param parser			The parser.
+ * @param text				The text.
+ * @param what				What kind of parser this is, for messages.
+ */
+static void
+check_inline(Parser parser, char * text, char * what) {
+	size_t len = strlen(text);
+	size_t index = 0;
+	while (index < len) {
+		// Peeking out of line and consuming inline must not look like a
+		// stall, however long it goes on.
+		if (spsps_peek(parser) != text[index] ||
+				spsps_peek_inline(parser) != text[index] ||
+				spsps_consume_inline(parser) != text[index]) {
+			ERR("The inline %s parser is wrong at %lu.", what, index);
+			return;
+		}
+		++index;
+		if (index % 100 == 0 && index + 10 <= len) {
+			size_t available = 0;
+			const SPSPS_CHAR * window = spsps_window_inline(parser, 10,
+					&available);
+			if (available < 10 || memcmp(window, text + index, 10) != 0) {
+				ERR("The inline %s window is wrong at %lu.", what, index);
+				return;
+			}
+			spsps_consume_n_inline(parser, 10);
+			index += 10;
+		}
+	} // Consume the text.
+	if (spsps_offset(parser) != len) {
+		ERR("The inline %s parser stopped at %" PRIu64 ".", what,
+				spsps_offset(parser));
+	}
+	if (spsps_peek_inline(parser) != SPSPS_EOF ||
+			spsps_consume_inline(parser) != SPSPS_EOF ||
+			! spsps_eof(parser)) {
+		ERR("The inline %s parser did not end.", what);
+	}
+}
+
+/**
+ * Test the inline functions.
+ */
+void
+inline_test() {
+	size_t len = 3 * SPSPS_LOOK + 17;
+	char * text = (char *) malloc(len + 1);
+	for (size_t index = 0; index < len; ++index) {
+		text[index] = (index % 41 == 40) ? '\n' : (char) ('a' + index % 26);
+	} // Build the text.
+	text[len] = 0;
+
+	Parser parser = spsps_new_buffer("buffer", text, len);
+	check_inline(parser, text, "buffer");
+	spsps_free(parser);
+
+	write_scratch(text);
+	FILE * stream = fopen(SCRATCH, "rb");
+	spsps_options options = { 0 };
+	options.block = 7;
+	parser = spsps_new_ex(SCRATCH, stream, &options);
+	check_inline(parser, text, "stream");
+	spsps_free(parser);
+	fclose(stream);
+	remove(SCRATCH);
+
+	test_source source = { text, len, 0, 5, 0 };
+	spsps_source mapper = { NULL, test_map, test_close };
+	parser = spsps_new_source("map", &mapper, &source);
+	check_inline(parser, text, "map");
+	spsps_free(parser);
+
+	// Peeking inline without consuming is a stall, as it is out of line.
+	parser = spsps_new_buffer("buffer", text, len);
+	for (size_t round = 0; round < SPSPS_STALL_LOOKS; ++round) {
+		if (spsps_peek_inline(parser) != text[0]) {
+			ERR("An inline peek stalled early, on round %lu.", round);
+			break;
+		}
+	} // Peek up to the stall.
+	if (spsps_peek_inline(parser) != SPSPS_EOF ||
+			spsps_get_errno(parser) != STALLED) {
+		ERR("Peeking inline without consuming was not a stall.");
+	}
+	spsps_consume_inline(parser);
+	if (spsps_peek_inline(parser) != text[1]) {
+		ERR("Consuming inline did not end the stall.");
+	}
+
+	// The counters see the inline calls as well as the library calls.
+	spsps_parser_stats before, after;
+	if (spsps_stats(parser, &before)) {
+		for (size_t round = 0; round < 5; ++round) {
+			spsps_consume_inline(parser);
+			spsps_consume(parser);
+		} // Consume both ways.
+		spsps_stats(parser, &after);
+		if (after.consumed - before.consumed != 10 ||
+				after.consumes - before.consumes != 10) {
+			ERR("The counters saw %" PRIu64 " of 10 characters consumed.",
+					after.consumed - before.consumed);
+		}
+	}
+	spsps_free(parser);
+	free(text);
+}
+
+/**
+ * Test views of the lookahead, and that the end of input is never mistaken
+ * for a character.
+ */
+void
+view_test() {
+	// A 0xff byte is a character like any other.
+	char text[] = "ab\xff\xff";
+	Parser parser = spsps_new_buffer("binary", text, 4);
+	if (! spsps_peek_str(parser, "ab\xff\xff") ||
+			spsps_peek_str(parser, "ab\xff\xff\xff")) {
+		ERR("A string of 0xff bytes was matched past the end of input.");
+	}
+	const SPSPS_CHAR * view = spsps_peek_view(parser, 4);
+	if (view == NULL || memcmp(view, text, 4) != 0 ||
+			spsps_peek_view(parser, 5) != NULL) {
+		ERR("The view of binary input is wrong.");
+	}
+	spsps_consume_n(parser, 4);
+	if (spsps_peek_str(parser, "\xff") || spsps_peek_view(parser, 1) != NULL) {
+		ERR("The end of input was mistaken for a 0xff byte.");
+	}
+	spsps_free(parser);
+
+	// The empty string is next even in empty input, which has no buffer.
+	parser = spsps_new_buffer("empty", "", 0);
+	if (! spsps_peek_str(parser, "") || spsps_get_errno(parser) != OK) {
+		ERR("The empty string was not seen in empty input.");
+	}
+	spsps_free(parser);
+
+	// Long lookahead across many refills is one contiguous view, and does
+	// not look like a stall.
+	size_t len = 2 * SPSPS_LOOK + 21;
+	char * long_text = (char *) malloc(len + 1);
+	for (size_t index = 0; index < len; ++index) {
+		long_text[index] = (char) ('a' + (index * 3) % 26);
+	} // Build the text.
+	long_text[len] = 0;
+	write_scratch(long_text);
+	FILE * stream = fopen(SCRATCH, "rb");
+	spsps_options options = { 0 };
+	options.block = 7;
+	parser = spsps_new_ex(SCRATCH, stream, &options);
+	spsps_consume_n(parser, 3);
+	view = spsps_peek_view(parser, len - 3);
+	if (view == NULL || memcmp(view, long_text + 3, len - 3) != 0) {
+		ERR("A long view across refills is wrong.");
+	}
+	size_t round = 0;
+	while (round < 1200 && spsps_peek_str(parser, long_text + 3)) ++round;
+	if (round != 1000 || spsps_get_errno(parser) != STALLED) {
+		ERR("Matching without progress stopped after %lu rounds.", round);
+	}
+	spsps_free(parser);
+	fclose(stream);
+	remove(SCRATCH);
+	free(long_text);
+}
+
+/**
+ * Check skipping on the given parser, which must be reading the text built
+ * by skip_test: numbered tokens separated by whitespace and comments.
+ * @param parser			The parser.
+ * @param skip				The skip set.
+ * @param count				The number of tokens.
+ * @param what				What kind of parser this is, for messages.
+ */
+static void
+check_skip(Parser parser, SkipSet skip, size_t count, char * what) {
+	for (size_t index = 0; index < count; ++index) {
+		spsps_skip(parser, skip);
+		char token[32], expect[32];
+		size_t length = spsps_take_while(parser, "tok0123456789", token, 31);
+		token[length] = 0;
+		snprintf(expect, sizeof(expect), "tok%lu", index);
+		if (strcmp(token, expect) != 0) {
+			ERR("The %s parser found \"%s\" instead of %s.", what, token,
+					expect);
+			return;
+		}
+	} // Find every token.
+	spsps_skip(parser, skip);
+	if (spsps_get_errno(parser) != OK || spsps_peek(parser) != SPSPS_EOF) {
+		ERR("The %s parser did not skip to the end.", what);
+	}
+}
+
+/**
+ * Test skipping whitespace and comments.
+ */
+void
+skip_test() {
+	char * line[] = { "#", "//", NULL };
+	char * block[] = { "/*", "*/", "#|", "|#", NULL };
+	SkipSet skip = spsps_skip_compile(NULL, line, block);
+	char * text = "  # one\n\t// two\n/* three\n * ** */ x/**/y/ #| a\nb |#z";
+	Parser parser = spsps_new_buffer("skip", text, strlen(text));
+	size_t count = spsps_skip(parser, skip);
+	Loc loc = spsps_location(parser);
+	if (count != 34 || spsps_peek(parser) != 'x' || loc.line != 4 ||
+			loc.column != 10) {
+		ERR("Skipping stopped at %" PRIu64 ":%" PRIu64 " after %lu "
+				"characters.", loc.line, loc.column, count);
+	}
+	spsps_consume(parser);
+	if (spsps_skip(parser, skip) != 4 || spsps_consume(parser) != 'y') {
+		ERR("An empty block comment was not skipped.");
+	}
+	// A lone slash does not start a comment.
+	if (spsps_skip(parser, skip) != 0 || spsps_consume(parser) != '/') {
+		ERR("A slash was mistaken for a comment.");
+	}
+	// The longer delimiter wins over a line comment that is its prefix.
+	if (spsps_skip(parser, skip) != 10 || spsps_consume(parser) != 'z') {
+		ERR("A block comment was taken for a line comment.");
+	}
+	spsps_free(parser);
+
+	text = "  /* never closed *";
+	parser = spsps_new_buffer("unterminated", text, strlen(text));
+	if (spsps_skip(parser, skip) != strlen(text) ||
+			spsps_get_errno(parser) != UNTERMINATED_COMMENT) {
+		ERR("An unterminated comment was not reported.");
+	}
+	spsps_free(parser);
+
+	// When newlines are not whitespace, a line comment stops before one.
+	CharClass blanks = spsps_class_new(" \t");
+	SkipSet tight = spsps_skip_compile(blanks, line, NULL);
+	spsps_class_free(blanks);
+	text = " # comment\n";
+	parser = spsps_new_buffer("tight", text, strlen(text));
+	if (spsps_skip(parser, tight) != 10 || spsps_peek(parser) != '\n') {
+		ERR("A line comment consumed its newline.");
+	}
+	spsps_free(parser);
+	spsps_skip_free(tight);
+
+	// Comments and whitespace that cross many refills.
+	size_t tokens = 500;
+	size_t size = tokens * 64;
+	char * long_text = (char *) malloc(size);
+	size_t len = 0;
+	for (size_t index = 0; index < tokens; ++index) {
+		len += (size_t) snprintf(long_text + len, size - len,
+				"tok%lu /* c o m * m e n t */ // line\n  # hash\n\t", index);
+	} // Build the text.
+	parser = spsps_new_buffer("buffer", long_text, len);
+	check_skip(parser, skip, tokens, "buffer");
+	spsps_free(parser);
+	write_scratch(long_text);
+	FILE * stream = fopen(SCRATCH, "rb");
+	spsps_options options = { 0 };
+	options.block = 7;
+	parser = spsps_new_ex(SCRATCH, stream, &options);
+	check_skip(parser, skip, tokens, "stream");
+	spsps_free(parser);
+	fclose(stream);
+	remove(SCRATCH);
+	free(long_text);
+	spsps_skip_free(skip);
+}
+
+int main(int argc, char * argv[]) {
+	error_count = 0;
+	mmap_test();
+	buffer_test();
+	scanner_test();
+	mark_test();
+	checkpoint_test();
+	push_test();
+	readahead_test();
+	keyword_test();
+	class_test();
+	error_test();
+	utf8_test();
+	stats_test();
+	reset_test();
+	options_test();
+	number_test();
+	source_test();
+	iov_test();
+	inline_test();
+	view_test();
+	skip_test();
+	if (error_count > 0) {
+		fprintf(stderr, "%d errors.\n", error_count);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,1408 @@
+/**
+ * @file
+ * Generate a C parser from a small declarative grammar.
+ *
+ * @verbatim
+ * SPSPS
+ * Stacy's Pathetically Simple Parsing System
+ * https://github.com/sprowell/spsps
+ *
+ * Copyright (c) 2014, Stacy Prowell
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ * @endverbatim
+ *
+ * Usage: spsps_gen grammar output.c output.h
+ *
+ * A grammar is a list of directives and rules.  Comments run from a hash
+ * mark to the end of the line.
+ * @verbatim
+ * %prefix json            # Prefix for every generated name.
+ * %start document         # The rule that json_parse runs.
+ * document = ws value ;
+ * @number = '-'? [0-9]+ ( '.' [0-9]+ )? ;
+ * @endverbatim
+ * Expressions are built from literals ('x' or "xyz", with the escapes \\n,
+ * \\r, \\t, \\xHH and \\ followed by any other character), character classes
+ * ([a-z_], or [^"\\] for the complement), the dot for any character, rule
+ * names, sequences, ordered choice (|), grouping, the postfix repetitions
+ * *, + and ?, and the predicates !e and &e, which consume nothing.
+ *
+ * A rule marked with @ is hooked: when it matches, the generated code calls
+ * prefix_on_rule(context, text, length) with the matched characters, taken
+ * straight from the parser's buffer.  The caller writes those functions and
+ * builds whatever it likes from the events.
+ *
+ * The generated parser matches exactly what a PEG matches, but only
+ * backtracks where it has to.  If the alternatives of a choice start with
+ * disjoint sets of characters, and none of them can match the empty string,
+ * the choice becomes a switch on the next character, since no other
+ * alternative could match.  A repetition or option whose body cannot match
+ * the empty string is only tried when the next character can start the
+ * body.  If the body can still fail after consuming something, the next few
+ * characters are checked first where that settles it, as for ( '.' [0-9]+ )?,
+ * and a checkpoint is taken otherwise.  A rule that fails leaves the input
+ * where it found it.  Write grammars the way the hand-written parsers are
+ * written: whitespace after tokens, no left recursion, and a token's first
+ * character telling you which token it is; then the generated code rarely
+ * needs a checkpoint.
+ */
+
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//======================================================================
+// Grammar representation.
+//======================================================================
+
+/// A set of characters.  Characters beyond 255 are all in or all out.
+typedef struct charset_ {
+	unsigned char bits[32];		///< One bit per character below 256.
+	bool high;					///< Whether characters above 255 are in.
+} charset;
+
+/// The kinds of expression.
+typedef enum kind_ {
+	K_EMPTY,	///< Matches the empty string.
+	K_SET,		///< Matches one character from a set.
+	K_STRING,	///< Matches a literal string of two or more characters.
+	K_RULE,		///< Matches a rule.
+	K_SEQ,		///< Matches a sequence.
+	K_CHOICE,	///< Matches the first alternative that matches.
+	K_STAR,		///< Zero or more.
+	K_PLUS,		///< One or more.
+	K_OPT,		///< Zero or one.
+	K_NOT,		///< Negative lookahead.
+	K_AND,		///< Positive lookahead.
+} kind;
+
+/// An expression in the grammar.
+typedef struct node_ {
+	kind kind;					///< The kind of the expression.
+	charset chars;				///< The characters of a set.
+	char * text;				///< The text of a string or rule name.
+	size_t length;				///< The length of a string.
+	int rule;					///< The index of a referenced rule.
+	int literal;				///< The index of a string's array.
+	int line;					///< Line of the grammar, for messages.
+	struct node_ ** kids;		///< The subexpressions.
+	size_t count;				///< The number of subexpressions.
+	bool nullable;				///< Whether the empty string matches.
+	charset first;				///< Characters that can start a match.
+} node;
+
+/// A rule of the grammar.
+typedef struct rule_ {
+	char * name;				///< The name of the rule.
+	node * body;				///< The expression.
+	bool hook;					///< Whether the rule reports matches.
+	int line;					///< Line of the definition.
+	bool used;					///< Whether the rule is reachable.
+} rule;
+
+static const char * grammar_name_;
+static rule * rules_ = NULL;
+static size_t rule_count_ = 0;
+static char * prefix_ = NULL;
+static char * start_ = NULL;
+
+/**
+ * Report an error in the grammar and stop.
+ * @param line				The line number, or zero if there is none.
+ * @param format			A printf-style format string.
+ */
+static void
+die_(int line, const char * format, ...) {
+	va_list ap;
+	va_start(ap, format);
+	if (line > 0) {
+		fprintf(stderr, "%s:%d: ", grammar_name_, line);
+	} else {
+		fprintf(stderr, "%s: ", grammar_name_);
+	}
+	vfprintf(stderr, format, ap);
+	fputc('\n', stderr);
+	va_end(ap);
+	exit(1);
+}
+
+static void
+set_add_(charset * set, unsigned ch) {
+	set->bits[ch >> 3] |= (unsigned char) (1u << (ch & 7));
+}
+
+static bool
+set_has_(const charset * set, unsigned ch) {
+	return (set->bits[ch >> 3] >> (ch & 7)) & 1;
+}
+
+static bool
+set_union_(charset * into, const charset * from) {
+	bool changed = false;
+	for (size_t index = 0; index < 32; ++index) {
+		unsigned char bits = into->bits[index] | from->bits[index];
+		changed |= bits != into->bits[index];
+		into->bits[index] = bits;
+	} // Merge the bits.
+	changed |= from->high && ! into->high;
+	into->high |= from->high;
+	return changed;
+}
+
+static bool
+set_disjoint_(const charset * a, const charset * b) {
+	for (size_t index = 0; index < 32; ++index) {
+		if (a->bits[index] & b->bits[index]) return false;
+	} // Check the bits.
+	return ! (a->high && b->high);
+}
+
+static size_t
+set_size_(const charset * set) {
+	size_t count = 0;
+	for (unsigned ch = 0; ch < 256; ++ch) count += set_has_(set, ch);
+	return count;
+}
+
+static node *
+new_node_(kind kind, int line) {
+	node * result = (node *) calloc(1, sizeof(node));
+	result->kind = kind;
+	result->line = line;
+	result->rule = -1;
+	return result;
+}
+
+static void
+add_kid_(node * parent, node * kid) {
+	parent->kids = (node **) realloc(parent->kids,
+			sizeof(node *) * (parent->count + 1));
+	parent->kids[parent->count++] = kid;
+}
+
+//======================================================================
+// Reading the grammar.
+//======================================================================
+
+static const char * src_;
+static int line_ = 1;
+
+static bool
+is_name_char_(char ch) {
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+			(ch >= '0' && ch <= '9') || ch == '_';
+}
+
+static void
+skip_space_() {
+	while (*src_ != 0) {
+		if (*src_ == '\n') {
+			++line_;
+			++src_;
+		} else if (*src_ == ' ' || *src_ == '\t' || *src_ == '\r') {
+			++src_;
+		} else if (*src_ == '#') {
+			while (*src_ != 0 && *src_ != '\n') ++src_;
+		} else {
+			break;
+		}
+	} // Skip whitespace and comments.
+}
+
+static char *
+read_name_() {
+	const char * start = src_;
+	while (is_name_char_(*src_)) ++src_;
+	if (src_ == start) die_(line_, "expected a name");
+	size_t length = (size_t) (src_ - start);
+	char * name = (char *) malloc(length + 1);
+	memcpy(name, start, length);
+	name[length] = 0;
+	return name;
+}
+
+static int
+unhex_(char ch) {
+	if (ch >= '0' && ch <= '9') return ch - '0';
+	if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+	if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+	die_(line_, "expected a hexadecimal digit");
+	return 0;
+}
+
+/**
+ * Read one possibly-escaped character of a literal or class.
+ * @return					The character.
+ */
+static unsigned
+read_char_() {
+	if (*src_ == 0 || *src_ == '\n') die_(line_, "unterminated literal");
+	if (*src_ != '\\') return (unsigned char) *src_++;
+	++src_;
+	char ch = *src_++;
+	switch (ch) {
+	case 'n': return '\n';
+	case 'r': return '\r';
+	case 't': return '\t';
+	case 'x': {
+		int high = unhex_(*src_++);
+		int low = unhex_(*src_++);
+		return (unsigned) (high << 4 | low);
+	}
+	case 0: die_(line_, "unterminated literal");
+	default: return (unsigned char) ch;
+	}
+}
+
+static node * read_choice_();
+
+/**
+ * Replace a sequence or choice of one item with the item.
+ * @param wrap				The sequence or choice.
+ * @return					Its only item.
+ */
+static node *
+unwrap_(node * wrap) {
+	node * kid = wrap->kids[0];
+	free(wrap->kids);
+	free(wrap);
+	return kid;
+}
+
+static node *
+read_primary_() {
+	node * result;
+	if (*src_ == '(') {
+		++src_;
+		skip_space_();
+		result = read_choice_();
+		if (*src_ != ')') die_(line_, "expected a closing parenthesis");
+		++src_;
+	} else if (*src_ == '.') {
+		++src_;
+		result = new_node_(K_SET, line_);
+		memset(result->chars.bits, 0xff, 32);
+		result->chars.high = true;
+	} else if (*src_ == '[') {
+		++src_;
+		result = new_node_(K_SET, line_);
+		bool negate = *src_ == '^';
+		if (negate) ++src_;
+		while (*src_ != ']') {
+			unsigned low = read_char_();
+			unsigned high = low;
+			if (*src_ == '-' && src_[1] != ']') {
+				++src_;
+				high = read_char_();
+			}
+			if (high < low) die_(line_, "backwards range in a class");
+			for (unsigned ch = low; ch <= high; ++ch) {
+				set_add_(&result->chars, ch);
+			} // Add the range.
+		} // Read the class.
+		++src_;
+		if (negate) {
+			for (size_t index = 0; index < 32; ++index) {
+				result->chars.bits[index] ^= 0xff;
+			} // Complement the class.
+			result->chars.high = true;
+		}
+	} else if (*src_ == '\'' || *src_ == '"') {
+		char quote = *src_++;
+		char * text = NULL;
+		size_t length = 0;
+		while (*src_ != quote) {
+			text = (char *) realloc(text, length + 2);
+			text[length++] = (char) read_char_();
+		} // Read the literal.
+		++src_;
+		if (length == 0) {
+			result = new_node_(K_EMPTY, line_);
+			free(text);
+		} else if (length == 1) {
+			result = new_node_(K_SET, line_);
+			set_add_(&result->chars, (unsigned char) text[0]);
+			free(text);
+		} else {
+			result = new_node_(K_STRING, line_);
+			text[length] = 0;
+			result->text = text;
+			result->length = length;
+		}
+	} else if (is_name_char_(*src_)) {
+		result = new_node_(K_RULE, line_);
+		result->text = read_name_();
+	} else {
+		die_(line_, "unexpected character '%c' in an expression", *src_);
+		return NULL;
+	}
+	skip_space_();
+	return result;
+}
+
+static node *
+read_postfix_() {
+	node * result = read_primary_();
+	while (*src_ == '*' || *src_ == '+' || *src_ == '?') {
+		node * wrap = new_node_(*src_ == '*' ? K_STAR :
+				*src_ == '+' ? K_PLUS : K_OPT, line_);
+		add_kid_(wrap, result);
+		result = wrap;
+		++src_;
+		skip_space_();
+	} // Apply all repetitions.
+	return result;
+}
+
+static node *
+read_prefix_() {
+	if (*src_ == '!' || *src_ == '&') {
+		node * result = new_node_(*src_ == '!' ? K_NOT : K_AND, line_);
+		++src_;
+		skip_space_();
+		add_kid_(result, read_postfix_());
+		return result;
+	}
+	return read_postfix_();
+}
+
+static node *
+read_sequence_() {
+	node * result = new_node_(K_SEQ, line_);
+	while (*src_ != 0 && *src_ != '|' && *src_ != ';' && *src_ != ')') {
+		add_kid_(result, read_prefix_());
+	} // Read the items.
+	if (result->count == 0) result->kind = K_EMPTY;
+	return result->count == 1 ? unwrap_(result) : result;
+}
+
+static node *
+read_choice_() {
+	node * result = new_node_(K_CHOICE, line_);
+	add_kid_(result, read_sequence_());
+	while (*src_ == '|') {
+		++src_;
+		skip_space_();
+		add_kid_(result, read_sequence_());
+	} // Read the alternatives.
+	return result->count == 1 ? unwrap_(result) : result;
+}
+
+static void
+read_grammar_() {
+	skip_space_();
+	while (*src_ != 0) {
+		if (*src_ == '%') {
+			++src_;
+			char * directive = read_name_();
+			skip_space_();
+			char * value = read_name_();
+			if (strcmp(directive, "prefix") == 0) {
+				prefix_ = value;
+			} else if (strcmp(directive, "start") == 0) {
+				start_ = value;
+			} else {
+				die_(line_, "unknown directive %%%s", directive);
+			}
+			free(directive);
+		} else {
+			rules_ = (rule *) realloc(rules_,
+					sizeof(rule) * (rule_count_ + 1));
+			rule * here = &rules_[rule_count_++];
+			memset(here, 0, sizeof(rule));
+			here->line = line_;
+			if (*src_ == '@') {
+				here->hook = true;
+				++src_;
+			}
+			here->name = read_name_();
+			skip_space_();
+			if (*src_ != '=') die_(line_, "expected = after %s", here->name);
+			++src_;
+			skip_space_();
+			here->body = read_choice_();
+			if (*src_ != ';') die_(line_, "expected ; to end %s", here->name);
+			++src_;
+		}
+		skip_space_();
+	} // Read everything.
+	if (prefix_ == NULL) die_(0, "no %%prefix given");
+	if (rule_count_ == 0) die_(0, "no rules");
+	if (start_ == NULL) start_ = rules_[0].name;
+}
+
+//======================================================================
+// Analysis.
+//======================================================================
+
+static int
+find_rule_(const char * name) {
+	for (size_t index = 0; index < rule_count_; ++index) {
+		if (strcmp(rules_[index].name, name) == 0) return (int) index;
+	} // Search the rules.
+	return -1;
+}
+
+static void
+resolve_(node * here) {
+	if (here->kind == K_RULE) {
+		here->rule = find_rule_(here->text);
+		if (here->rule < 0) die_(here->line, "no rule named %s", here->text);
+	}
+	for (size_t index = 0; index < here->count; ++index) {
+		resolve_(here->kids[index]);
+	} // Resolve the subexpressions.
+}
+
+static void
+mark_used_(node * here) {
+	if (here->kind == K_RULE && ! rules_[here->rule].used) {
+		rules_[here->rule].used = true;
+		mark_used_(rules_[here->rule].body);
+	}
+	for (size_t index = 0; index < here->count; ++index) {
+		mark_used_(here->kids[index]);
+	} // Mark the subexpressions.
+}
+
+/**
+ * Compute whether an expression is nullable, and what characters can start
+ * it, from what is currently known about the rules.
+ * @param here				The expression.
+ * @return					Whether anything changed.
+ */
+static bool
+analyze_(node * here) {
+	bool changed = false;
+	for (size_t index = 0; index < here->count; ++index) {
+		changed |= analyze_(here->kids[index]);
+	} // Analyze the subexpressions first.
+	bool nullable = here->nullable;
+	charset first = here->first;
+	switch (here->kind) {
+	case K_EMPTY:
+		nullable = true;
+		break;
+	case K_SET:
+		first = here->chars;
+		break;
+	case K_STRING:
+		set_add_(&first, (unsigned char) here->text[0]);
+		break;
+	case K_RULE:
+		nullable = rules_[here->rule].body->nullable;
+		set_union_(&first, &rules_[here->rule].body->first);
+		break;
+	case K_SEQ:
+		nullable = true;
+		for (size_t index = 0; index < here->count && nullable; ++index) {
+			set_union_(&first, &here->kids[index]->first);
+			nullable = here->kids[index]->nullable;
+		} // Collect until something must consume.
+		break;
+	case K_CHOICE:
+		for (size_t index = 0; index < here->count; ++index) {
+			set_union_(&first, &here->kids[index]->first);
+			nullable |= here->kids[index]->nullable;
+		} // Collect all alternatives.
+		break;
+	case K_PLUS:
+		nullable = here->kids[0]->nullable;
+		set_union_(&first, &here->kids[0]->first);
+		break;
+	case K_STAR:
+	case K_OPT:
+		nullable = true;
+		set_union_(&first, &here->kids[0]->first);
+		break;
+	case K_NOT:
+	case K_AND:
+		// Predicates consume nothing, so whatever follows decides.
+		nullable = true;
+		break;
+	}
+	changed |= nullable != here->nullable;
+	changed |= set_union_(&here->first, &first);
+	here->nullable = nullable;
+	return changed;
+}
+
+static bool
+left_recursive_(node * here, int target, bool * seen) {
+	switch (here->kind) {
+	case K_RULE:
+		if (here->rule == target) return true;
+		if (seen[here->rule]) return false;
+		seen[here->rule] = true;
+		return left_recursive_(rules_[here->rule].body, target, seen);
+	case K_SEQ:
+		for (size_t index = 0; index < here->count; ++index) {
+			if (left_recursive_(here->kids[index], target, seen)) return true;
+			if (! here->kids[index]->nullable) break;
+		} // Check the leading items.
+		return false;
+	default:
+		for (size_t index = 0; index < here->count; ++index) {
+			if (left_recursive_(here->kids[index], target, seen)) return true;
+		} // Check the subexpressions.
+		return false;
+	}
+}
+
+static void
+check_loops_(node * here) {
+	if ((here->kind == K_STAR || here->kind == K_PLUS) &&
+			here->kids[0]->nullable) {
+		fprintf(stderr, "%s:%d: warning: the body of a repetition can match "
+				"the empty string\n", grammar_name_, here->line);
+	}
+	for (size_t index = 0; index < here->count; ++index) {
+		check_loops_(here->kids[index]);
+	} // Check the subexpressions.
+}
+
+static void
+analyze_grammar_() {
+	for (size_t index = 0; index < rule_count_; ++index) {
+		if (find_rule_(rules_[index].name) != (int) index) {
+			die_(rules_[index].line, "rule %s is defined twice",
+					rules_[index].name);
+		}
+		resolve_(rules_[index].body);
+	} // Resolve all rule references.
+	int start = find_rule_(start_);
+	if (start < 0) die_(0, "no start rule named %s", start_);
+	rules_[start].used = true;
+	mark_used_(rules_[start].body);
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (size_t index = 0; index < rule_count_; ++index) {
+			changed |= analyze_(rules_[index].body);
+		} // Analyze every rule.
+	} // Iterate to a fixed point.
+	bool * seen = (bool *) malloc(rule_count_);
+	for (size_t index = 0; index < rule_count_; ++index) {
+		memset(seen, 0, rule_count_);
+		if (left_recursive_(rules_[index].body, (int) index, seen)) {
+			die_(rules_[index].line, "rule %s is left recursive",
+					rules_[index].name);
+		}
+		check_loops_(rules_[index].body);
+	} // Check every rule.
+	free(seen);
+}
+
+//======================================================================
+// Code generation.
+//======================================================================
+
+/// A growable buffer for generated text.
+typedef struct text_ {
+	char * data;
+	size_t length;
+	size_t capacity;
+} text;
+
+static void
+emit_(text * out, int indent, const char * format, ...) {
+	char line[1024];
+	va_list ap;
+	va_start(ap, format);
+	int length = vsnprintf(line, sizeof(line), format, ap);
+	va_end(ap);
+	size_t need = out->length + (size_t) indent + (size_t) length + 2;
+	if (need > out->capacity) {
+		out->capacity = need * 2;
+		out->data = (char *) realloc(out->data, out->capacity);
+	}
+	for (int count = 0; count < indent; ++count) {
+		out->data[out->length++] = '\t';
+	} // Indent.
+	memcpy(out->data + out->length, line, (size_t) length);
+	out->length += (size_t) length;
+	out->data[out->length++] = '\n';
+	out->data[out->length] = 0;
+}
+
+static void
+append_(text * out, const char * data, size_t length) {
+	if (out->length + length + 1 > out->capacity) {
+		out->capacity = (out->length + length + 1) * 2;
+		out->data = (char *) realloc(out->data, out->capacity);
+	}
+	memcpy(out->data + out->length, data, length);
+	out->length += length;
+	out->data[out->length] = 0;
+}
+
+/// The character sets that need tables in the generated code.
+static charset * tables_ = NULL;
+static size_t table_count_ = 0;
+
+/// Per-rule state while generating.
+static int label_count_;
+static bool * label_used_;
+static int checkpoints_;
+static bool uses_ch_;
+
+static size_t
+table_for_(const charset * set) {
+	for (size_t index = 0; index < table_count_; ++index) {
+		if (memcmp(&tables_[index], set, sizeof(charset)) == 0) return index;
+	} // Reuse an existing table.
+	tables_ = (charset *) realloc(tables_,
+			sizeof(charset) * (table_count_ + 1));
+	tables_[table_count_] = *set;
+	return table_count_++;
+}
+
+static int
+new_label_() {
+	label_used_ = (bool *) realloc(label_used_, (size_t) label_count_ + 1);
+	label_used_[label_count_] = false;
+	return label_count_++;
+}
+
+static const char *
+goto_(int label) {
+	static char buf[32];
+	label_used_[label] = true;
+	snprintf(buf, sizeof(buf), "goto L%d_;", label);
+	return buf;
+}
+
+static void
+emit_label_(text * out, int indent, int label) {
+	if (label_used_[label]) emit_(out, indent > 0 ? indent - 1 : 0,
+			"L%d_:", label);
+}
+
+/**
+ * Write a C expression testing whether ch is in a set.
+ * @param buf				Where to write the expression.
+ * @param size				The size of the buffer.
+ * @param set				The set.
+ */
+static void
+test_(char * buf, size_t size, const charset * set) {
+	size_t count = set_size_(set);
+	if (count == 1 && ! set->high) {
+		for (unsigned ch = 0; ch < 256; ++ch) {
+			if (set_has_(set, ch)) snprintf(buf, size, "ch == %u", ch);
+		} // Find the character.
+		return;
+	}
+	snprintf(buf, size, "%s_IN_(%s_set%zu_, %d, ch)", prefix_, prefix_,
+			table_for_(set), set->high ? 1 : 0);
+}
+
+static bool
+atomic_(const node * here) {
+	return here->kind == K_SET || here->kind == K_STRING ||
+			here->kind == K_EMPTY;
+}
+
+/**
+ * Whether an expression always matches, if only the empty string.
+ * @param here				The expression.
+ * @return					True iff the generated code never fails.
+ */
+static bool
+never_fails_(const node * here) {
+	switch (here->kind) {
+	case K_EMPTY:
+	case K_STAR:
+	case K_OPT:
+		return true;
+	case K_SEQ:
+		for (size_t index = 0; index < here->count; ++index) {
+			if (! never_fails_(here->kids[index])) return false;
+		} // Check every item.
+		return true;
+	case K_RULE:
+		// This cannot recurse forever: an item is only reached if those
+		// before it can match the empty string, and the grammar has no left
+		// recursion.
+		return never_fails_(rules_[here->rule].body);
+	default:
+		return false;
+	}
+}
+
+/**
+ * Whether the next character decides between the alternatives of a choice:
+ * they start with disjoint sets of characters, and none can match the empty
+ * string.
+ * @param here				The choice.
+ * @return					True iff the choice can be a switch.
+ */
+static bool
+decides_(const node * here) {
+	bool decides = true;
+	for (size_t index = 0; index < here->count && decides; ++index) {
+		decides = ! here->kids[index]->nullable;
+		for (size_t other = 0; other < index && decides; ++other) {
+			decides = set_disjoint_(&here->kids[index]->first,
+					&here->kids[other]->first);
+		} // Compare with the earlier alternatives.
+	} // Check that the first character decides.
+	return decides;
+}
+
+/**
+ * Whether the generated code for an expression consumes nothing when it
+ * fails, so that nothing has to be restored.  Generated rules restore the
+ * input when they fail, so a rule reference qualifies.
+ * @param here				The expression.
+ * @return					True iff a failure leaves the input alone.
+ */
+static bool
+fails_clean_(const node * here) {
+	switch (here->kind) {
+	case K_SEQ:
+		if (here->count > 0 && ! fails_clean_(here->kids[0])) return false;
+		for (size_t index = 1; index < here->count; ++index) {
+			if (! never_fails_(here->kids[index])) return false;
+		} // Check that nothing after the first item can fail.
+		return true;
+	case K_CHOICE:
+		// A choice that backtracks restores each alternative itself.
+		if (! decides_(here)) return true;
+		for (size_t index = 0; index < here->count; ++index) {
+			if (! fails_clean_(here->kids[index])) return false;
+		} // Check every alternative.
+		return true;
+	case K_PLUS:
+		return fails_clean_(here->kids[0]);
+	default:
+		return true;
+	}
+}
+
+/// The most characters a guard looks at.
+#define GUARD_LOOK (16)
+
+/**
+ * Whether an expression that can fail after consuming something can instead
+ * be checked in advance, by looking at the next few characters.  That is so
+ * if it starts with single characters, optional single characters, and
+ * literals, perhaps ending with a run of a class, and nothing after them can
+ * fail.
+ * @param here				The expression.
+ * @param look				Set to the most characters the check looks at.
+ * @return					True iff the expression can be checked in advance.
+ */
+static bool
+guarded_(node * here, size_t * look) {
+	node ** items = here->kind == K_SEQ ? here->kids : &here;
+	size_t count = here->kind == K_SEQ ? here->count : 1;
+	size_t index = 0;
+	*look = 0;
+	for (; index < count; ++index) {
+		node * item = items[index];
+		if (item->kind == K_SET || (item->kind == K_OPT &&
+				item->kids[0]->kind == K_SET)) {
+			++*look;
+		} else if (item->kind == K_STRING) {
+			*look += item->length;
+		} else if (item->kind == K_PLUS && item->kids[0]->kind == K_SET) {
+			// Where the run ends is not known, so this is the last item
+			// that can be checked.
+			++*look;
+			++index;
+			break;
+		} else {
+			break;
+		}
+	} // Find the items that can be checked.
+	for (; index < count; ++index) {
+		if (! never_fails_(items[index])) return false;
+	} // Check that nothing after them can fail.
+	return *look <= GUARD_LOOK;
+}
+
+/**
+ * Generate the check of an expression accepted by guarded_, which jumps to
+ * the fail label if the expression would not match.
+ */
+static void
+gen_guard_(text * out, node * here, size_t look, int fail, int indent) {
+	char test[128];
+	node ** items = here->kind == K_SEQ ? here->kids : &here;
+	size_t count = here->kind == K_SEQ ? here->count : 1;
+	uses_ch_ = true;
+	emit_(out, indent, "{");
+	emit_(out, indent + 1, "size_t at = 0, available;");
+	emit_(out, indent + 1, "const SPSPS_CHAR * window = "
+			"spsps_window_inline(parser, %zu,", look);
+	emit_(out, indent + 3, "&available);");
+	for (size_t index = 0; index < count; ++index) {
+		node * item = items[index];
+		if (item->kind == K_STRING) {
+			for (size_t at = 0; at < item->length; ++at) {
+				emit_(out, indent + 1, "if (at == available || %s_CODE_("
+						"window[at]) != %u) %s", prefix_,
+						(unsigned char) item->text[at], goto_(fail));
+				emit_(out, indent + 1, "++at;");
+			} // Check each character.
+			continue;
+		}
+		if (item->kind == K_OPT) {
+			test_(test, sizeof(test), &item->kids[0]->chars);
+			emit_(out, indent + 1, "if (at < available) {");
+			emit_(out, indent + 2, "ch = %s_CODE_(window[at]);", prefix_);
+			emit_(out, indent + 2, "if (%s) ++at;", test);
+			emit_(out, indent + 1, "}");
+			continue;
+		}
+		if (item->kind != K_SET && item->kind != K_PLUS) break;
+		test_(test, sizeof(test), item->kind == K_SET ? &item->chars :
+				&item->kids[0]->chars);
+		emit_(out, indent + 1, "if (at == available) %s", goto_(fail));
+		emit_(out, indent + 1, "ch = %s_CODE_(window[at]);", prefix_);
+		emit_(out, indent + 1, "if (! (%s)) %s", test, goto_(fail));
+		if (item->kind == K_PLUS) break;
+		emit_(out, indent + 1, "++at;");
+	} // Check the items.
+	emit_(out, indent, "}");
+}
+
+static void gen_(text * out, node * here, int fail, int indent,
+		bool known);
+
+/**
+ * Generate an ordered choice whose alternatives the next character decides.
+ */
+static void
+gen_dispatch_(text * out, node * here, int fail, int indent, bool known) {
+	char test[128];
+	uses_ch_ = true;
+	if (! known) {
+		emit_(out, indent, "if (! %s_next_(parser, &ch)) %s", prefix_,
+				goto_(fail));
+	}
+	size_t cases = 0;
+	bool high = false;
+	for (size_t index = 0; index < here->count; ++index) {
+		cases += set_size_(&here->kids[index]->first);
+		high |= here->kids[index]->first.high;
+	} // Count the cases.
+	if (cases <= 32 && ! high) {
+		emit_(out, indent, "switch (ch) {");
+		for (size_t index = 0; index < here->count; ++index) {
+			node * kid = here->kids[index];
+			for (unsigned ch = 0; ch < 256; ++ch) {
+				if (! set_has_(&kid->first, ch)) continue;
+				if (ch >= ' ' && ch < 127 && ch != '\'' && ch != '\\') {
+					emit_(out, indent, "case '%c':", (char) ch);
+				} else {
+					emit_(out, indent, "case %u:", ch);
+				}
+			} // Emit the cases.
+			gen_(out, kid, fail, indent + 1, true);
+			emit_(out, indent + 1, "break;");
+		} // Emit the alternatives.
+		emit_(out, indent, "default:");
+		emit_(out, indent + 1, "%s", goto_(fail));
+		emit_(out, indent, "}");
+		return;
+	}
+	for (size_t index = 0; index < here->count; ++index) {
+		test_(test, sizeof(test), &here->kids[index]->first);
+		emit_(out, indent, "%sif (%s) {", index == 0 ? "" : "} else ", test);
+		gen_(out, here->kids[index], fail, indent + 1, true);
+	} // Emit the alternatives.
+	emit_(out, indent, "} else {");
+	emit_(out, indent + 1, "%s", goto_(fail));
+	emit_(out, indent, "}");
+}
+
+/**
+ * Generate an ordered choice that backtracks.
+ */
+static void
+gen_backtrack_(text * out, node * here, int fail, int indent, bool known) {
+	char test[128];
+	int done = new_label_();
+	(void) known;
+	for (size_t index = 0; index < here->count; ++index) {
+		node * kid = here->kids[index];
+		int next = new_label_();
+		if (! kid->nullable) {
+			// Skip alternatives that cannot start here.
+			uses_ch_ = true;
+			test_(test, sizeof(test), &kid->first);
+			emit_(out, indent, "if (! %s_next_(parser, &ch) || ! (%s)) %s",
+					prefix_, test, goto_(next));
+		}
+		if (atomic_(kid)) {
+			gen_(out, kid, next, indent, ! kid->nullable);
+		} else {
+			int cp = checkpoints_++;
+			int undo = new_label_();
+			emit_(out, indent, "cp%d = spsps_checkpoint(parser);", cp);
+			gen_(out, kid, undo, indent, ! kid->nullable);
+			emit_(out, indent, "spsps_commit(parser, cp%d);", cp);
+			emit_(out, indent, "%s", goto_(done));
+			emit_label_(out, indent + 1, undo);
+			emit_(out, indent, "spsps_restore(parser, cp%d);", cp);
+		}
+		if (atomic_(kid)) emit_(out, indent, "%s", goto_(done));
+		emit_label_(out, indent + 1, next);
+	} // Try the alternatives in order.
+	emit_(out, indent, "%s", goto_(fail));
+	emit_label_(out, indent + 1, done);
+	emit_(out, indent, ";");
+}
+
+static void
+gen_choice_(text * out, node * here, int fail, int indent, bool known) {
+	if (decides_(here)) {
+		gen_dispatch_(out, here, fail, indent, known);
+	} else {
+		gen_backtrack_(out, here, fail, indent, known);
+	}
+}
+
+static void
+gen_repeat_(text * out, node * here, int fail, int indent, bool known) {
+	char test[128];
+	node * kid = here->kids[0];
+	if (here->kind == K_PLUS) {
+		gen_(out, kid, fail, indent, known);
+	}
+	if (kid->kind == K_SET && here->kind != K_OPT) {
+		// Runs of a class are scanned in place.
+		emit_(out, indent, "%s_scan_(parser, %s_set%zu_, %s);", prefix_,
+				prefix_, table_for_(&kid->chars),
+				kid->chars.high ? "true" : "false");
+		return;
+	}
+	if (! kid->nullable) {
+		// The body is only tried when it can start.  If it can then fail
+		// having consumed something, either look ahead to see whether it
+		// will match, or go back to where it started if it does not.
+		uses_ch_ = true;
+		test_(test, sizeof(test), &kid->first);
+		size_t look = 0;
+		bool clean = fails_clean_(kid);
+		bool guard = ! clean && guarded_(kid, &look);
+		bool restore = ! clean && ! guard;
+		int stop = new_label_();
+		int cp = restore ? checkpoints_++ : 0;
+		int undo = restore ? new_label_() : stop;
+		emit_(out, indent, "%s (%s_next_(parser, &ch) && (%s)) {",
+				here->kind == K_OPT ? "if" : "while", prefix_, test);
+		if (guard) {
+			gen_guard_(out, kid, look, stop, indent + 1);
+			// The guard has overwritten ch.
+			emit_(out, indent + 1, "%s_next_(parser, &ch);", prefix_);
+		}
+		if (restore) {
+			emit_(out, indent + 1, "cp%d = spsps_checkpoint(parser);", cp);
+		}
+		gen_(out, kid, undo, indent + 1, true);
+		if (restore) {
+			emit_(out, indent + 1, "spsps_commit(parser, cp%d);", cp);
+			emit_(out, indent + 1, "%s", here->kind == K_OPT ? goto_(stop) :
+					"continue;");
+			emit_label_(out, indent + 2, undo);
+			emit_(out, indent + 1, "spsps_restore(parser, cp%d);", cp);
+			emit_(out, indent + 1, "%s", goto_(stop));
+		}
+		emit_(out, indent, "%s", here->kind == K_OPT ? "}" :
+				"} // Repeat while the body can start.");
+		if (label_used_[stop]) {
+			emit_label_(out, indent + 1, stop);
+			emit_(out, indent, ";");
+		}
+		return;
+	}
+	// The body can match the empty string, so this has to backtrack.
+	int cp = checkpoints_++;
+	int undo = new_label_();
+	if (here->kind == K_OPT) {
+		int done = new_label_();
+		emit_(out, indent, "cp%d = spsps_checkpoint(parser);", cp);
+		gen_(out, kid, undo, indent, false);
+		emit_(out, indent, "spsps_commit(parser, cp%d);", cp);
+		emit_(out, indent, "%s", goto_(done));
+		emit_label_(out, indent + 1, undo);
+		emit_(out, indent, "spsps_restore(parser, cp%d);", cp);
+		emit_label_(out, indent + 1, done);
+		emit_(out, indent, ";");
+		return;
+	}
+	emit_(out, indent, "for (;;) {");
+	emit_(out, indent + 1, "uint64_t before = spsps_offset(parser);");
+	emit_(out, indent + 1, "cp%d = spsps_checkpoint(parser);", cp);
+	gen_(out, kid, undo, indent + 1, false);
+	emit_(out, indent + 1, "spsps_commit(parser, cp%d);", cp);
+	emit_(out, indent + 1, "if (spsps_offset(parser) == before) break;");
+	emit_(out, indent + 1, "continue;");
+	emit_label_(out, indent + 2, undo);
+	emit_(out, indent + 1, "spsps_restore(parser, cp%d);", cp);
+	emit_(out, indent + 1, "break;");
+	emit_(out, indent, "} // Repeat until the body fails.");
+}
+
+static void
+gen_predicate_(text * out, node * here, int fail, int indent, bool known) {
+	char test[128];
+	node * kid = here->kids[0];
+	bool negate = here->kind == K_NOT;
+	(void) known;
+	if (kid->kind == K_SET) {
+		uses_ch_ = true;
+		test_(test, sizeof(test), &kid->chars);
+		emit_(out, indent, "if (%s(%s_next_(parser, &ch) && (%s))) %s",
+				negate ? "" : "! ", prefix_, test, goto_(fail));
+		return;
+	}
+	if (kid->kind == K_STRING) {
+		emit_(out, indent, "if (%s%s_look_(parser, %s_str%d_, %zu)) %s",
+				negate ? "" : "! ", prefix_, prefix_, kid->literal,
+				kid->length, goto_(fail));
+		return;
+	}
+	int cp = checkpoints_++;
+	int undo = new_label_();
+	emit_(out, indent, "cp%d = spsps_checkpoint(parser);", cp);
+	gen_(out, kid, undo, indent, false);
+	emit_(out, indent, "spsps_restore(parser, cp%d);", cp);
+	if (negate) {
+		emit_(out, indent, "%s", goto_(fail));
+		emit_label_(out, indent + 1, undo);
+		emit_(out, indent, "spsps_restore(parser, cp%d);", cp);
+	} else {
+		int done = new_label_();
+		emit_(out, indent, "%s", goto_(done));
+		emit_label_(out, indent + 1, undo);
+		emit_(out, indent, "spsps_restore(parser, cp%d);", cp);
+		emit_(out, indent, "%s", goto_(fail));
+		emit_label_(out, indent + 1, done);
+		emit_(out, indent, ";");
+	}
+}
+
+/// The string literals, which become static arrays.
+static node ** strings_ = NULL;
+static int string_count_ = 0;
+
+static void
+number_strings_(node * here) {
+	if (here->kind == K_STRING) {
+		here->literal = string_count_;
+		strings_ = (node **) realloc(strings_,
+				sizeof(node *) * (size_t) (string_count_ + 1));
+		strings_[string_count_++] = here;
+	}
+	for (size_t index = 0; index < here->count; ++index) {
+		number_strings_(here->kids[index]);
+	} // Number the subexpressions.
+}
+
+/**
+ * Generate code that matches an expression and jumps to the fail label if
+ * it does not match.
+ * @param out				The output.
+ * @param here				The expression.
+ * @param fail				The label to jump to on failure.
+ * @param indent			The indentation.
+ * @param known				Whether ch already holds the next character, and
+ *							it is one that can start the expression.
+ */
+static void
+gen_(text * out, node * here, int fail, int indent, bool known) {
+	char test[128];
+	switch (here->kind) {
+	case K_EMPTY:
+		break;
+	case K_SET:
+		if (! known) {
+			uses_ch_ = true;
+			test_(test, sizeof(test), &here->chars);
+			emit_(out, indent, "if (! %s_next_(parser, &ch) || ! (%s)) %s",
+					prefix_, test, goto_(fail));
+		}
+		emit_(out, indent, "spsps_consume_n_inline(parser, 1);");
+		break;
+	case K_STRING:
+		emit_(out, indent, "if (! %s_look_(parser, %s_str%d_, %zu)) %s",
+				prefix_, prefix_, here->literal, here->length, goto_(fail));
+		emit_(out, indent, "spsps_consume_n_inline(parser, %zu);",
+				here->length);
+		break;
+	case K_RULE:
+		emit_(out, indent, "if (! %s_%s_(parser, context)) %s", prefix_,
+				rules_[here->rule].name, goto_(fail));
+		break;
+	case K_SEQ:
+		for (size_t index = 0; index < here->count; ++index) {
+			gen_(out, here->kids[index], fail, indent, known && index == 0 &&
+					! here->kids[0]->nullable);
+		} // Match each item.
+		break;
+	case K_CHOICE:
+		gen_choice_(out, here, fail, indent, known);
+		break;
+	case K_STAR:
+	case K_PLUS:
+	case K_OPT:
+		gen_repeat_(out, here, fail, indent, known);
+		break;
+	case K_NOT:
+	case K_AND:
+		gen_predicate_(out, here, fail, indent, known);
+		break;
+	}
+}
+
+static void
+write_rule_(text * out, rule * here) {
+	text body = { NULL, 0, 0 };
+	label_count_ = 0;
+	checkpoints_ = 0;
+	uses_ch_ = false;
+	int fail = new_label_();
+	// A rule that could fail after consuming something either looks ahead
+	// to see whether it will match, or goes back to where it started.
+	size_t look = 0;
+	bool clean = fails_clean_(here->body);
+	if (! clean && guarded_(here->body, &look)) {
+		gen_guard_(&body, here->body, look, fail, 1);
+		clean = true;
+	}
+	gen_(&body, here->body, fail, 1, false);
+	int undo = -1;
+	if (label_used_[fail] && ! clean) undo = checkpoints_++;
+	emit_(out, 0, "static bool");
+	emit_(out, 0, "%s_%s_(Parser parser, void * context) {", prefix_,
+			here->name);
+	if (uses_ch_) emit_(out, 1, "unsigned long ch;");
+	for (int cp = 0; cp < checkpoints_; ++cp) {
+		emit_(out, 1, "Checkpoint cp%d;", cp);
+	} // Declare the checkpoints.
+	if (here->hook) emit_(out, 1, "Mark mark = spsps_mark(parser);");
+	if (undo >= 0) emit_(out, 1, "cp%d = spsps_checkpoint(parser);", undo);
+	if (body.data != NULL) append_(out, body.data, body.length);
+	if (undo >= 0) emit_(out, 1, "spsps_commit(parser, cp%d);", undo);
+	if (here->hook) {
+		emit_(out, 1, "{");
+		emit_(out, 2, "size_t length;");
+		emit_(out, 2, "const SPSPS_CHAR * text = spsps_slice(parser, mark, "
+				"&length);");
+		emit_(out, 2, "%s_on_%s(context, text, length);", prefix_,
+				here->name);
+		emit_(out, 1, "}");
+		emit_(out, 1, "spsps_unmark(parser, mark);");
+	}
+	emit_(out, 1, "return true;");
+	if (label_used_[fail]) {
+		emit_(out, 0, "L%d_:", fail);
+		if (undo >= 0) emit_(out, 1, "spsps_restore(parser, cp%d);", undo);
+		if (here->hook) emit_(out, 1, "spsps_unmark(parser, mark);");
+		emit_(out, 1, "return false;");
+	}
+	emit_(out, 0, "}\n");
+	free(body.data);
+}
+
+static void
+write_prelude_(FILE * out, const char * header) {
+	const char * base = strrchr(header, '/');
+	base = base == NULL ? header : base + 1;
+	fprintf(out, "// Generated by spsps_gen from %s.  Do not edit.\n\n",
+			grammar_name_);
+	fprintf(out, "#include \"%s\"\n#include <parser_inline.h>\n\n", base);
+	fprintf(out,
+		"/// The code of a character, without sign extension.\n"
+		"#define %s_CODE_(m_ch) (sizeof(SPSPS_CHAR) == 1 ? \\\n"
+		"\t(unsigned long) (unsigned char) (m_ch) : (unsigned long) (m_ch))\n"
+		"\n"
+		"/// Whether a character is in a set with the given table.\n"
+		"#define %s_IN_(m_table, m_high, m_ch) \\\n"
+		"\t((m_ch) < 256 ? (m_table)[m_ch] : (m_high))\n\n",
+		prefix_, prefix_);
+	for (size_t index = 0; index < rule_count_; ++index) {
+		if (! rules_[index].used) continue;
+		fprintf(out, "static bool %s_%s_(Parser parser, void * context);\n",
+				prefix_, rules_[index].name);
+	} // Declare the rules.
+	fprintf(out, "\n");
+	for (int index = 0; index < string_count_; ++index) {
+		fprintf(out, "static const unsigned char %s_str%d_[] = {", prefix_,
+				index);
+		for (size_t at = 0; at < strings_[index]->length; ++at) {
+			fprintf(out, "%s%u", at == 0 ? " " : ", ",
+					(unsigned char) strings_[index]->text[at]);
+		} // Write the characters.
+		fprintf(out, " };\n");
+	} // Write the strings.
+	fprintf(out,
+		"\n"
+		"/**\n"
+		" * Get the code of the next character without consuming it.\n"
+		" * @return\t\t\t\t\tFalse at the end of the input.\n"
+		" */\n"
+		"static inline bool\n"
+		"%s_next_(Parser parser, unsigned long * ch) {\n"
+		"\tsize_t available;\n"
+		"\tconst SPSPS_CHAR * window = spsps_window_inline(parser, 1,\n"
+		"\t\t\t&available);\n"
+		"\tif (available == 0) return false;\n"
+		"\t*ch = %s_CODE_(window[0]);\n"
+		"\treturn true;\n"
+		"}\n\n", prefix_, prefix_);
+	fprintf(out,
+		"/**\n"
+		" * Check whether a literal comes next, without consuming it.\n"
+		" */\n"
+		"static inline bool\n"
+		"%s_look_(Parser parser, const unsigned char * str, size_t n) {\n"
+		"\tsize_t available;\n"
+		"\tconst SPSPS_CHAR * window = spsps_window_inline(parser, n,\n"
+		"\t\t\t&available);\n"
+		"\tif (available < n) return false;\n"
+		"\tfor (size_t index = 0; index < n; ++index) {\n"
+		"\t\tif (%s_CODE_(window[index]) != str[index]) return false;\n"
+		"\t} // Compare the characters.\n"
+		"\treturn true;\n"
+		"}\n\n", prefix_, prefix_);
+	fprintf(out,
+		"/**\n"
+		" * Consume a run of characters from a set, scanning the buffer in "
+		"place.\n"
+		" */\n"
+		"static inline void\n"
+		"%s_scan_(Parser parser, const unsigned char * table, bool high) {\n"
+		"\twhile (true) {\n"
+		"\t\tsize_t available;\n"
+		"\t\tconst SPSPS_CHAR * window = spsps_window_inline(parser, 1,\n"
+		"\t\t\t\t&available);\n"
+		"\t\tsize_t index = 0;\n"
+		"\t\twhile (index < available &&\n"
+		"\t\t\t\t%s_IN_(table, high, %s_CODE_(window[index]))) ++index;\n"
+		"\t\tif (index > 0) spsps_consume_n_inline(parser, index);\n"
+		"\t\tif (index < available || available == 0) return;\n"
+		"\t} // Scan the buffered characters.\n"
+		"}\n\n", prefix_, prefix_, prefix_);
+}
+
+static void
+write_tables_(FILE * out) {
+	for (size_t index = 0; index < table_count_; ++index) {
+		fprintf(out, "static const unsigned char %s_set%zu_[256] = {",
+				prefix_, index);
+		for (unsigned ch = 0; ch < 256; ++ch) {
+			fprintf(out, "%s%d", ch == 0 ? "\n\t" : ch % 32 == 0 ? ",\n\t" : ",",
+					set_has_(&tables_[index], ch) ? 1 : 0);
+		} // Write the table.
+		fprintf(out, "\n};\n");
+	} // Write all tables.
+	fprintf(out, "\n");
+}
+
+static void
+write_header_(FILE * out) {
+	char * guard = strdup(prefix_);
+	for (char * at = guard; *at != 0; ++at) {
+		if (*at >= 'a' && *at <= 'z') *at = (char) (*at - 'a' + 'A');
+	} // Make the guard upper case.
+	fprintf(out, "// Generated by spsps_gen from %s.  Do not edit.\n\n",
+			grammar_name_);
+	fprintf(out, "#ifndef %s_GEN_H_\n#define %s_GEN_H_\n\n", guard, guard);
+	fprintf(out, "#include <parser.h>\n\n");
+	fprintf(out, "/**\n * Parse the input with the %s rule.  The parser is "
+			"left after the\n * matched text.\n * @param parser\t\t\tThe "
+			"parser.\n * @param context\t\t\tPassed to the event functions."
+			"\n * @return\t\t\t\t\tWhether the rule matched.\n */\n"
+			"bool %s_parse(Parser parser, void * context);\n\n", start_,
+			prefix_);
+	for (size_t index = 0; index < rule_count_; ++index) {
+		if (! rules_[index].used || ! rules_[index].hook) continue;
+		fprintf(out, "/// Called by the generated parser when %s matches.  "
+				"Define this.\nvoid %s_on_%s(void * context, const SPSPS_CHAR "
+				"* text, size_t length);\n\n", rules_[index].name, prefix_,
+				rules_[index].name);
+	} // Declare the events.
+	fprintf(out, "#endif /* %s_GEN_H_ */\n", guard);
+	free(guard);
+}
+
+int
+main(int argc, char * argv[]) {
+	if (argc != 4) {
+		fprintf(stderr, "Usage: %s grammar output.c output.h\n", argv[0]);
+		return 1;
+	}
+	grammar_name_ = argv[1];
+	FILE * in = fopen(argv[1], "rb");
+	if (in == NULL) die_(0, "cannot read the grammar");
+	char * source = NULL;
+	size_t length = 0;
+	size_t got;
+	char block[4096];
+	while ((got = fread(block, 1, sizeof(block), in)) > 0) {
+		source = (char *) realloc(source, length + got + 1);
+		memcpy(source + length, block, got);
+		length += got;
+	} // Read the grammar.
+	fclose(in);
+	if (source == NULL) die_(0, "the grammar is empty");
+	source[length] = 0;
+	src_ = source;
+	read_grammar_();
+	analyze_grammar_();
+	for (size_t index = 0; index < rule_count_; ++index) {
+		number_strings_(rules_[index].body);
+	} // Collect the literals.
+
+	// Generate the rules first, so the tables they use are known, then
+	// put the tables ahead of them.
+	text code = { NULL, 0, 0 };
+	for (size_t index = 0; index < rule_count_; ++index) {
+		if (rules_[index].used) write_rule_(&code, &rules_[index]);
+	} // Generate the rules.
+	FILE * out = fopen(argv[2], "w");
+	if (out == NULL) die_(0, "cannot write %s", argv[2]);
+	write_prelude_(out, argv[3]);
+	write_tables_(out);
+	fputs(code.data, out);
+	fprintf(out, "bool\n%s_parse(Parser parser, void * context) {\n"
+			"\treturn %s_%s_(parser, context);\n}\n", prefix_, prefix_,
+			start_);
+	fclose(out);
+	free(code.data);
+	out = fopen(argv[3], "w");
+	if (out == NULL) die_(0, "cannot write %s", argv[3]);
+	write_header_(out);
+	fclose(out);
+	free(source);
+	return 0;
+}